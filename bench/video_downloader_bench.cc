@@ -0,0 +1,704 @@
+// Microbenchmarks for the segment hot paths: playlist parsing, decryption,
+// the curl write callback and merging/ordered output.
+//
+// The decrypt/cbc_* and decrypt/stage_* cases decrypt in place the way the
+// decrypt stage does and also report GB/s per core, on one thread and on
+// every hardware thread. decrypt/pooled_to_file adds what merge mode does
+// around it: unpad the pooled body and write the plaintext once.
+//
+//   video_downloader_bench [--size-mb N] [--segment-kb N] [--lines N]
+//                          [--iterations N] [--filter TEXT] [--format text|json]
+//                          [--dir PATH] [--url PLAYLIST] [--transfers N]
+//
+// Every case runs --iterations times and reports the median throughput,
+// p50/p90/p99 iteration time and heap allocations per iteration. With
+// --format json the results are printed as one JSON document so a CI job
+// can compare them against a previous build.
+//
+// With --url the net/* cases download that playlist with the multi engine
+// over HTTP/1.1 and over HTTP/2 and also report the connections opened,
+// e.g. against a local h2 server (nghttpd, or nghttpx in front of any
+// HTTP/1.1 server).
+#include "video_downloader.h"
+#include "segment_decryptor.h"
+#include "decrypt_stage.h"
+#include "m3u8_parser.h"
+#include "file_copy.h"
+#include "ordered_output.h"
+#include "checksum.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fcntl.h>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include <nlohmann/json.hpp>
+#include <openssl/evp.h>
+
+// 统计堆分配次数，用于比较各路径的分配开销
+static std::atomic<size_t> g_allocations{0};
+
+void *operator new(size_t size)
+{
+  g_allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void *p = std::malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete(void *p, size_t) noexcept { std::free(p); }
+
+namespace
+{
+  // 与setupCurlCommonOpts中的CURLOPT_BUFFERSIZE一致，模拟curl写回调的分块大小
+  constexpr size_t kCurlChunkSize = 102400;
+
+  struct BenchOptions
+  {
+    size_t size_mb = 64;
+    size_t segment_kb = 2048; // merge/ordered output cases split the payload into segments of this size
+    size_t lines = 0;         // playlist lines, 0 = 10k, 100k and 1M
+    size_t iterations = 5;
+    std::string filter;
+    std::string format = "text";
+    std::string dir = std::filesystem::temp_directory_path().string();
+    std::string url;        // playlist for the net/* cases, empty = skipped
+    size_t transfers = 32;  // net/* cases: concurrent transfers of the multi engine
+  };
+
+  struct BenchResult
+  {
+    std::string name;
+    size_t bytes = 0;
+    std::vector<double> seconds; // one sample per iteration
+    size_t allocations = 0;      // per iteration, averaged
+    bool ok = true;
+    nlohmann::json counters = nlohmann::json::object(); // case-specific values of the last iteration
+  };
+
+  double percentile(std::vector<double> samples, double p)
+  {
+    std::sort(samples.begin(), samples.end());
+    size_t rank = static_cast<size_t>(p / 100.0 * (samples.size() - 1) + 0.5);
+    return samples[std::min(rank, samples.size() - 1)];
+  }
+
+  class BenchRunner
+  {
+  public:
+    explicit BenchRunner(const BenchOptions &options) : options_(options) {}
+
+    bool enabled(const std::string &name) const
+    {
+      return options_.filter.empty() || name.find(options_.filter) != std::string::npos;
+    }
+
+    // 整组用例都被过滤掉时跳过准备数据
+    bool anyEnabled(std::initializer_list<std::string> names) const
+    {
+      return std::any_of(names.begin(), names.end(), [this](const std::string &name)
+                         { return enabled(name); });
+    }
+
+    // fn返回是否成功；setup在每次计时前执行，verify在最后一次计时后检查输出，都不计入耗时和分配次数；
+    // counters在最后取一次，附加到结果中
+    void run(const std::string &name, size_t bytes, const std::function<bool()> &fn,
+             const std::function<bool()> &verify = nullptr, const std::function<void()> &setup = nullptr,
+             const std::function<nlohmann::json()> &counters = nullptr)
+    {
+      if (!enabled(name))
+        return;
+
+      BenchResult result;
+      result.name = name;
+      result.bytes = bytes;
+      size_t allocations = 0;
+      for (size_t i = 0; i < std::max<size_t>(1, options_.iterations); ++i)
+      {
+        if (setup)
+          setup();
+        size_t before = g_allocations.load();
+        auto start = std::chrono::steady_clock::now();
+        bool ok = fn();
+        result.seconds.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+        allocations += g_allocations.load() - before;
+        result.ok = result.ok && ok;
+      }
+      result.allocations = allocations / result.seconds.size();
+      if (verify)
+        result.ok = verify() && result.ok;
+      if (counters)
+        result.counters = counters();
+
+      if (options_.format == "text")
+        printText(result);
+      results_.push_back(std::move(result));
+    }
+
+    void printJson() const
+    {
+      nlohmann::json out;
+      out["payload_mb"] = options_.size_mb;
+      out["segment_kb"] = options_.segment_kb;
+      out["iterations"] = options_.iterations;
+      out["results"] = nlohmann::json::array();
+      for (const auto &result : results_)
+      {
+        const double p50 = percentile(result.seconds, 50);
+        out["results"].push_back({{"name", result.name},
+                                  {"bytes", result.bytes},
+                                  {"mb_per_s", result.bytes / (1024.0 * 1024.0) / p50},
+                                  {"p50_ms", p50 * 1000},
+                                  {"p90_ms", percentile(result.seconds, 90) * 1000},
+                                  {"p99_ms", percentile(result.seconds, 99) * 1000},
+                                  {"allocations", result.allocations},
+                                  {"counters", result.counters},
+                                  {"ok", result.ok}});
+      }
+      std::cout << out.dump(2) << std::endl;
+    }
+
+    bool allOk() const
+    {
+      return std::all_of(results_.begin(), results_.end(), [](const BenchResult &result)
+                         { return result.ok; });
+    }
+
+  private:
+    static void printText(const BenchResult &result)
+    {
+      const double p50 = percentile(result.seconds, 50);
+      std::cout << std::left << std::setw(40) << result.name << std::right << std::fixed << std::setprecision(1)
+                << std::setw(10) << result.bytes / (1024.0 * 1024.0) / p50 << " MB/s"
+                << std::setw(10) << p50 * 1000 << " p50"
+                << std::setw(10) << percentile(result.seconds, 90) * 1000 << " p90"
+                << std::setw(10) << percentile(result.seconds, 99) * 1000 << " p99 ms"
+                << std::setw(10) << result.allocations << " allocs";
+      for (const auto &counter : result.counters.items())
+        std::cout << "  " << counter.key() << "=" << counter.value().dump();
+      std::cout << (result.ok ? "" : "  (OUTPUT MISMATCH)") << std::endl;
+    }
+
+    const BenchOptions &options_;
+    std::vector<BenchResult> results_;
+  };
+
+  std::vector<uint8_t> randomBytes(size_t size)
+  {
+    std::vector<uint8_t> data(size);
+    std::mt19937_64 rng(42);
+    for (size_t i = 0; i + 8 <= size; i += 8)
+    {
+      uint64_t v = rng();
+      std::memcpy(&data[i], &v, 8);
+    }
+    return data;
+  }
+
+  std::vector<uint8_t> encrypt(const std::vector<uint8_t> &plain, const std::vector<uint8_t> &key,
+                               const uint8_t *iv = nullptr)
+  {
+    std::vector<uint8_t> cipher(plain.size() + EVP_MAX_BLOCK_LENGTH);
+    EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+    int len = 0, total = 0;
+    EVP_EncryptInit_ex(ctx, EVP_aes_128_cbc(), nullptr, key.data(), iv);
+    EVP_EncryptUpdate(ctx, cipher.data(), &len, plain.data(), static_cast<int>(plain.size()));
+    total = len;
+    EVP_EncryptFinal_ex(ctx, cipher.data() + total, &len);
+    total += len;
+    EVP_CIPHER_CTX_free(ctx);
+    cipher.resize(total);
+    return cipher;
+  }
+
+  std::vector<uint8_t> readFile(const std::string &path)
+  {
+    std::vector<uint8_t> data(std::filesystem::file_size(path));
+    FILE *fp = fopen(path.c_str(), "rb");
+    size_t n = fread(data.data(), 1, data.size(), fp);
+    fclose(fp);
+    data.resize(n);
+    return data;
+  }
+
+  // 解密阶段的做法：密文原地解密，按256 KB切分后由多个线程同时解密。计数器中的gb_per_s_per_core取最后一次
+  void benchParallelDecrypt(BenchRunner &runner, const BenchOptions &options)
+  {
+    // 调用线程也参与解密，所以worker比用到的线程数少一个
+    const size_t threads = std::max(2u, std::thread::hardware_concurrency());
+    const std::string stage_name = "decrypt/stage_" + std::to_string(threads) + "threads";
+    if (!runner.anyEnabled({"decrypt/cbc_blocks_1thread", stage_name, "decrypt/pooled_to_file"}))
+      return;
+
+    SegmentCipher segment_cipher;
+    const std::vector<uint8_t> key = randomBytes(16);
+    std::memcpy(segment_cipher.key, key.data(), sizeof(segment_cipher.key));
+    for (size_t i = 0; i < kAesBlockSize; ++i)
+      segment_cipher.iv[i] = static_cast<uint8_t>(i * 7 + 1);
+    const std::vector<uint8_t> plain = randomBytes(options.size_mb << 20);
+    const std::vector<uint8_t> cipher = encrypt(plain, key, segment_cipher.iv);
+
+    // 每次计时前恢复成密文；最后一块是填充，比较时去掉
+    std::vector<uint8_t> work(cipher.size());
+    auto setup = [&]
+    { std::memcpy(work.data(), cipher.data(), cipher.size()); };
+    auto verify = [&]
+    {
+      return unpaddedLength(work.data(), work.size()) == plain.size() &&
+             std::memcmp(work.data(), plain.data(), plain.size()) == 0;
+    };
+    double seconds = 0;
+    auto timed = [&](const std::function<bool()> &fn)
+    {
+      return [&, fn]
+      {
+        auto start = std::chrono::steady_clock::now();
+        bool ok = fn();
+        seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return ok;
+      };
+    };
+    auto per_core = [&](size_t cores)
+    {
+      return [&, cores]
+      { return nlohmann::json{{"threads", cores}, {"gb_per_s_per_core", cipher.size() / seconds / cores / 1e9}}; };
+    };
+
+    runner.run("decrypt/cbc_blocks_1thread", cipher.size(), timed([&]
+                                                                  { return decryptBlocks(segment_cipher.key, segment_cipher.iv,
+                                                                                         work.data(), work.size()); }),
+               verify, setup, per_core(1));
+
+    DecryptStage stage(threads - 1);
+    std::vector<DecryptStage::Range> ranges;
+    for (size_t pos = 0; pos < work.size(); pos += DecryptStage::kParallelRange)
+      ranges.emplace_back(work.data() + pos, std::min(DecryptStage::kParallelRange, work.size() - pos));
+    runner.run(stage_name, cipher.size(), timed([&]
+                                                { return stage.decrypt(segment_cipher, ranges); }),
+               verify, setup, per_core(threads));
+
+    // merge模式的完整路径：密文在缓冲池中解密、去掉填充，明文只写一次片段文件
+    const std::string out_path = options.dir + "/vd_bench_segment.ts";
+    BufferPool pool;
+    PooledBuffer body(&pool);
+    runner.run("decrypt/pooled_to_file", cipher.size(), [&]
+               {
+                 auto body_ranges = body.ranges();
+                 if (!stage.decrypt(segment_cipher, body_ranges))
+                   return false;
+                 const auto &last = body_ranges.back();
+                 body.truncate(body.size() - kAesBlockSize +
+                               unpaddedLength(last.first + last.second - kAesBlockSize, kAesBlockSize));
+                 FILE *fp = fopen(out_path.c_str(), "wb");
+                 if (!fp)
+                   return false;
+                 bool ok = body.forEach([&](const uint8_t *data, size_t len)
+                                        { return fwrite(data, 1, len, fp) == len; });
+                 return fclose(fp) == 0 && ok; },
+               [&]
+               { return readFile(out_path) == plain; },
+               [&]
+               {
+                 body.clear();
+                 body.append(cipher.data(), cipher.size());
+               });
+    std::filesystem::remove(out_path);
+  }
+
+  // 与writeSegmentData相同：每块先更新XXH64，再写临时文件或追加到内存中的片段
+  void benchWriteCallbacks(BenchRunner &runner, const BenchOptions &options)
+  {
+    if (!runner.anyEnabled({"write/file_xxh64", "write/memory_xxh64", "write/pooled_xxh64"}))
+      return;
+
+    const std::vector<uint8_t> payload = randomBytes(options.size_mb << 20);
+    const size_t segment_size = std::max<size_t>(1, options.segment_kb) << 10;
+    const std::string out_path = options.dir + "/vd_bench_write.ts.temp";
+    const uint64_t expected = Xxh64::hash(payload.data(), payload.size());
+
+    runner.run("write/file_xxh64", payload.size(), [&]
+               {
+                 Xxh64 checksum;
+                 FILE *fp = fopen(out_path.c_str(), "wb");
+                 for (size_t off = 0; off < payload.size(); off += kCurlChunkSize)
+                 {
+                   size_t len = std::min(kCurlChunkSize, payload.size() - off);
+                   checksum.update(payload.data() + off, len);
+                   fwrite(payload.data() + off, 1, len, fp);
+                 }
+                 fclose(fp);
+                 return checksum.digest() == expected; });
+
+    // stream模式：片段体在内存中增长，每个片段交给重排序缓冲区后重新开始
+    runner.run("write/memory_xxh64", payload.size(), [&]
+               {
+                 Xxh64 checksum;
+                 uint64_t total = 0;
+                 for (size_t start = 0; start < payload.size(); start += segment_size)
+                 {
+                   const size_t end = std::min(payload.size(), start + segment_size);
+                   std::vector<uint8_t> body;
+                   for (size_t off = start; off < end; off += kCurlChunkSize)
+                   {
+                     size_t len = std::min(kCurlChunkSize, end - off);
+                     checksum.update(payload.data() + off, len);
+                     body.insert(body.end(), payload.data() + off, payload.data() + off + len);
+                   }
+                   total += body.size();
+                 }
+                 return total == payload.size() && checksum.digest() == expected; });
+
+    // 当前stream模式：片段体写入缓冲池的固定大小块，交出后块回到池中被下一个片段复用
+    BufferPool pool;
+    runner.run("write/pooled_xxh64", payload.size(), [&]
+               {
+                 Xxh64 checksum;
+                 uint64_t total = 0;
+                 for (size_t start = 0; start < payload.size(); start += segment_size)
+                 {
+                   const size_t end = std::min(payload.size(), start + segment_size);
+                   PooledBuffer body(&pool);
+                   for (size_t off = start; off < end; off += kCurlChunkSize)
+                   {
+                     size_t len = std::min(kCurlChunkSize, end - off);
+                     checksum.update(payload.data() + off, len);
+                     body.append(payload.data() + off, len);
+                   }
+                   total += body.size();
+                 }
+                 return total == payload.size() && checksum.digest() == expected; },
+               nullptr, nullptr, [&]
+               { return nlohmann::json{{"pool_peak_kb", pool.peakBytes() >> 10}}; });
+
+    std::filesystem::remove(out_path);
+  }
+
+  // 把负载切成片段文件，与merge模式下载完成后的目录一致
+  std::vector<std::string> writeSegments(const BenchOptions &options, const std::vector<uint8_t> &payload,
+                                         size_t segment_size)
+  {
+    std::vector<std::string> paths;
+    for (size_t off = 0, i = 0; off < payload.size(); off += segment_size, ++i)
+    {
+      paths.push_back(options.dir + "/vd_bench_segment_" + std::to_string(i) + ".ts");
+      FILE *fp = fopen(paths.back().c_str(), "wb");
+      fwrite(payload.data() + off, 1, std::min(segment_size, payload.size() - off), fp);
+      fclose(fp);
+    }
+    return paths;
+  }
+
+  void benchMerge(BenchRunner &runner, const BenchOptions &options)
+  {
+    if (!runner.anyEnabled({"merge/legacy_stream_copy", "merge/file_appender", "merge/ordered_output_shuffled",
+                            "merge/ordered_output_shuffled_spill"}))
+      return;
+
+    const std::vector<uint8_t> payload = randomBytes(options.size_mb << 20);
+    const size_t segment_size = std::max<size_t>(1, options.segment_kb) << 10;
+    const std::string out_path = options.dir + "/vd_bench_merged.ts";
+    // 落盘的乱序片段放在单独的目录里，不会碰到目录中已有的segment_N.ts
+    const std::string spill_dir = options.dir + "/vd_bench_spill/";
+    std::filesystem::create_directories(spill_dir);
+    const std::vector<std::string> paths = writeSegments(options, payload, segment_size);
+
+    // 原mergeSegments的做法：ifstream整块读入再用ofstream写出
+    runner.run("merge/legacy_stream_copy", payload.size(), [&]
+               {
+                 std::ofstream output(out_path, std::ios::binary | std::ios::trunc);
+                 std::vector<char> buffer(1 << 20);
+                 for (const auto &path : paths)
+                 {
+                   std::ifstream input(path, std::ios::binary);
+                   while (input.read(buffer.data(), buffer.size()) || input.gcount() > 0)
+                     output.write(buffer.data(), input.gcount());
+                 }
+                 output.close();
+                 return output.good(); },
+               [&]
+               { return readFile(out_path) == payload; });
+
+    // 当前mergeSegments：FileAppender依次尝试reflink、copy_file_range、sendfile
+    runner.run("merge/file_appender", payload.size(), [&]
+               {
+                 int fd = ::open(out_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+                 FileAppender appender(fd, 0);
+                 appender.preallocate(payload.size());
+                 bool ok = true;
+                 for (const auto &path : paths)
+                   ok = appender.append(path) && ok;
+                 close(fd);
+                 return ok; },
+               [&]
+               { return readFile(out_path) == payload; });
+
+    // stream模式：片段乱序到达，经重排序缓冲区按序写出；缓冲区只够放一半时其余片段落盘
+    std::vector<size_t> order(paths.size());
+    for (size_t i = 0; i < order.size(); ++i)
+      order[i] = i;
+    std::shuffle(order.begin(), order.end(), std::mt19937(7));
+
+    for (size_t limit : {payload.size(), payload.size() / 2})
+    {
+      BufferPool pool;
+      std::vector<PooledBuffer> bodies;
+      runner.run(std::string("merge/ordered_output_shuffled") + (limit < payload.size() ? "_spill" : ""), payload.size(), [&]
+                 {
+                   OrderedOutput output(out_path, spill_dir, limit);
+                   bool ok = output.open(order.size());
+                   for (size_t index : order)
+                     ok = output.deliver(index, std::move(bodies[index])) && ok;
+                   return output.finish() && ok; },
+                 [&]
+                 { return readFile(out_path) == payload; },
+                 [&]
+                 {
+                   // 片段体在计时之外准备好，与下载完成时交给deliver的数据一致
+                   std::filesystem::remove(out_path + ".progress");
+                   bodies.clear();
+                   for (size_t off = 0; off < payload.size(); off += segment_size)
+                   {
+                     bodies.emplace_back(&pool);
+                     bodies.back().append(payload.data() + off, std::min(segment_size, payload.size() - off));
+                   }
+                 });
+    }
+
+    for (const auto &path : paths)
+      std::filesystem::remove(path);
+    std::filesystem::remove(out_path);
+    std::filesystem::remove_all(spill_dir);
+  }
+
+  // 合成的点播播放列表：头部若干标签，之后每个片段一行EXTINF一行相对URI
+  std::string syntheticPlaylist(size_t lines)
+  {
+    std::string content = "#EXTM3U\n#EXT-X-VERSION:3\n#EXT-X-TARGETDURATION:10\n#EXT-X-MEDIA-SEQUENCE:0\n"
+                          "#EXT-X-KEY:METHOD=AES-128,URI=\"/keys/key.bin\"\n";
+    char line[64];
+    for (size_t i = 0; i < lines / 2; ++i)
+    {
+      int n = snprintf(line, sizeof(line), "#EXTINF:10.010,\nvod/1080p/segment_%07zu.ts\n", i);
+      content.append(line, n);
+    }
+    content += "#EXT-X-ENDLIST\n";
+    return content;
+  }
+
+  // 原parseM3U8的做法：istringstream逐行读取，erase去空白，逐个片段拼接URL
+  std::vector<std::string> legacyParse(const std::string &content, const std::string &baseurl)
+  {
+    std::vector<std::string> segments;
+    std::istringstream stream(content);
+    std::string line;
+    std::getline(stream, line);
+    while (std::getline(stream, line))
+    {
+      line.erase(0, line.find_first_not_of(" \t\r\n"));
+      line.erase(line.find_last_not_of(" \t\r\n") + 1);
+      if (line.empty() || line[0] == '#')
+        continue;
+      if (line.find("://") != std::string::npos)
+        segments.push_back(line);
+      else
+      {
+        if (baseurl.back() == '/' && line[0] == '/')
+          line = line.substr(1);
+        segments.push_back(baseurl + line);
+      }
+    }
+    return segments;
+  }
+
+  void benchParse(BenchRunner &runner, const BenchOptions &options)
+  {
+    const std::string baseurl = "https://cdn.example.com/media/";
+    std::vector<size_t> sizes = {10000, 100000, 1000000};
+    if (options.lines > 0)
+      sizes = {options.lines};
+
+    for (size_t lines : sizes)
+    {
+      const std::string suffix = "_" + std::to_string(lines / 1000) + "k";
+      if (!runner.anyEnabled({"parse/legacy_istringstream" + suffix, "parse/string_view_table" + suffix,
+                              "parse/string_view_table+urls" + suffix}))
+        continue;
+
+      const std::string content = syntheticPlaylist(lines);
+      const std::vector<std::string> expected = legacyParse(content, baseurl);
+
+      runner.run("parse/legacy_istringstream" + suffix, content.size(), [&]
+                 { return legacyParse(content, baseurl).size() == expected.size(); });
+
+      // 只解析：片段表中全部是指向原缓冲区的string_view
+      M3U8Playlist playlist;
+      runner.run("parse/string_view_table" + suffix, content.size(), [&]
+                 { return parseMediaPlaylist(content, playlist) && playlist.segments.size() == expected.size(); });
+
+      // 解析后按需拼接URL，复用同一个缓冲区
+      runner.run("parse/string_view_table+urls" + suffix, content.size(), [&]
+                 {
+                   bool ok = parseMediaPlaylist(content, playlist) && playlist.segments.size() == expected.size();
+                   SegmentUrlResolver resolver("", baseurl);
+                   std::string url;
+                   for (size_t i = 0; ok && i < playlist.segments.size(); ++i)
+                   {
+                     resolver.resolve(playlist.segments[i].uri, url);
+                     ok = url == expected[i];
+                   }
+                   return ok; });
+    }
+  }
+
+  // 用multi引擎下载--url指定的播放列表，分别走HTTP/1.1和HTTP/2，比较吞吐和新建连接数
+  void benchNetwork(BenchRunner &runner, const BenchOptions &options)
+  {
+    if (options.url.empty() || !runner.anyEnabled({"net/multi_http1.1", "net/multi_http2"}))
+      return;
+
+    const std::string dir = options.dir + "/vd_bench_net/";
+    const size_t slash = options.url.rfind('/');
+    const size_t host_end = options.url.find('/', options.url.find("://") + 3);
+
+    VideoDownloader::Config base;
+    base.download_path = dir;
+    base.log_path = options.dir + "/vd_bench_net.log";
+    base.log_level = "error";
+    base.user_agent = "video_downloader_bench";
+    base.engine = "multi";
+    base.max_transfers = static_cast<int>(options.transfers);
+    base.retry_count = 1;
+    base.url = options.url;
+    base.baseurl = options.url.substr(0, slash + 1);
+    base.key_baseurl = options.url.substr(0, host_end);
+    base.output_name = "net";
+    base.metrics.json_path = dir + "metrics.json";
+
+    // 每次都从头下载：清掉上次的输出和断点记录，新建的下载器也不会复用上次的连接
+    auto reset = [&]
+    { std::filesystem::remove_all(dir); };
+    auto download = [&](bool http2)
+    {
+      VideoDownloader::Config config = base;
+      config.http2.enabled = http2;
+      VideoDownloader downloader;
+      downloader.setQuiet(true);
+      // 下载器的控制台信息会混进--format json的输出，下载期间丢弃
+      std::ostringstream discard;
+      std::streambuf *console = std::cout.rdbuf(discard.rdbuf());
+      const bool ok = downloader.setConfig(config) && downloader.downloadM3U8(config.url, config.output_name);
+      std::cout.rdbuf(console);
+      return ok;
+    };
+
+    // 先不计时下载一次，得到数据量，同时预热服务器端的缓存
+    reset();
+    if (!download(false))
+    {
+      std::cerr << "net: failed to download " << options.url << ", see " << base.log_path << std::endl;
+      return;
+    }
+    std::error_code ec;
+    const auto bytes = std::filesystem::file_size(dir + "net.ts", ec);
+    const std::string reference = options.dir + "/vd_bench_net_reference.ts";
+    std::filesystem::copy_file(dir + "net.ts", reference, std::filesystem::copy_options::overwrite_existing, ec);
+
+    auto counters = [&]
+    {
+      std::ifstream in(base.metrics.json_path);
+      nlohmann::json metrics = nlohmann::json::parse(in, nullptr, false);
+      if (metrics.is_discarded())
+        return nlohmann::json::object();
+      return nlohmann::json{{"connections", metrics.value("connections_opened", 0)},
+                            {"h2_transfers", metrics.value("http2_transfers", 0)},
+                            {"transfers", metrics["transfers"].value("ok", 0) + metrics["transfers"].value("failed", 0)}};
+    };
+    auto verify = [&]
+    {
+      std::ifstream a(dir + "net.ts", std::ios::binary), b(reference, std::ios::binary);
+      return std::equal(std::istreambuf_iterator<char>(a), std::istreambuf_iterator<char>(),
+                        std::istreambuf_iterator<char>(b), std::istreambuf_iterator<char>());
+    };
+
+    for (bool http2 : {false, true})
+      runner.run(http2 ? "net/multi_http2" : "net/multi_http1.1", static_cast<size_t>(bytes), [&]
+                 { return download(http2); }, verify, reset, counters);
+
+    std::filesystem::remove_all(dir);
+    std::filesystem::remove(reference, ec);
+  }
+
+  void printUsage()
+  {
+    std::cerr << "Usage: video_downloader_bench [--size-mb N] [--segment-kb N] [--lines N] [--iterations N]" << std::endl
+              << "                              [--filter TEXT] [--format text|json] [--dir PATH]" << std::endl
+              << "                              [--url PLAYLIST] [--transfers N]" << std::endl;
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  BenchOptions options;
+  for (int i = 1; i < argc; i += 2)
+  {
+    std::string arg = argv[i];
+    if (i + 1 >= argc)
+    {
+      printUsage();
+      return 1;
+    }
+    std::string value = argv[i + 1];
+    if (arg == "--size-mb")
+      options.size_mb = std::stoul(value);
+    else if (arg == "--segment-kb")
+      options.segment_kb = std::stoul(value);
+    else if (arg == "--lines")
+      options.lines = std::stoul(value);
+    else if (arg == "--iterations")
+      options.iterations = std::max<size_t>(1, std::stoul(value));
+    else if (arg == "--filter")
+      options.filter = value;
+    else if (arg == "--format" && (value == "text" || value == "json"))
+      options.format = value;
+    else if (arg == "--dir")
+      options.dir = value;
+    else if (arg == "--url")
+      options.url = value;
+    else if (arg == "--transfers")
+      options.transfers = std::max<size_t>(1, std::stoul(value));
+    else
+    {
+      printUsage();
+      return 1;
+    }
+  }
+
+  BenchRunner runner(options);
+  if (options.format == "text")
+    std::cout << "payload: " << options.size_mb << " MB, segments: " << options.segment_kb << " KB, iterations: "
+              << options.iterations << ", dir: " << options.dir << std::endl;
+  benchParallelDecrypt(runner, options);
+  benchWriteCallbacks(runner, options);
+  benchMerge(runner, options);
+  benchParse(runner, options);
+  benchNetwork(runner, options);
+  if (options.format == "json")
+    runner.printJson();
+
+  // 输出不一致时返回非零，CI可以直接据此失败
+  return runner.allOk() ? 0 : 2;
+}
@@ -0,0 +1,185 @@
+#include "buffer_pool.h"
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+  // 不设上限时最多保留这么多空闲块，其余归还给堆，避免一次峰值之后一直占着内存
+  constexpr size_t kMaxIdleBytes = 32 << 20;
+}
+
+BufferPool::BufferPool(size_t block_size, size_t max_bytes)
+    : block_size_(block_size ? block_size : kDefaultBlockSize), max_bytes_(max_bytes)
+{
+}
+
+BufferPool::~BufferPool()
+{
+  for (uint8_t *block : free_)
+    delete[] block;
+}
+
+void BufferPool::setLimit(size_t max_bytes)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  max_bytes_ = max_bytes;
+}
+
+size_t BufferPool::limit() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return max_bytes_;
+}
+
+uint8_t *BufferPool::acquire(bool overdraft)
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!overdraft && max_bytes_ > 0 && (in_use_ + 1) * block_size_ > max_bytes_)
+    {
+      ++exhausted_;
+      return nullptr;
+    }
+    ++in_use_;
+    peak_ = std::max(peak_, in_use_);
+    if (!free_.empty())
+    {
+      uint8_t *block = free_.back();
+      free_.pop_back();
+      return block;
+    }
+  }
+  // 新块在锁外分配
+  return new uint8_t[block_size_];
+}
+
+void BufferPool::release(uint8_t *block)
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    --in_use_;
+    // 有上限时空闲块与在用块合计不超过上限（透支的块用完即还给堆）
+    const size_t keep = max_bytes_ > 0 ? max_bytes_ : kMaxIdleBytes;
+    if ((in_use_ + free_.size() + 1) * block_size_ <= keep)
+    {
+      free_.push_back(block);
+      return;
+    }
+  }
+  delete[] block;
+}
+
+size_t BufferPool::bytesInUse() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return in_use_ * block_size_;
+}
+
+size_t BufferPool::peakBytes() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return peak_ * block_size_;
+}
+
+uint64_t BufferPool::exhausted() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return exhausted_;
+}
+
+PooledBuffer::PooledBuffer(PooledBuffer &&other) noexcept
+    : pool_(other.pool_), blocks_(std::move(other.blocks_)), size_(other.size_)
+{
+  other.blocks_.clear();
+  other.size_ = 0;
+}
+
+PooledBuffer &PooledBuffer::operator=(PooledBuffer &&other) noexcept
+{
+  if (this != &other)
+  {
+    clear();
+    pool_ = other.pool_;
+    blocks_ = std::move(other.blocks_);
+    size_ = other.size_;
+    other.blocks_.clear();
+    other.size_ = 0;
+  }
+  return *this;
+}
+
+bool PooledBuffer::reserve(size_t len, bool overdraft)
+{
+  if (!pool_)
+    return len == 0;
+  while (blocks_.size() * blockSize() < size_ + len)
+  {
+    uint8_t *block = pool_->acquire(overdraft);
+    if (!block)
+      return false;
+    blocks_.push_back(block);
+  }
+  return true;
+}
+
+bool PooledBuffer::append(const uint8_t *data, size_t len, bool overdraft)
+{
+  if (!reserve(len, overdraft))
+    return false;
+
+  // 按块依次填满
+  const size_t block_size = blockSize();
+  while (len > 0)
+  {
+    const size_t offset = size_ % block_size;
+    const size_t n = std::min(len, block_size - offset);
+    std::memcpy(blocks_[size_ / block_size] + offset, data, n);
+    data += n;
+    len -= n;
+    size_ += n;
+  }
+  return true;
+}
+
+void PooledBuffer::clear()
+{
+  for (uint8_t *block : blocks_)
+    pool_->release(block);
+  blocks_.clear();
+  size_ = 0;
+}
+
+void PooledBuffer::truncate(size_t len)
+{
+  if (len >= size_)
+    return;
+  const size_t keep = (len + blockSize() - 1) / blockSize();
+  while (blocks_.size() > keep)
+  {
+    pool_->release(blocks_.back());
+    blocks_.pop_back();
+  }
+  size_ = len;
+}
+
+std::vector<std::pair<uint8_t *, size_t>> PooledBuffer::ranges()
+{
+  std::vector<std::pair<uint8_t *, size_t>> result;
+  size_t left = size_;
+  for (size_t i = 0; i < blocks_.size() && left > 0; ++i)
+  {
+    const size_t len = std::min(left, blockSize());
+    result.emplace_back(blocks_[i], len);
+    left -= len;
+  }
+  return result;
+}
+
+void PooledBuffer::appendTo(std::string &out) const
+{
+  out.reserve(out.size() + size_);
+  forEach([&out](const uint8_t *data, size_t len)
+          {
+            out.append(reinterpret_cast<const char *>(data), len);
+            return true; });
+}
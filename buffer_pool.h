@@ -0,0 +1,109 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Fixed-size I/O blocks shared by every transfer in the process.
+//
+// Released blocks go onto a free list and are handed out again, so bodies
+// that grow chunk by chunk never reallocate or copy. With a ceiling set,
+// acquire() fails once that many bytes are checked out and the caller is
+// expected to stop reading (backpressure) until other bodies have been
+// written out and released. An overdraft acquire ignores the ceiling; it is
+// meant for the one body the output is blocked on, so a full pool cannot
+// deadlock the pipeline. Thread-safe.
+class BufferPool
+{
+public:
+  static constexpr size_t kDefaultBlockSize = 128 * 1024;
+
+  explicit BufferPool(size_t block_size = kDefaultBlockSize, size_t max_bytes = 0);
+  ~BufferPool();
+
+  BufferPool(const BufferPool &) = delete;
+  BufferPool &operator=(const BufferPool &) = delete;
+
+  // 0 means no ceiling. Safe to call while blocks are checked out; a lower
+  // ceiling only holds back new acquires.
+  void setLimit(size_t max_bytes);
+  size_t limit() const;
+  size_t blockSize() const { return block_size_; }
+
+  // Returns nullptr when the ceiling is reached (unless overdraft).
+  uint8_t *acquire(bool overdraft = false);
+  void release(uint8_t *block);
+
+  size_t bytesInUse() const;
+  size_t peakBytes() const;
+  // acquire() calls refused by the ceiling.
+  uint64_t exhausted() const;
+
+private:
+  const size_t block_size_;
+  mutable std::mutex mutex_;
+  std::vector<uint8_t *> free_;
+  size_t max_bytes_;
+  size_t in_use_ = 0; // blocks checked out
+  size_t peak_ = 0;   // most blocks checked out at once
+  uint64_t exhausted_ = 0;
+};
+
+// Growable byte sequence stored in BufferPool blocks. Move-only; the
+// blocks go back to the pool when the buffer is cleared or destroyed. A
+// default-constructed buffer is empty and has no pool (nothing can be
+// appended).
+class PooledBuffer
+{
+public:
+  PooledBuffer() = default;
+  explicit PooledBuffer(BufferPool *pool) : pool_(pool) {}
+  PooledBuffer(PooledBuffer &&other) noexcept;
+  PooledBuffer &operator=(PooledBuffer &&other) noexcept;
+  ~PooledBuffer() { clear(); }
+
+  PooledBuffer(const PooledBuffer &) = delete;
+  PooledBuffer &operator=(const PooledBuffer &) = delete;
+
+  // Makes room for len more bytes. Returns false when the pool is out of
+  // blocks; the blocks obtained so far are kept for the next attempt.
+  bool reserve(size_t len, bool overdraft = false);
+  // All or nothing: returns false without appending when reserve() fails.
+  bool append(const uint8_t *data, size_t len, bool overdraft = false);
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  void clear();
+  // Shrinks the buffer to len bytes (no more than size()) and returns the
+  // blocks that are no longer needed.
+  void truncate(size_t len);
+  // The filled part of every block as (data, length), for processing the
+  // bytes in place.
+  std::vector<std::pair<uint8_t *, size_t>> ranges();
+
+  // Calls fn(const uint8_t *data, size_t len) for every filled block in
+  // order; stops early and returns false once fn returns false.
+  template <typename Fn>
+  bool forEach(Fn &&fn) const
+  {
+    size_t left = size_;
+    for (size_t i = 0; i < blocks_.size() && left > 0; ++i)
+    {
+      const size_t len = left < blockSize() ? left : blockSize();
+      if (!fn(static_cast<const uint8_t *>(blocks_[i]), len))
+        return false;
+      left -= len;
+    }
+    return true;
+  }
+  void appendTo(std::string &out) const;
+
+private:
+  size_t blockSize() const { return pool_->blockSize(); }
+
+  BufferPool *pool_ = nullptr;
+  std::vector<uint8_t *> blocks_;
+  size_t size_ = 0;
+};
@@ -0,0 +1,137 @@
+#include "checksum.h"
+#include <cstring>
+
+namespace
+{
+  constexpr uint64_t kPrime1 = 11400714785074694791ULL;
+  constexpr uint64_t kPrime2 = 14029467366897019727ULL;
+  constexpr uint64_t kPrime3 = 1609587929392839161ULL;
+  constexpr uint64_t kPrime4 = 9650029242287828579ULL;
+  constexpr uint64_t kPrime5 = 2870177450012600261ULL;
+
+  inline uint64_t rotl(uint64_t x, int r)
+  {
+    return (x << r) | (x >> (64 - r));
+  }
+
+  inline uint64_t read64(const uint8_t *p)
+  {
+    uint64_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+  }
+
+  inline uint32_t read32(const uint8_t *p)
+  {
+    uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+  }
+
+  inline uint64_t round(uint64_t acc, uint64_t input)
+  {
+    acc += input * kPrime2;
+    acc = rotl(acc, 31);
+    return acc * kPrime1;
+  }
+
+  inline uint64_t mergeRound(uint64_t acc, uint64_t val)
+  {
+    acc ^= round(0, val);
+    return acc * kPrime1 + kPrime4;
+  }
+}
+
+Xxh64::Xxh64(uint64_t seed)
+    : seed_(seed)
+{
+  v_[0] = seed + kPrime1 + kPrime2;
+  v_[1] = seed + kPrime2;
+  v_[2] = seed;
+  v_[3] = seed - kPrime1;
+}
+
+void Xxh64::update(const void *data, size_t len)
+{
+  const uint8_t *p = static_cast<const uint8_t *>(data);
+  const uint8_t *end = p + len;
+  total_len_ += len;
+
+  if (buffered_ + len < 32)
+  {
+    std::memcpy(buffer_ + buffered_, p, len);
+    buffered_ += len;
+    return;
+  }
+
+  if (buffered_ > 0)
+  {
+    size_t fill = 32 - buffered_;
+    std::memcpy(buffer_ + buffered_, p, fill);
+    p += fill;
+    for (int i = 0; i < 4; ++i)
+      v_[i] = round(v_[i], read64(buffer_ + i * 8));
+    buffered_ = 0;
+  }
+
+  while (p + 32 <= end)
+  {
+    for (int i = 0; i < 4; ++i)
+      v_[i] = round(v_[i], read64(p + i * 8));
+    p += 32;
+  }
+
+  buffered_ = static_cast<size_t>(end - p);
+  std::memcpy(buffer_, p, buffered_);
+}
+
+uint64_t Xxh64::digest() const
+{
+  uint64_t h;
+  if (total_len_ >= 32)
+  {
+    h = rotl(v_[0], 1) + rotl(v_[1], 7) + rotl(v_[2], 12) + rotl(v_[3], 18);
+    for (int i = 0; i < 4; ++i)
+      h = mergeRound(h, v_[i]);
+  }
+  else
+  {
+    h = seed_ + kPrime5;
+  }
+  h += total_len_;
+
+  const uint8_t *p = buffer_;
+  const uint8_t *end = buffer_ + buffered_;
+  while (p + 8 <= end)
+  {
+    h ^= round(0, read64(p));
+    h = rotl(h, 27) * kPrime1 + kPrime4;
+    p += 8;
+  }
+  if (p + 4 <= end)
+  {
+    h ^= static_cast<uint64_t>(read32(p)) * kPrime1;
+    h = rotl(h, 23) * kPrime2 + kPrime3;
+    p += 4;
+  }
+  while (p < end)
+  {
+    h ^= (*p) * kPrime5;
+    h = rotl(h, 11) * kPrime1;
+    ++p;
+  }
+
+  h ^= h >> 33;
+  h *= kPrime2;
+  h ^= h >> 29;
+  h *= kPrime3;
+  h ^= h >> 32;
+  return h;
+}
+
+uint64_t Xxh64::hash(const void *data, size_t len, uint64_t seed)
+{
+  Xxh64 state(seed);
+  state.update(data, len);
+  return state.digest();
+}
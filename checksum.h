@@ -0,0 +1,23 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// Streaming XXH64, used as the fast per-segment checksum in the resume
+// journal. It can be fed straight from curl's write callback.
+class Xxh64
+{
+public:
+  explicit Xxh64(uint64_t seed = 0);
+
+  void update(const void *data, size_t len);
+  uint64_t digest() const;
+
+  static uint64_t hash(const void *data, size_t len, uint64_t seed = 0);
+
+private:
+  uint64_t v_[4];
+  uint8_t buffer_[32];
+  size_t buffered_ = 0;
+  uint64_t total_len_ = 0;
+  uint64_t seed_;
+};
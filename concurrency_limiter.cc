@@ -0,0 +1,117 @@
+#include "concurrency_limiter.h"
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+namespace
+{
+  constexpr double kDecreaseFactor = 0.7;    // multiplicative cut on errors
+  constexpr double kErrorRateLimit = 0.1;    // tolerated share of failed attempts
+  constexpr double kLatencyTolerance = 2.0;  // avg latency vs baseline before backing off
+  constexpr double kHeadroomTolerance = 1.2; // avg latency vs baseline that still allows growth
+  constexpr double kBaselineDecay = 1.05;    // lets the baseline recover after a change of route
+}
+
+ConcurrencyLimiter::ConcurrencyLimiter(const ConcurrencyConfig &config)
+    : config_(config),
+      window_start_(Clock::now())
+{
+  const int lo = std::max(1, config_.min);
+  const int hi = std::max(lo, config_.max);
+  limit_ = static_cast<size_t>(std::clamp(config_.initial, lo, hi));
+}
+
+void ConcurrencyLimiter::record(uint64_t bytes, std::chrono::microseconds latency, bool ok, bool throttled)
+{
+  size_t changed_to = 0;
+  std::string message;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    window_bytes_ += bytes;
+    ++window_completions_;
+    if (!ok)
+      ++window_errors_;
+    if (throttled)
+      ++window_throttled_;
+    window_latency_ms_ += latency.count() / 1000.0;
+
+    // 窗口至少持续window_ms，并且完成数不少于当前并发数，保证样本有代表性
+    const auto now = Clock::now();
+    const double elapsed = std::chrono::duration<double>(now - window_start_).count();
+    if (elapsed * 1000 < config_.window_ms || window_completions_ < limit_)
+      return;
+
+    const double throughput = window_bytes_ / elapsed;
+    const double avg_latency_ms = window_latency_ms_ / window_completions_;
+    const double error_rate = static_cast<double>(window_errors_) / window_completions_;
+
+    const char *reason = nullptr;
+    size_t next = adjust(throughput, avg_latency_ms, error_rate, reason);
+    if (next != limit_)
+    {
+      std::ostringstream line;
+      line << std::fixed << std::setprecision(1)
+           << "Concurrency limit " << limit_.load() << " -> " << next << " (" << reason << ": "
+           << throughput / (1024 * 1024) << " MB/s, " << avg_latency_ms << " ms avg latency, "
+           << error_rate * 100 << "% errors)";
+      message = line.str();
+      limit_ = next;
+      changed_to = next;
+    }
+
+    last_throughput_ = throughput;
+    window_start_ = now;
+    window_bytes_ = 0;
+    window_completions_ = 0;
+    window_errors_ = 0;
+    window_throttled_ = 0;
+    window_latency_ms_ = 0;
+  }
+
+  // 输出和回调都在锁外执行：其他完成的传输不必排在控制台输出后面，回调内也可以安全地调整调度器
+  if (!message.empty() && log_)
+    log_(Logger::kInfo, std::move(message));
+  else if (!message.empty())
+    std::cout << message << std::endl;
+  if (changed_to && on_change_)
+    on_change_(changed_to);
+}
+
+size_t ConcurrencyLimiter::adjust(double throughput, double avg_latency_ms, double error_rate, const char *&reason)
+{
+  const size_t lo = static_cast<size_t>(std::max(1, config_.min));
+  const size_t hi = std::max(lo, static_cast<size_t>(config_.max));
+
+  if (baseline_latency_ms_ <= 0 || avg_latency_ms < baseline_latency_ms_)
+    baseline_latency_ms_ = avg_latency_ms;
+  else
+    baseline_latency_ms_ *= kBaselineDecay;
+
+  // 被限流或错误率过高：乘性减少
+  if (window_throttled_ > 0 || error_rate > kErrorRateLimit)
+  {
+    reason = window_throttled_ > 0 ? "throttled" : "errors";
+    return std::max(lo, static_cast<size_t>(std::floor(limit_ * kDecreaseFactor)));
+  }
+
+  // 延迟明显上升而吞吐没有增长，说明已超过瓶颈带宽：减一
+  const bool throughput_grew = throughput > last_throughput_ * 1.05;
+  if (avg_latency_ms > baseline_latency_ms_ * kLatencyTolerance && !throughput_grew)
+  {
+    reason = "latency";
+    return limit_ > lo ? limit_ - 1 : lo;
+  }
+
+  // 吞吐仍在增长，或延迟接近基线说明还有余量：加性增加，继续探测
+  const bool headroom = avg_latency_ms <= baseline_latency_ms_ * kHeadroomTolerance &&
+                        throughput >= last_throughput_ * 0.95;
+  if ((throughput_grew || headroom) && limit_ < hi)
+  {
+    reason = "throughput";
+    return limit_ + 1;
+  }
+  return limit_;
+}
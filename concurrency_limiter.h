@@ -0,0 +1,69 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include "logger.h"
+
+struct ConcurrencyConfig
+{
+  bool adaptive = false;
+  int min = 1;
+  int max = 64;
+  int initial = 4;
+  int window_ms = 2000; // how long to measure before each adjustment
+};
+
+// AIMD limit on in-flight segments driven by measured throughput, latency
+// and errors.
+//
+// Completed transfers are aggregated into windows. At the end of a window
+// the limit grows by one while throughput rises or latency stays close to
+// the best seen; it is cut multiplicatively on errors or throttling
+// responses (429/503) and trimmed by one when latency inflates without a
+// throughput gain. Every change is reported through the log callback
+// (stdout when none is set) and on_change, outside the lock.
+class ConcurrencyLimiter
+{
+public:
+  using ChangeCallback = std::function<void(size_t limit)>;
+
+  explicit ConcurrencyLimiter(const ConcurrencyConfig &config);
+
+  ConcurrencyLimiter(const ConcurrencyLimiter &) = delete;
+  ConcurrencyLimiter &operator=(const ConcurrencyLimiter &) = delete;
+
+  // Safe to call from any thread while record() is running.
+  size_t limit() const { return limit_.load(); }
+  // Called with the new limit whenever it changes; may run on any thread
+  // that calls record().
+  void setChangeCallback(ChangeCallback on_change) { on_change_ = std::move(on_change); }
+  void setLogCallback(LogCallback log) { log_ = std::move(log); }
+
+  // Thread-safe. latency is the transfer time of one attempt.
+  void record(uint64_t bytes, std::chrono::microseconds latency, bool ok, bool throttled);
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  size_t adjust(double throughput, double avg_latency_ms, double error_rate, const char *&reason);
+
+  const ConcurrencyConfig config_;
+  ChangeCallback on_change_;
+  LogCallback log_;
+  std::mutex mutex_;
+  std::atomic<size_t> limit_; // written under mutex_, read lock-free by limit()
+
+  Clock::time_point window_start_;
+  uint64_t window_bytes_ = 0;
+  size_t window_completions_ = 0;
+  size_t window_errors_ = 0;
+  size_t window_throttled_ = 0;
+  double window_latency_ms_ = 0;
+
+  double last_throughput_ = 0;    // bytes/s of the previous window
+  double baseline_latency_ms_ = 0; // best average latency, slowly forgotten
+};
@@ -0,0 +1,97 @@
+#include "curl_handle_pool.h"
+
+namespace
+{
+  std::mutex global_mutex;
+  size_t global_users = 0;
+}
+
+CurlGlobal::CurlGlobal()
+{
+  std::lock_guard<std::mutex> lock(global_mutex);
+  if (global_users++ == 0)
+    curl_global_init(CURL_GLOBAL_ALL);
+}
+
+CurlGlobal::~CurlGlobal()
+{
+  std::lock_guard<std::mutex> lock(global_mutex);
+  if (--global_users == 0)
+    curl_global_cleanup();
+}
+
+CurlShare::CurlShare()
+{
+  share_ = curl_share_init();
+  if (!share_)
+    return;
+
+  curl_share_setopt(share_, CURLSHOPT_LOCKFUNC, lockCallback);
+  curl_share_setopt(share_, CURLSHOPT_UNLOCKFUNC, unlockCallback);
+  curl_share_setopt(share_, CURLSHOPT_USERDATA, this);
+
+  curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+  curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+  curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+}
+
+CurlShare::~CurlShare()
+{
+  if (share_)
+    curl_share_cleanup(share_);
+}
+
+void CurlShare::lockCallback(CURL *, curl_lock_data data, curl_lock_access, void *userp)
+{
+  static_cast<CurlShare *>(userp)->locks_[data].lock();
+}
+
+void CurlShare::unlockCallback(CURL *, curl_lock_data data, void *userp)
+{
+  static_cast<CurlShare *>(userp)->locks_[data].unlock();
+}
+
+CurlHandlePool::CurlHandlePool(size_t worker_count)
+    : free_(worker_count ? worker_count : 1)
+{
+}
+
+CurlHandlePool::~CurlHandlePool()
+{
+  for (auto &handles : free_)
+    for (CURL *easy : handles)
+      curl_easy_cleanup(easy);
+}
+
+CURL *CurlHandlePool::acquire(size_t worker_id)
+{
+  auto &handles = free_[worker_id % free_.size()];
+  if (handles.empty())
+    return curl_easy_init();
+
+  CURL *easy = handles.back();
+  handles.pop_back();
+  return easy;
+}
+
+void CurlHandlePool::release(size_t worker_id, CURL *easy)
+{
+  if (!easy)
+    return;
+
+  // reset只清除选项，连接、DNS和TLS会话缓存都会保留
+  curl_easy_reset(easy);
+  free_[worker_id % free_.size()].push_back(easy);
+}
+
+void CurlHandlePool::recordTransfer(CURL *easy)
+{
+  long connects = 0;
+  curl_easy_getinfo(easy, CURLINFO_NUM_CONNECTS, &connects);
+
+  transfers_.fetch_add(1);
+  if (connects == 0)
+    reused_.fetch_add(1);
+  else
+    new_connections_.fetch_add(connects);
+}
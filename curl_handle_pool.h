@@ -0,0 +1,68 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <vector>
+#include <curl/curl.h>
+
+// Reference-counted curl_global_init/curl_global_cleanup. The global setup
+// is not thread-safe, so every downloader in the process holds one of these
+// and only the first and the last instance touch libcurl's globals.
+class CurlGlobal
+{
+public:
+  CurlGlobal();
+  ~CurlGlobal();
+
+  CurlGlobal(const CurlGlobal &) = delete;
+  CurlGlobal &operator=(const CurlGlobal &) = delete;
+};
+
+// curl_share wrapper so every handle of a downloader shares the DNS cache,
+// TLS sessions and the connection cache. Locking is done per data type.
+class CurlShare
+{
+public:
+  CurlShare();
+  ~CurlShare();
+
+  CurlShare(const CurlShare &) = delete;
+  CurlShare &operator=(const CurlShare &) = delete;
+
+  CURLSH *handle() const { return share_; }
+
+private:
+  static void lockCallback(CURL *handle, curl_lock_data data, curl_lock_access access, void *userp);
+  static void unlockCallback(CURL *handle, curl_lock_data data, void *userp);
+
+  CURLSH *share_ = nullptr;
+  std::mutex locks_[CURL_LOCK_DATA_LAST];
+};
+
+// Reusable easy handles kept per worker. A released handle is reset but keeps
+// its live connections, so retries and later segments skip TCP/TLS setup.
+class CurlHandlePool
+{
+public:
+  explicit CurlHandlePool(size_t worker_count);
+  ~CurlHandlePool();
+
+  CurlHandlePool(const CurlHandlePool &) = delete;
+  CurlHandlePool &operator=(const CurlHandlePool &) = delete;
+
+  // Each worker slot must only be used from one thread at a time.
+  CURL *acquire(size_t worker_id);
+  void release(size_t worker_id, CURL *easy);
+
+  // Reads CURLINFO_NUM_CONNECTS after a transfer to count reused connections.
+  void recordTransfer(CURL *easy);
+  size_t transfers() const { return transfers_.load(); }
+  size_t reusedConnections() const { return reused_.load(); }
+  size_t newConnections() const { return new_connections_.load(); }
+
+private:
+  std::vector<std::vector<CURL *>> free_;
+  std::atomic<size_t> transfers_{0};
+  std::atomic<size_t> reused_{0};
+  std::atomic<size_t> new_connections_{0};
+};
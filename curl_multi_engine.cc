@@ -0,0 +1,259 @@
+#include "curl_multi_engine.h"
+#include <algorithm>
+#include <cerrno>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+CurlMultiEngine::CurlMultiEngine(size_t max_transfers)
+    : max_transfers_(max_transfers ? max_transfers : 1)
+{
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  multi_ = curl_multi_init();
+  if (!multi_)
+    return;
+
+  curl_multi_setopt(multi_, CURLMOPT_SOCKETFUNCTION, socketCallback);
+  curl_multi_setopt(multi_, CURLMOPT_SOCKETDATA, this);
+  curl_multi_setopt(multi_, CURLMOPT_TIMERFUNCTION, timerCallback);
+  curl_multi_setopt(multi_, CURLMOPT_TIMERDATA, this);
+  curl_multi_setopt(multi_, CURLMOPT_MAXCONNECTS, static_cast<long>(max_transfers_));
+}
+
+void CurlMultiEngine::enableMultiplexing(size_t max_streams)
+{
+  // 同一主机的传输共用一条h2连接；不支持h2的主机仍按HTTP/1.1每条连接一个请求
+  curl_multi_setopt(multi_, CURLMOPT_PIPELINING, static_cast<long>(CURLPIPE_MULTIPLEX));
+  curl_multi_setopt(multi_, CURLMOPT_MAX_CONCURRENT_STREAMS, static_cast<long>(max_streams ? max_streams : 1));
+}
+
+CurlMultiEngine::~CurlMultiEngine()
+{
+  if (multi_)
+  {
+    for (auto &entry : running_)
+      curl_multi_remove_handle(multi_, entry.first);
+    curl_multi_cleanup(multi_);
+  }
+  if (epoll_fd_ >= 0)
+    close(epoll_fd_);
+}
+
+void CurlMultiEngine::add(CURL *easy, Completion on_done, bool urgent, TimerTask on_started)
+{
+  if (on_started)
+    on_started_[easy] = std::move(on_started);
+  if (urgent)
+    queued_.emplace_front(easy, std::move(on_done));
+  else
+    queued_.emplace_back(easy, std::move(on_done));
+}
+
+void CurlMultiEngine::cancel(CURL *easy)
+{
+  Completion on_done;
+  auto queued = std::find_if(queued_.begin(), queued_.end(), [easy](const auto &entry)
+                             { return entry.first == easy; });
+  if (queued != queued_.end())
+  {
+    on_done = std::move(queued->second);
+    queued_.erase(queued);
+    on_started_.erase(easy);
+  }
+  else
+  {
+    auto running = running_.find(easy);
+    if (running == running_.end())
+      return;
+    curl_multi_remove_handle(multi_, easy);
+    --active_;
+    on_done = std::move(running->second);
+    running_.erase(running);
+  }
+  on_done(easy, CURLE_ABORTED_BY_CALLBACK);
+}
+
+void CurlMultiEngine::cancelAll()
+{
+  // 先整体取出再回调，回调中新加入的传输不受影响
+  std::deque<std::pair<CURL *, Completion>> cancelled;
+  cancelled.swap(queued_);
+  on_started_.clear();
+
+  // 运行中的传输直接移出multi句柄：被限速暂停的传输若先恢复再中止，
+  // curl会在curl_easy_pause内部投递数据，写回调失败后传输会卡住
+  for (auto &entry : running_)
+  {
+    curl_multi_remove_handle(multi_, entry.first);
+    --active_;
+    cancelled.emplace_back(entry.first, std::move(entry.second));
+  }
+  running_.clear();
+
+  for (auto &entry : cancelled)
+    entry.second(entry.first, CURLE_ABORTED_BY_CALLBACK);
+}
+
+void CurlMultiEngine::schedule(std::chrono::milliseconds delay, TimerTask fn)
+{
+  timers_.push({Clock::now() + delay, timer_seq_++, std::move(fn)});
+}
+
+int CurlMultiEngine::socketCallback(CURL *, curl_socket_t fd, int what, void *userp, void *)
+{
+  auto *self = static_cast<CurlMultiEngine *>(userp);
+
+  if (what == CURL_POLL_REMOVE)
+  {
+    epoll_ctl(self->epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+    return 0;
+  }
+
+  epoll_event ev{};
+  ev.data.fd = fd;
+  if (what & CURL_POLL_IN)
+    ev.events |= EPOLLIN;
+  if (what & CURL_POLL_OUT)
+    ev.events |= EPOLLOUT;
+
+  // 同一个socket可能被重复通知，已注册时改为修改事件
+  if (epoll_ctl(self->epoll_fd_, EPOLL_CTL_MOD, fd, &ev) != 0 && errno == ENOENT)
+    epoll_ctl(self->epoll_fd_, EPOLL_CTL_ADD, fd, &ev);
+  return 0;
+}
+
+int CurlMultiEngine::timerCallback(CURLM *, long timeout_ms, void *userp)
+{
+  auto *self = static_cast<CurlMultiEngine *>(userp);
+  self->curl_timeout_ms_ = timeout_ms;
+  self->curl_timer_set_ = Clock::now();
+  return 0;
+}
+
+void CurlMultiEngine::startQueued()
+{
+  while (active_ < max_transfers_ && !queued_.empty())
+  {
+    CURL *easy = queued_.front().first;
+    Completion on_done = std::move(queued_.front().second);
+    queued_.pop_front();
+
+    if (curl_multi_add_handle(multi_, easy) != CURLM_OK)
+    {
+      on_started_.erase(easy);
+      on_done(easy, CURLE_FAILED_INIT);
+      continue;
+    }
+    running_.emplace(easy, std::move(on_done));
+    ++active_;
+
+    auto started = on_started_.find(easy);
+    if (started != on_started_.end())
+    {
+      TimerTask fn = std::move(started->second);
+      on_started_.erase(started);
+      fn();
+    }
+  }
+}
+
+void CurlMultiEngine::drainCompleted()
+{
+  int msgs_left = 0;
+  while (CURLMsg *msg = curl_multi_info_read(multi_, &msgs_left))
+  {
+    if (msg->msg != CURLMSG_DONE)
+      continue;
+
+    CURL *easy = msg->easy_handle;
+    CURLcode result = msg->data.result;
+    curl_multi_remove_handle(multi_, easy);
+    --active_;
+
+    auto it = running_.find(easy);
+    if (it == running_.end())
+      continue;
+    Completion on_done = std::move(it->second);
+    running_.erase(it);
+    on_done(easy, result);
+  }
+}
+
+void CurlMultiEngine::runDueTimers()
+{
+  const auto now = Clock::now();
+  while (!timers_.empty() && timers_.top().due <= now)
+  {
+    TimerTask fn = timers_.top().fn;
+    timers_.pop();
+    fn();
+  }
+}
+
+int CurlMultiEngine::nextWaitMs() const
+{
+  // 没有任何截止时间时也定期醒来，防止遗漏curl内部状态变化
+  long wait_ms = 1000;
+  const auto now = Clock::now();
+
+  if (curl_timeout_ms_ >= 0)
+  {
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - curl_timer_set_).count();
+    wait_ms = std::min(wait_ms, std::max(0L, curl_timeout_ms_ - static_cast<long>(elapsed)));
+  }
+  if (!timers_.empty())
+  {
+    auto until = std::chrono::duration_cast<std::chrono::milliseconds>(timers_.top().due - now).count();
+    wait_ms = std::min(wait_ms, std::max(0L, static_cast<long>(until)));
+  }
+  if (!queued_.empty() && active_ < max_transfers_)
+    wait_ms = 0;
+  return static_cast<int>(wait_ms);
+}
+
+void CurlMultiEngine::run()
+{
+  if (!valid())
+    return;
+
+  startQueued();
+  epoll_event events[64];
+
+  while (active_ > 0 || !queued_.empty() || !timers_.empty())
+  {
+    int n = epoll_wait(epoll_fd_, events, 64, nextWaitMs());
+    if (n < 0 && errno != EINTR)
+      break;
+
+    for (int i = 0; i < n; ++i)
+    {
+      int flags = 0;
+      if (events[i].events & EPOLLIN)
+        flags |= CURL_CSELECT_IN;
+      if (events[i].events & EPOLLOUT)
+        flags |= CURL_CSELECT_OUT;
+      if (events[i].events & (EPOLLERR | EPOLLHUP))
+        flags |= CURL_CSELECT_ERR;
+      curl_multi_socket_action(multi_, events[i].data.fd, flags, &still_running_);
+    }
+
+    if (curl_timeout_ms_ >= 0)
+    {
+      auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - curl_timer_set_).count();
+      if (elapsed >= curl_timeout_ms_)
+      {
+        curl_timeout_ms_ = -1;
+        curl_multi_socket_action(multi_, CURL_SOCKET_TIMEOUT, 0, &still_running_);
+      }
+    }
+
+    drainCompleted();
+    if (stop_ && stop_())
+    {
+      cancelAll();
+      timers_ = {};
+      break;
+    }
+    runDueTimers();
+    startQueued();
+  }
+}
@@ -0,0 +1,95 @@
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <map>
+#include <queue>
+#include <vector>
+#include <curl/curl.h>
+
+// Event-driven transfer loop built on curl_multi_socket_action and epoll.
+//
+// A single thread calling run() drives every transfer that was add()ed, so
+// concurrency is bounded by max_transfers rather than by OS threads. All
+// methods must be called from the thread running the loop (or before run()).
+class CurlMultiEngine
+{
+public:
+  using Completion = std::function<void(CURL *easy, CURLcode result)>;
+  using TimerTask = std::function<void()>;
+
+  explicit CurlMultiEngine(size_t max_transfers);
+  ~CurlMultiEngine();
+
+  CurlMultiEngine(const CurlMultiEngine &) = delete;
+  CurlMultiEngine &operator=(const CurlMultiEngine &) = delete;
+
+  bool valid() const { return multi_ != nullptr && epoll_fd_ >= 0; }
+
+  // Queues a fully configured easy handle. on_done runs on the loop thread
+  // after the handle has been removed from the multi handle; the caller
+  // still owns the easy handle. urgent transfers are queued ahead of the
+  // others (retries of segments a reader is waiting for). on_started, if
+  // set, runs once the transfer leaves the queue and actually starts.
+  void add(CURL *easy, Completion on_done, bool urgent = false, TimerTask on_started = nullptr);
+  // Runs fn on the loop thread once delay has elapsed (used for retries).
+  void schedule(std::chrono::milliseconds delay, TimerTask fn);
+  // Adjusts how many transfers run at once (adaptive concurrency). Lowering
+  // it lets running transfers finish; queued ones wait for a free slot.
+  void setMaxTransfers(size_t max_transfers) { max_transfers_ = max_transfers ? max_transfers : 1; }
+  // Lets up to max_streams transfers to the same host share one HTTP/2
+  // connection. Easy handles should set CURLOPT_PIPEWAIT so that they wait
+  // for a connection being set up instead of opening their own.
+  void enableMultiplexing(size_t max_streams);
+  // Removes one queued or running transfer and completes it with
+  // CURLE_ABORTED_BY_CALLBACK (the loser of a hedged segment). Does
+  // nothing when easy is not in the engine.
+  void cancel(CURL *easy);
+  // Removes every queued and running transfer and completes it with
+  // CURLE_ABORTED_BY_CALLBACK. Paused transfers are dropped without being
+  // resumed. Pending timers still run.
+  void cancelAll();
+  // Checked by run() at least once a second. Once it returns true, run()
+  // cancels every transfer, drops pending timers and returns.
+  void setStopCondition(std::function<bool()> stop) { stop_ = std::move(stop); }
+  // Returns once no transfer is queued or running and no timer is pending.
+  void run();
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  struct Timer
+  {
+    Clock::time_point due;
+    size_t seq;
+    TimerTask fn;
+    bool operator>(const Timer &other) const
+    {
+      return due != other.due ? due > other.due : seq > other.seq;
+    }
+  };
+
+  static int socketCallback(CURL *easy, curl_socket_t fd, int what, void *userp, void *socketp);
+  static int timerCallback(CURLM *multi, long timeout_ms, void *userp);
+
+  void startQueued();
+  void drainCompleted();
+  void runDueTimers();
+  int nextWaitMs() const;
+
+  CURLM *multi_ = nullptr;
+  int epoll_fd_ = -1;
+  size_t max_transfers_;
+  size_t active_ = 0;
+  int still_running_ = 0;
+  long curl_timeout_ms_ = -1;
+  Clock::time_point curl_timer_set_;
+
+  std::deque<std::pair<CURL *, Completion>> queued_;
+  std::map<CURL *, Completion> running_;
+  std::map<CURL *, TimerTask> on_started_;
+  std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> timers_;
+  size_t timer_seq_ = 0;
+  std::function<bool()> stop_;
+};
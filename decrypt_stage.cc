@@ -0,0 +1,133 @@
+#include "decrypt_stage.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstring>
+#include <memory>
+
+DecryptStage::DecryptStage(size_t threads)
+{
+  if (threads == 0)
+    threads = std::max<size_t>(1, std::thread::hardware_concurrency() / 2);
+  for (size_t i = 0; i < threads; ++i)
+    workers_.emplace_back([this]
+                          { run(); });
+}
+
+DecryptStage::~DecryptStage()
+{
+  wait();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  cv_.notify_all();
+  for (auto &worker : workers_)
+    worker.join();
+}
+
+void DecryptStage::submit(std::function<void()> task)
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    tasks_.push_back(std::move(task));
+    ++pending_;
+  }
+  cv_.notify_one();
+}
+
+void DecryptStage::wait()
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  idle_cv_.wait(lock, [this]
+                { return pending_ == 0; });
+}
+
+void DecryptStage::run()
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true)
+  {
+    cv_.wait(lock, [this]
+             { return stopping_ || !tasks_.empty(); });
+    if (tasks_.empty())
+      return;
+
+    auto task = std::move(tasks_.front());
+    tasks_.pop_front();
+    lock.unlock();
+    task();
+    lock.lock();
+    if (--pending_ == 0)
+      idle_cv_.notify_all();
+  }
+}
+
+void DecryptStage::parallelFor(size_t parts, const std::function<void(size_t part)> &fn)
+{
+  if (parts <= 1)
+  {
+    if (parts == 1)
+      fn(0);
+    return;
+  }
+
+  // 各部分按序号领取：调用线程自己也领取，已被领走的部分一定正在某个线程上执行，
+  // 等待它们不会因为所有worker都在等待而卡住
+  struct Shared
+  {
+    std::atomic<size_t> next{0};
+    std::mutex mutex;
+    std::condition_variable cv;
+    size_t done = 0;
+  };
+  auto shared = std::make_shared<Shared>();
+  auto work = [shared, parts, &fn]
+  {
+    size_t finished = 0;
+    for (size_t part; (part = shared->next.fetch_add(1)) < parts; ++finished)
+      fn(part);
+    if (finished == 0)
+      return;
+    std::lock_guard<std::mutex> lock(shared->mutex);
+    shared->done += finished;
+    if (shared->done == parts)
+      shared->cv.notify_all();
+  };
+
+  // 帮手任务在所有部分都领完之后才轮到时直接返回，不会再访问fn
+  const size_t helpers = std::min(parts - 1, workers_.size());
+  for (size_t i = 0; i < helpers; ++i)
+    submit(work);
+  work();
+
+  std::unique_lock<std::mutex> lock(shared->mutex);
+  shared->cv.wait(lock, [&]
+                  { return shared->done == parts; });
+}
+
+bool DecryptStage::decrypt(const SegmentCipher &cipher, const std::vector<Range> &ranges)
+{
+  if (ranges.empty())
+    return true;
+
+  // 先记下每段之前的那个密文块作为该段的IV，原地解密会覆盖它
+  std::vector<std::array<uint8_t, kAesBlockSize>> ivs(ranges.size());
+  std::memcpy(ivs[0].data(), cipher.iv, kAesBlockSize);
+  for (size_t i = 1; i < ranges.size(); ++i)
+  {
+    const Range &previous = ranges[i - 1];
+    if (previous.second < kAesBlockSize || previous.second % kAesBlockSize != 0)
+      return false;
+    std::memcpy(ivs[i].data(), previous.first + previous.second - kAesBlockSize, kAesBlockSize);
+  }
+
+  std::atomic<bool> ok{true};
+  parallelFor(ranges.size(), [&](size_t part)
+              {
+                const size_t len = ranges[part].second - ranges[part].second % kAesBlockSize;
+                if (!decryptBlocks(cipher.key, ivs[part].data(), ranges[part].first, len))
+                  ok.store(false);
+              });
+  return ok.load();
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include "segment_decryptor.h"
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Worker threads that decrypt finished segments, so the threads (or the
+// event loop) driving the transfers never wait on crypto.
+//
+// A segment is decrypted in place as a list of ranges. Large segments are
+// split into several ranges that run on different workers at once; see
+// decryptBlocks() for why CBC allows this. Thread-safe.
+class DecryptStage
+{
+public:
+  using Range = std::pair<uint8_t *, size_t>;
+
+  // threads of 0 picks half the CPU cores, at least one.
+  explicit DecryptStage(size_t threads);
+  // Finishes the queued tasks first.
+  ~DecryptStage();
+
+  DecryptStage(const DecryptStage &) = delete;
+  DecryptStage &operator=(const DecryptStage &) = delete;
+
+  size_t threads() const { return workers_.size(); }
+
+  void submit(std::function<void()> task);
+  // Blocks until every submitted task has finished.
+  void wait();
+
+  // Runs fn(0) ... fn(parts - 1) and returns once all of them are done.
+  // The calling thread works through the parts itself and idle workers
+  // help, so it is safe to call from a stage task.
+  void parallelFor(size_t parts, const std::function<void(size_t part)> &fn);
+
+  // Decrypts consecutive ranges of one segment in place, one range per
+  // parallelFor() part. Every range but the last must be a multiple of
+  // kAesBlockSize; a trailing partial block is left as it is.
+  bool decrypt(const SegmentCipher &cipher, const std::vector<Range> &ranges);
+
+  // Contiguous buffers are split into ranges of this size.
+  static constexpr size_t kParallelRange = 256 * 1024;
+
+private:
+  void run();
+
+  std::vector<std::thread> workers_;
+  std::mutex mutex_;
+  std::condition_variable cv_;      // tasks_ changed or stopping
+  std::condition_variable idle_cv_; // pending_ reached zero
+  std::deque<std::function<void()>> tasks_;
+  size_t pending_ = 0; // queued plus running tasks
+  bool stopping_ = false;
+};
@@ -0,0 +1,65 @@
+#include "download_handle.h"
+
+std::unique_ptr<DownloadHandle> DownloadHandle::start(const VideoDownloader::Config &config, DownloadRequest request,
+                                                      VideoDownloader::ProgressCallback on_progress)
+{
+  std::unique_ptr<DownloadHandle> handle(new DownloadHandle());
+  if (!handle->downloader_.setConfig(config))
+    return nullptr;
+  // 嵌入方通过回调获取进度，控制台不再打印进度行
+  handle->downloader_.setQuiet(true);
+  handle->downloader_.setProgressCallback(std::move(on_progress));
+
+  handle->result_ = handle->promise_.get_future().share();
+  handle->thread_ = std::thread(&DownloadHandle::run, handle.get(), std::move(request));
+  return handle;
+}
+
+DownloadHandle::~DownloadHandle()
+{
+  if (thread_.joinable())
+  {
+    downloader_.cancel();
+    thread_.join();
+  }
+}
+
+DownloadState DownloadHandle::state() const
+{
+  DownloadState state = state_.load();
+  if (state == DownloadState::kRunning && downloader_.paused())
+    return DownloadState::kPaused;
+  return state;
+}
+
+void DownloadHandle::run(DownloadRequest request)
+{
+  bool success = false;
+  switch (request.kind)
+  {
+  case DownloadRequest::Kind::kPlaylist:
+    success = downloader_.downloadM3U8(request.url, request.output_name);
+    break;
+  case DownloadRequest::Kind::kDownloadOnly:
+    success = downloader_.downloadOnly(request.url, request.output_name);
+    break;
+  case DownloadRequest::Kind::kMergeOnly:
+    success = downloader_.mergeOnly(request.output_name);
+    break;
+  case DownloadRequest::Kind::kDirect:
+    success = downloader_.downloadDirect(request.url, request.output_name);
+    break;
+  case DownloadRequest::Kind::kLive:
+    success = downloader_.downloadLive(request.url, request.output_name);
+    break;
+  case DownloadRequest::Kind::kPipe:
+    success = downloader_.downloadToPipe(request.url, request.output_name);
+    break;
+  }
+
+  // 取消前刚好完成的下载仍算成功
+  DownloadState result = success ? DownloadState::kSucceeded
+                                 : (downloader_.cancelled() ? DownloadState::kCancelled : DownloadState::kFailed);
+  state_.store(result);
+  promise_.set_value(result);
+}
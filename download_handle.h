@@ -0,0 +1,75 @@
+#pragma once
+#include <atomic>
+#include <future>
+#include <memory>
+#include <string>
+#include <thread>
+#include "video_downloader.h"
+
+// One download for DownloadHandle::start; each kind is one CLI mode.
+struct DownloadRequest
+{
+  enum class Kind
+  {
+    kPlaylist,     // download and merge into <output_name>.ts
+    kDownloadOnly, // keep the segment files for a later kMergeOnly
+    kMergeOnly,    // merge segments already in download_path, url is unused
+    kDirect,       // single file in parallel byte ranges, output_name is the file path
+    kLive,         // record until EXT-X-ENDLIST
+    kPipe,         // stream to output_name, a named pipe or "-" for stdout
+  };
+
+  Kind kind = Kind::kPlaylist;
+  std::string url;
+  std::string output_name;
+};
+
+enum class DownloadState
+{
+  kRunning,
+  kPaused,
+  kSucceeded,
+  kFailed,
+  kCancelled, // partial output and resume state are kept, starting again continues
+};
+
+// Runs one download on a background thread for services that embed the
+// downloader instead of spawning the executable per job.
+//
+// Each handle owns a VideoDownloader, so several handles run side by side
+// in one process. Control methods may be called from any thread. The
+// progress callback runs on download threads and must not destroy the
+// handle. Destroying a running handle cancels it and waits for it to stop.
+class DownloadHandle
+{
+public:
+  // Returns null when config is invalid (log level, download_path).
+  static std::unique_ptr<DownloadHandle> start(const VideoDownloader::Config &config, DownloadRequest request,
+                                               VideoDownloader::ProgressCallback on_progress = nullptr);
+  ~DownloadHandle();
+
+  DownloadHandle(const DownloadHandle &) = delete;
+  DownloadHandle &operator=(const DownloadHandle &) = delete;
+
+  // Cooperative: in-flight transfers are aborted, queued and retrying
+  // segments are dropped, and the result becomes kCancelled.
+  void cancel() { downloader_.cancel(); }
+  // Stops dispatching new requests; direct download chunks stall in place.
+  void pause() { downloader_.pause(); }
+  void resume() { downloader_.resume(); }
+
+  DownloadState state() const;
+  // Ready once the download thread has finished; never kRunning/kPaused.
+  std::shared_future<DownloadState> result() const { return result_; }
+  DownloadState wait() const { return result_.get(); }
+
+private:
+  DownloadHandle() = default;
+  void run(DownloadRequest request);
+
+  VideoDownloader downloader_;
+  std::promise<DownloadState> promise_;
+  std::shared_future<DownloadState> result_;
+  std::atomic<DownloadState> state_{DownloadState::kRunning};
+  std::thread thread_;
+};
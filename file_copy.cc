@@ -0,0 +1,183 @@
+#include "file_copy.h"
+#include <cerrno>
+#include <vector>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+  // 这些错误表示文件系统或内核不支持该方式，而不是一次性的I/O错误
+  bool isUnsupported(int err)
+  {
+    return err == EXDEV || err == EINVAL || err == ENOSYS ||
+           err == EOPNOTSUPP || err == ENOTTY || err == EBADF;
+  }
+}
+
+FileAppender::FileAppender(int out_fd, uint64_t offset)
+    : out_fd_(out_fd), offset_(offset)
+{
+  struct stat st;
+  if (fstat(out_fd_, &st) == 0 && st.st_blksize > 0)
+    block_size_ = static_cast<size_t>(st.st_blksize);
+}
+
+const char *FileAppender::methodName(Method method)
+{
+  switch (method)
+  {
+  case kReflink:
+    return "reflink";
+  case kCopyFileRange:
+    return "copy_file_range";
+  case kSendfile:
+    return "sendfile";
+  default:
+    return "buffered";
+  }
+}
+
+void FileAppender::preallocate(uint64_t size)
+{
+  if (size > 0)
+    fallocate(out_fd_, FALLOC_FL_KEEP_SIZE, static_cast<off_t>(offset_), static_cast<off_t>(size));
+}
+
+bool FileAppender::append(const std::string &path, uint64_t *bytes)
+{
+  int in_fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (in_fd < 0)
+    return false;
+
+  struct stat st;
+  if (fstat(in_fd, &st) != 0)
+  {
+    close(in_fd);
+    return false;
+  }
+  const uint64_t len = static_cast<uint64_t>(st.st_size);
+
+  uint64_t done = 0;
+  bool ok = len == 0 || reflink(in_fd) ||
+            copyRange(in_fd, len, done) ||
+            sendfileCopy(in_fd, len, done) ||
+            bufferedCopy(in_fd, len, done);
+  close(in_fd);
+
+  if (!ok)
+    return false;
+
+  offset_ += len;
+  if (bytes)
+    *bytes = len;
+  return lseek(out_fd_, static_cast<off_t>(offset_), SEEK_SET) >= 0;
+}
+
+bool FileAppender::reflink(int in_fd)
+{
+  // 目标偏移必须按块对齐；源文件末尾的不完整块由内核按EOF处理
+  if (!enabled_[kReflink] || offset_ % block_size_ != 0)
+    return false;
+
+  file_clone_range range{};
+  range.src_fd = in_fd;
+  range.src_offset = 0;
+  range.src_length = 0; // 0表示一直克隆到源文件末尾
+  range.dest_offset = offset_;
+
+  if (ioctl(out_fd_, FICLONERANGE, &range) != 0)
+  {
+    if (errno == EOPNOTSUPP || errno == ENOTTY || errno == EXDEV || errno == ENOSYS)
+      enabled_[kReflink] = false;
+    return false;
+  }
+
+  ++counts_[kReflink];
+  return true;
+}
+
+bool FileAppender::copyRange(int in_fd, uint64_t len, uint64_t &done)
+{
+  if (!enabled_[kCopyFileRange])
+    return false;
+
+  while (done < len)
+  {
+    loff_t in_off = static_cast<loff_t>(done);
+    loff_t out_off = static_cast<loff_t>(offset_ + done);
+    ssize_t n = copy_file_range(in_fd, &in_off, out_fd_, &out_off, len - done, 0);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+    {
+      if (n < 0 && isUnsupported(errno))
+        enabled_[kCopyFileRange] = false;
+      return false;
+    }
+    done += static_cast<uint64_t>(n);
+  }
+
+  ++counts_[kCopyFileRange];
+  return true;
+}
+
+bool FileAppender::sendfileCopy(int in_fd, uint64_t len, uint64_t &done)
+{
+  if (!enabled_[kSendfile])
+    return false;
+
+  // sendfile从输出文件的当前位置写入
+  if (lseek(out_fd_, static_cast<off_t>(offset_ + done), SEEK_SET) < 0)
+    return false;
+
+  while (done < len)
+  {
+    off_t in_off = static_cast<off_t>(done);
+    ssize_t n = sendfile(out_fd_, in_fd, &in_off, len - done);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+    {
+      if (n < 0 && isUnsupported(errno))
+        enabled_[kSendfile] = false;
+      return false;
+    }
+    done += static_cast<uint64_t>(n);
+  }
+
+  ++counts_[kSendfile];
+  return true;
+}
+
+bool FileAppender::bufferedCopy(int in_fd, uint64_t len, uint64_t &done)
+{
+  std::vector<char> buffer(1 << 20);
+  while (done < len)
+  {
+    ssize_t n = pread(in_fd, buffer.data(), buffer.size(), static_cast<off_t>(done));
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+
+    ssize_t written = 0;
+    while (written < n)
+    {
+      ssize_t w = pwrite(out_fd_, buffer.data() + written, n - written,
+                         static_cast<off_t>(offset_ + done + written));
+      if (w < 0 && errno == EINTR)
+        continue;
+      if (w <= 0)
+        return false;
+      written += w;
+    }
+    done += static_cast<uint64_t>(n);
+  }
+
+  ++counts_[kBuffered];
+  return true;
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Appends whole files to an output descriptor without routing the bytes
+// through userspace where the kernel allows it.
+//
+// Each append tries, in order: FICLONERANGE reflink (XFS, btrfs; needs a
+// block-aligned output offset), copy_file_range, sendfile and finally a
+// buffered pread/pwrite loop. A method that reports itself unsupported is
+// not tried again for the rest of the appender's life.
+class FileAppender
+{
+public:
+  enum Method
+  {
+    kReflink,
+    kCopyFileRange,
+    kSendfile,
+    kBuffered,
+    kMethodCount
+  };
+
+  // offset is where the next append lands; the file position of out_fd is
+  // kept at the end of the appended data.
+  FileAppender(int out_fd, uint64_t offset);
+
+  bool append(const std::string &path, uint64_t *bytes = nullptr);
+  // Reserves size bytes past the current offset without changing the file
+  // size, so later reflinks still end at EOF. Failure is harmless.
+  void preallocate(uint64_t size);
+
+  uint64_t offset() const { return offset_; }
+  size_t count(Method method) const { return counts_[method]; }
+  static const char *methodName(Method method);
+
+private:
+  bool reflink(int in_fd);
+  bool copyRange(int in_fd, uint64_t len, uint64_t &done);
+  bool sendfileCopy(int in_fd, uint64_t len, uint64_t &done);
+  bool bufferedCopy(int in_fd, uint64_t len, uint64_t &done);
+
+  int out_fd_;
+  uint64_t offset_;
+  size_t block_size_ = 4096;
+  bool enabled_[kMethodCount] = {true, true, true, true};
+  size_t counts_[kMethodCount] = {0, 0, 0, 0};
+};
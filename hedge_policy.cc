@@ -0,0 +1,49 @@
+#include "hedge_policy.h"
+#include <algorithm>
+
+HedgePolicy::HedgePolicy(const HedgeConfig &config)
+    : config_(config)
+{
+  window_us_.reserve(kWindow);
+  scratch_.reserve(kWindow);
+}
+
+std::chrono::milliseconds HedgePolicy::onSegmentStart()
+{
+  started_.fetch_add(1, std::memory_order_relaxed);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (window_us_.size() < static_cast<size_t>(std::max(1, config_.min_samples)))
+    return std::chrono::milliseconds(0);
+
+  // 窗口只有几百个样本，每次直接取分位数，慢节点出现后阈值能立刻跟上
+  scratch_.assign(window_us_.begin(), window_us_.end());
+  double q = std::min(1.0, std::max(0.0, config_.percentile));
+  auto nth = scratch_.begin() + static_cast<ptrdiff_t>(q * (scratch_.size() - 1));
+  std::nth_element(scratch_.begin(), nth, scratch_.end());
+
+  auto delay = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::microseconds(*nth));
+  return std::max(delay, std::chrono::milliseconds(std::max(1, config_.min_delay_ms)));
+}
+
+void HedgePolicy::recordLatency(std::chrono::microseconds latency)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (window_us_.size() < kWindow)
+    window_us_.push_back(latency.count());
+  else
+    window_us_[next_sample_] = latency.count();
+  next_sample_ = (next_sample_ + 1) % kWindow;
+}
+
+bool HedgePolicy::tryHedge()
+{
+  const double budget = config_.max_ratio * static_cast<double>(started_.load(std::memory_order_relaxed));
+  uint64_t fired = fired_.load(std::memory_order_relaxed);
+  do
+  {
+    if (static_cast<double>(fired + 1) > budget)
+      return false;
+  } while (!fired_.compare_exchange_weak(fired, fired + 1, std::memory_order_relaxed));
+  return true;
+}
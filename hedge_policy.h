@@ -0,0 +1,56 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+struct HedgeConfig
+{
+  bool enabled = false;
+  double percentile = 0.95; // hedge a segment once it runs longer than this share of recent segments
+  int min_samples = 20;     // finished segments to observe before hedging starts
+  int min_delay_ms = 500;   // never hedge earlier than this
+  double max_ratio = 0.1;   // hedged requests per started segment, caps the extra load
+};
+
+// Decides when a slow segment gets a duplicate request.
+//
+// Transfer times of recently finished segments are kept in a sliding
+// window; a segment still running after the configured percentile of that
+// window is hedged, at most once, as long as the hedges fired so far stay
+// under max_ratio of the segments started. All methods are thread-safe.
+class HedgePolicy
+{
+public:
+  explicit HedgePolicy(const HedgeConfig &config);
+
+  HedgePolicy(const HedgePolicy &) = delete;
+  HedgePolicy &operator=(const HedgePolicy &) = delete;
+
+  // Called when a segment's first attempt starts. Returns how long to wait
+  // before hedging it, or zero while too few samples have been seen.
+  std::chrono::milliseconds onSegmentStart();
+  // Transfer time of a successful attempt, primary or hedge.
+  void recordLatency(std::chrono::microseconds latency);
+  // Reserves budget for one hedge; false when it would exceed max_ratio.
+  bool tryHedge();
+  void recordWin() { won_.fetch_add(1, std::memory_order_relaxed); }
+
+  uint64_t fired() const { return fired_.load(std::memory_order_relaxed); }
+  uint64_t won() const { return won_.load(std::memory_order_relaxed); }
+
+private:
+  static constexpr size_t kWindow = 256;
+
+  const HedgeConfig config_;
+  std::mutex mutex_;
+  std::vector<int64_t> window_us_; // ring buffer of the latest kWindow latencies
+  size_t next_sample_ = 0;
+  std::vector<int64_t> scratch_;
+
+  std::atomic<uint64_t> started_{0};
+  std::atomic<uint64_t> fired_{0};
+  std::atomic<uint64_t> won_{0};
+};
@@ -0,0 +1,225 @@
+#include "job_queue.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+namespace
+{
+  std::mutex cout_mutex;
+
+  double megabytes(uint64_t bytes)
+  {
+    return bytes / (1024.0 * 1024.0);
+  }
+}
+
+bool loadJobList(const std::string &path, const std::string &default_name, std::vector<JobSpec> &jobs)
+{
+  std::ifstream file;
+  if (path != "-")
+  {
+    file.open(path);
+    if (!file)
+    {
+      std::cerr << "Failed to open job list: " << path << std::endl;
+      return false;
+    }
+  }
+  std::istream &in = (path == "-") ? std::cin : file;
+
+  std::string line;
+  size_t line_number = 0;
+  while (std::getline(in, line))
+  {
+    ++line_number;
+    std::istringstream fields(line);
+    JobSpec job;
+    if (!(fields >> job.url) || job.url[0] == '#')
+      continue;
+
+    std::string priority;
+    fields >> job.output_name >> priority;
+    if (job.output_name.empty())
+      job.output_name = default_name + "_" + std::to_string(jobs.size() + 1);
+    if (!priority.empty())
+    {
+      try
+      {
+        job.priority = static_cast<unsigned>(std::max(1, std::stoi(priority)));
+      }
+      catch (const std::exception &)
+      {
+        std::cerr << "Invalid priority on line " << line_number << " of " << path << ": " << priority << std::endl;
+        return false;
+      }
+    }
+    jobs.push_back(std::move(job));
+  }
+
+  if (jobs.empty())
+  {
+    std::cerr << "No jobs found in " << path << std::endl;
+    return false;
+  }
+  return true;
+}
+
+JobQueue::JobQueue(std::string config_path, std::vector<JobSpec> jobs)
+    : config_path_(std::move(config_path)),
+      jobs_(std::move(jobs))
+{
+}
+
+bool JobQueue::run()
+{
+  // 下载器都在主线程中创建和销毁，配置错误在启动任何作业之前报告
+  for (size_t i = 0; i < jobs_.size(); ++i)
+  {
+    auto downloader = std::make_unique<VideoDownloader>();
+    if (!downloader->loadConfig(config_path_))
+      return false;
+    std::lock_guard<std::mutex> lock(downloaders_mutex_);
+    downloaders_.push_back(std::move(downloader));
+  }
+  config_ = downloaders_.front()->getConfig();
+
+  const size_t worker_count = static_cast<size_t>(std::max(1, config_.thread_count));
+  share_ = std::make_shared<CurlShare>();
+  handle_pool_ = std::make_shared<CurlHandlePool>(worker_count);
+  scheduler_ = std::make_shared<SegmentScheduler>(worker_count);
+  metrics_ = std::make_shared<TransferMetrics>();
+  // 所有作业写同一个日志文件，由一个刷写线程负责
+  logger_ = std::make_shared<Logger>();
+  Logger::Level level = Logger::kInfo;
+  Logger::parseLevel(config_.log_level, level);
+  logger_->setLevel(level);
+  if (!config_.log_path.empty() && !logger_->open(config_.log_path))
+    std::cerr << "Failed to open log file " << config_.log_path << ", logging to stderr" << std::endl;
+  std::unique_ptr<MetricsExporter> exporter;
+  if (!config_.metrics.prometheus_path.empty())
+    exporter = std::make_unique<MetricsExporter>(*metrics_, config_.metrics.prometheus_path,
+                                                 std::chrono::seconds(config_.metrics.interval_seconds));
+
+  for (size_t i = 0; i < jobs_.size(); ++i)
+  {
+    VideoDownloader &downloader = *downloaders_[i];
+    downloader.shareWorkers(share_, handle_pool_, scheduler_, metrics_, logger_, jobs_[i].priority);
+    downloader.setQuiet(true);
+    // 每个作业使用独立的子目录，片段文件和日志不会互相覆盖
+    if (!downloader.setDownloadPath(config_.download_path + jobs_[i].output_name + "/"))
+      return false;
+    // 配置中的baseurl只对应video.url，作业的相对片段URI按各自播放列表所在目录拼接
+    const std::string &url = jobs_[i].url;
+    downloader.setBaseUrl(url.substr(0, url.rfind('/', url.find_first_of("?#")) + 1));
+  }
+
+  const size_t active = std::min(jobs_.size(), static_cast<size_t>(std::max(1, config_.job_queue.max_active_jobs)));
+  std::cout << "Running " << jobs_.size() << " jobs, " << active << " at a time, on " << worker_count
+            << " shared workers" << std::endl;
+
+  results_.assign(jobs_.size(), JobResult());
+  std::atomic<size_t> next_job{0};
+  const auto start = std::chrono::steady_clock::now();
+
+  std::vector<std::thread> runners;
+  for (size_t i = 0; i < active; ++i)
+  {
+    runners.emplace_back([this, &next_job]
+                         {
+                           for (size_t index = next_job.fetch_add(1); index < jobs_.size(); index = next_job.fetch_add(1))
+                             runJob(index); });
+  }
+  for (auto &runner : runners)
+    runner.join();
+
+  printSummary(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+  exporter.reset();
+  if (!config_.metrics.json_path.empty() && !writeFileAtomically(config_.metrics.json_path, metrics_->toJson().dump(2)))
+    std::cerr << "Failed to write metrics to " << config_.metrics.json_path << std::endl;
+
+  // 下载器注销各自的作业后再释放共用的调度器
+  {
+    std::lock_guard<std::mutex> lock(downloaders_mutex_);
+    downloaders_.clear();
+  }
+  return std::all_of(results_.begin(), results_.end(), [](const JobResult &result)
+                     { return result.success; });
+}
+
+bool JobQueue::reloadBandwidthLimit()
+{
+  std::lock_guard<std::mutex> lock(downloaders_mutex_);
+  bool ok = !downloaders_.empty();
+  for (auto &downloader : downloaders_)
+    ok = downloader->reloadBandwidthLimit(config_path_) && ok;
+  if (ok)
+  {
+    const auto &bandwidth = downloaders_.front()->getConfig().bandwidth;
+    std::lock_guard<std::mutex> cout_lock(cout_mutex);
+    std::cout << "Bandwidth limit for " << downloaders_.size() << " jobs: global " << bandwidth.global_kbps
+              << " KB/s, job " << bandwidth.job_kbps << " KB/s (0 = unlimited)" << std::endl;
+  }
+  return ok;
+}
+
+void JobQueue::runJob(size_t index)
+{
+  const JobSpec &job = jobs_[index];
+  VideoDownloader &downloader = *downloaders_[index];
+  {
+    std::lock_guard<std::mutex> lock(cout_mutex);
+    std::cout << "[job " << index + 1 << "/" << jobs_.size() << "] Started " << job.output_name
+              << " (priority " << job.priority << "): " << job.url << std::endl;
+  }
+
+  const auto start = std::chrono::steady_clock::now();
+  JobResult &result = results_[index];
+  result.success = downloader.downloadM3U8(job.url, job.output_name);
+  result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  result.bytes = downloader.bytesReceived();
+
+  std::lock_guard<std::mutex> lock(cout_mutex);
+  std::cout << "[job " << index + 1 << "/" << jobs_.size() << "] " << (result.success ? "Finished " : "Failed ")
+            << job.output_name << ": " << std::fixed << std::setprecision(1) << megabytes(result.bytes) << " MB in "
+            << result.seconds << " s" << std::defaultfloat << std::endl;
+}
+
+void JobQueue::printSummary(double elapsed) const
+{
+  std::lock_guard<std::mutex> lock(cout_mutex);
+  std::cout << std::endl
+            << "Job summary:" << std::endl
+            << std::left << std::setw(6) << "  #" << std::setw(10) << "priority" << std::setw(8) << "status"
+            << std::right << std::setw(10) << "MB" << std::setw(10) << "seconds" << std::setw(10) << "MB/s"
+            << "  output" << std::endl;
+
+  uint64_t total_bytes = 0;
+  size_t succeeded = 0;
+  std::cout << std::fixed << std::setprecision(2);
+  for (size_t i = 0; i < jobs_.size(); ++i)
+  {
+    const JobResult &result = results_[i];
+    total_bytes += result.bytes;
+    succeeded += result.success;
+    std::cout << "  " << std::left << std::setw(4) << i + 1 << std::setw(10) << jobs_[i].priority
+              << std::setw(8) << (result.success ? "ok" : "failed") << std::right
+              << std::setw(10) << megabytes(result.bytes) << std::setw(10) << result.seconds
+              << std::setw(10) << (result.seconds > 0 ? megabytes(result.bytes) / result.seconds : 0.0)
+              << "  " << config_.download_path << jobs_[i].output_name << "/" << jobs_[i].output_name << ".ts"
+              << std::endl;
+  }
+  std::cout << "Total: " << succeeded << "/" << jobs_.size() << " jobs succeeded, " << megabytes(total_bytes)
+            << " MB in " << elapsed << " s (" << (elapsed > 0 ? megabytes(total_bytes) / elapsed : 0.0)
+            << " MB/s)" << std::defaultfloat << std::endl;
+  std::cout << "Connection reuse: " << handle_pool_->reusedConnections() << "/" << handle_pool_->transfers()
+            << " transfers reused a connection, " << handle_pool_->newConnections() << " new connections"
+            << std::endl;
+  if (metrics_->transfers() > 0)
+    std::cout << metrics_->summary() << std::endl;
+}
@@ -0,0 +1,67 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "video_downloader.h"
+
+struct JobSpec
+{
+  std::string url;
+  std::string output_name;
+  unsigned priority = 1; // fair-share weight, a priority 2 job gets twice the workers of a priority 1 job
+};
+
+// Reads a job list from path, or from stdin when path is "-". One job per
+// line: "<url> [output_name] [priority]"; blank lines and lines starting
+// with '#' are skipped. Jobs without a name get <default_name>_<n>.
+bool loadJobList(const std::string &path, const std::string &default_name, std::vector<JobSpec> &jobs);
+
+// Downloads many playlists in one process.
+//
+// Every job is its own VideoDownloader (own journal, output, bandwidth
+// bucket and retry state) working in <download_path>/<output_name>/, but
+// all of them share one SegmentScheduler, one CurlHandlePool and one
+// CurlShare, so the thread count and the connection cache are paid once.
+// Transfer metrics are collected and exported for the whole queue, and all
+// jobs write to one log.
+// The scheduler hands out workers by weighted fair share, and up to
+// job_queue.max_active_jobs jobs run at a time. A summary with the
+// throughput of each job is printed at the end.
+class JobQueue
+{
+public:
+  JobQueue(std::string config_path, std::vector<JobSpec> jobs);
+
+  // Returns false when the config cannot be loaded or any job failed.
+  bool run();
+  // Re-reads the bandwidth settings for every job. Thread-safe, may be
+  // called while run() is in progress.
+  bool reloadBandwidthLimit();
+
+private:
+  struct JobResult
+  {
+    bool success = false;
+    uint64_t bytes = 0;
+    double seconds = 0;
+  };
+
+  void runJob(size_t index);
+  void printSummary(double elapsed) const;
+
+  const std::string config_path_;
+  const std::vector<JobSpec> jobs_;
+  VideoDownloader::Config config_;
+
+  std::shared_ptr<CurlShare> share_;
+  std::shared_ptr<CurlHandlePool> handle_pool_;
+  std::shared_ptr<SegmentScheduler> scheduler_;
+  std::shared_ptr<TransferMetrics> metrics_;
+  std::shared_ptr<Logger> logger_;
+  std::mutex downloaders_mutex_; // guards downloaders_ against reloadBandwidthLimit()
+  std::vector<std::unique_ptr<VideoDownloader>> downloaders_;
+  std::vector<JobResult> results_;
+};
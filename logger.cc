@@ -0,0 +1,205 @@
+#include "logger.h"
+#include <chrono>
+#include <ctime>
+#include <strings.h>
+
+namespace
+{
+  // 队列为空时刷写线程的轮询间隔；生产者不做唤醒，保证写日志不碰锁
+  constexpr std::chrono::milliseconds kPollInterval(20);
+
+  const char *levelName(Logger::Level level)
+  {
+    switch (level)
+    {
+    case Logger::kDebug:
+      return "DEBUG";
+    case Logger::kInfo:
+      return "INFO ";
+    case Logger::kWarn:
+      return "WARN ";
+    default:
+      return "ERROR";
+    }
+  }
+
+  int64_t nowMicros()
+  {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::system_clock::now().time_since_epoch())
+        .count();
+  }
+}
+
+Logger::Line::Line(Line &&other) noexcept
+    : logger_(other.logger_),
+      level_(other.level_),
+      out_(std::move(other.out_))
+{
+  other.logger_ = nullptr;
+}
+
+Logger::Line::~Line()
+{
+  if (logger_)
+    logger_->log(level_, out_.str());
+}
+
+Logger::Logger(size_t capacity)
+{
+  // 容量取2的幂，下标用掩码计算
+  size_t size = 2;
+  while (size < capacity)
+    size <<= 1;
+  slots_.reset(new Slot[size]);
+  mask_ = size - 1;
+  for (size_t i = 0; i < size; ++i)
+    slots_[i].sequence.store(i, std::memory_order_relaxed);
+
+  flusher_ = std::thread(&Logger::run, this);
+}
+
+Logger::~Logger()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  wake_cv_.notify_all();
+  flusher_.join();
+
+  if (dropped() > 0)
+    std::fprintf(stderr, "Log queue overflowed, %llu lines dropped\n", static_cast<unsigned long long>(dropped()));
+  if (file_ && file_ != stderr)
+    std::fclose(file_);
+}
+
+bool Logger::open(const std::string &path)
+{
+  std::FILE *file = std::fopen(path.c_str(), "a");
+  if (!file)
+    return false;
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (file_ && file_ != stderr)
+    std::fclose(file_);
+  file_ = file;
+  return true;
+}
+
+bool Logger::parseLevel(const std::string &name, Level &level)
+{
+  static const struct
+  {
+    const char *name;
+    Level level;
+  } kLevels[] = {{"debug", kDebug}, {"info", kInfo}, {"warn", kWarn}, {"error", kError}};
+
+  for (const auto &entry : kLevels)
+  {
+    if (strcasecmp(name.c_str(), entry.name) == 0)
+    {
+      level = entry.level;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool Logger::log(Level level, std::string message)
+{
+  // 有界多生产者环形队列：每个槽的sequence等于写入位置时可写，等于位置+1时可读
+  size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+  Slot *slot;
+  while (true)
+  {
+    slot = &slots_[pos & mask_];
+    size_t sequence = slot->sequence.load(std::memory_order_acquire);
+    intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+    if (diff == 0)
+    {
+      if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+        break;
+    }
+    else if (diff < 0)
+    {
+      // 队列已满：丢弃这一行，不让下载线程等待磁盘
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    else
+    {
+      pos = enqueue_pos_.load(std::memory_order_relaxed);
+    }
+  }
+
+  slot->level = level;
+  slot->time_us = nowMicros();
+  slot->message = std::move(message);
+  slot->sequence.store(pos + 1, std::memory_order_release);
+  published_.fetch_add(1, std::memory_order_release);
+  return true;
+}
+
+void Logger::flush()
+{
+  const uint64_t target = published_.load(std::memory_order_acquire);
+  std::unique_lock<std::mutex> lock(mutex_);
+  wake_cv_.notify_all();
+  written_cv_.wait(lock, [&]
+                   { return written_.load(std::memory_order_acquire) >= target || stopping_; });
+}
+
+size_t Logger::drain()
+{
+  char prefix[64];
+  size_t count = 0;
+  while (true)
+  {
+    Slot &slot = slots_[dequeue_pos_ & mask_];
+    if (slot.sequence.load(std::memory_order_acquire) != dequeue_pos_ + 1)
+      break;
+
+    const Level level = slot.level;
+    const int64_t time_us = slot.time_us;
+    std::string message = std::move(slot.message);
+    // 先交还槽位再写文件，格式化和IO期间生产者可以继续写入
+    slot.sequence.store(dequeue_pos_ + mask_ + 1, std::memory_order_release);
+    ++dequeue_pos_;
+
+    std::time_t seconds = static_cast<std::time_t>(time_us / 1000000);
+    std::tm local{};
+    localtime_r(&seconds, &local);
+    size_t length = std::strftime(prefix, sizeof(prefix), "%Y-%m-%d %H:%M:%S", &local);
+    std::snprintf(prefix + length, sizeof(prefix) - length, ".%03d %s ",
+                  static_cast<int>(time_us % 1000000 / 1000), levelName(level));
+
+    std::FILE *out = file_ ? file_ : stderr;
+    std::fputs(prefix, out);
+    std::fwrite(message.data(), 1, message.size(), out);
+    std::fputc('\n', out);
+    ++count;
+  }
+  return count;
+}
+
+void Logger::run()
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true)
+  {
+    // 持有mutex_只是为了不与open()交换文件冲突，生产者从不获取它
+    size_t count = drain();
+    if (count > 0)
+    {
+      std::fflush(file_ ? file_ : stderr);
+      written_.fetch_add(count, std::memory_order_release);
+      written_cv_.notify_all();
+      continue;
+    }
+    if (stopping_)
+      break;
+    wake_cv_.wait_for(lock, kPollInterval);
+  }
+  written_cv_.notify_all();
+}
@@ -0,0 +1,107 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+
+// Asynchronous log for the download hot path.
+//
+// Producers publish lines into a bounded lock-free ring (one atomic
+// compare-and-swap per line, no mutex), stamped with the time they were
+// logged. A background thread formats and writes them to the log file
+// (stderr until open() succeeds). When the ring is full the line is
+// dropped and counted rather than blocking the caller.
+class Logger
+{
+public:
+  enum Level
+  {
+    kDebug,
+    kInfo,
+    kWarn,
+    kError
+  };
+
+  // Collects one line with operator<< and submits it when destroyed.
+  class Line
+  {
+  public:
+    Line(Logger *logger, Level level) : logger_(logger), level_(level) {}
+    Line(Line &&other) noexcept;
+    ~Line();
+
+    template <typename T>
+    Line &operator<<(const T &value)
+    {
+      if (logger_)
+        out_ << value;
+      return *this;
+    }
+
+  private:
+    Logger *logger_; // null when the level is filtered out
+    Level level_;
+    std::ostringstream out_;
+  };
+
+  explicit Logger(size_t capacity = 8192);
+  ~Logger();
+
+  Logger(const Logger &) = delete;
+  Logger &operator=(const Logger &) = delete;
+
+  // Appends to path from now on. Lines already queued go to the new file.
+  bool open(const std::string &path);
+  void setLevel(Level level) { level_.store(level, std::memory_order_relaxed); }
+  bool enabled(Level level) const { return level >= level_.load(std::memory_order_relaxed); }
+  static bool parseLevel(const std::string &name, Level &level);
+
+  Line line(Level level) { return Line(enabled(level) ? this : nullptr, level); }
+  // Returns false when the line was dropped because the ring was full.
+  bool log(Level level, std::string message);
+  // Blocks until every line logged before the call is written.
+  void flush();
+
+  uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+private:
+  struct Slot
+  {
+    std::atomic<size_t> sequence;
+    Level level;
+    int64_t time_us;
+    std::string message;
+  };
+
+  void run();
+  // Flusher thread only. Returns the number of lines written.
+  size_t drain();
+
+  std::unique_ptr<Slot[]> slots_;
+  size_t mask_;
+  alignas(64) std::atomic<size_t> enqueue_pos_{0};
+  alignas(64) size_t dequeue_pos_ = 0; // flusher thread only
+
+  std::atomic<Level> level_{kInfo};
+  std::atomic<uint64_t> published_{0};
+  std::atomic<uint64_t> written_{0};
+  std::atomic<uint64_t> dropped_{0};
+
+  std::mutex mutex_; // guards file_, stopping_ and the flush handshake, never taken by producers
+  std::condition_variable wake_cv_;
+  std::condition_variable written_cv_;
+  std::FILE *file_ = nullptr;
+  bool stopping_ = false;
+  std::thread flusher_;
+};
+
+// Where components that do not own a Logger send their messages, e.g. a
+// lambda forwarding to the downloader's current Logger::log().
+using LogCallback = std::function<void(Logger::Level level, std::string message)>;
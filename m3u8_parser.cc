@@ -0,0 +1,301 @@
+#include "m3u8_parser.h"
+#include <algorithm>
+#include <charconv>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+  bool isSpace(char c)
+  {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+  }
+
+  std::string_view trim(std::string_view line)
+  {
+    while (!line.empty() && isSpace(line.front()))
+      line.remove_prefix(1);
+    while (!line.empty() && isSpace(line.back()))
+      line.remove_suffix(1);
+    return line;
+  }
+
+  bool consumePrefix(std::string_view &line, std::string_view prefix)
+  {
+    if (line.compare(0, prefix.size(), prefix) != 0)
+      return false;
+    line.remove_prefix(prefix.size());
+    return true;
+  }
+
+  // from_chars不依赖结尾的'\0'，映射文件末尾没有换行时也不会越界读取
+  template <typename T>
+  T parseNumber(std::string_view text)
+  {
+    T value = 0;
+    std::from_chars(text.data(), text.data() + text.size(), value);
+    return value;
+  }
+}
+
+void M3U8Playlist::clear()
+{
+  media_sequence = 0;
+  target_duration = 0;
+  endlist = false;
+  can_block_reload = false;
+  keys.clear();
+  segments.clear();
+}
+
+PlaylistBuffer::~PlaylistBuffer()
+{
+  release();
+}
+
+void PlaylistBuffer::assign(std::string content)
+{
+  release();
+  owned_ = std::move(content);
+  view_ = owned_;
+}
+
+bool PlaylistBuffer::mapFile(const std::string &path)
+{
+  release();
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return false;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0)
+  {
+    close(fd);
+    return false;
+  }
+
+  // 空文件无法映射，按空内容处理
+  if (st.st_size > 0)
+  {
+    void *base = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (base == MAP_FAILED)
+    {
+      close(fd);
+      return false;
+    }
+    madvise(base, st.st_size, MADV_SEQUENTIAL);
+    mapped_ = base;
+    mapped_size_ = st.st_size;
+    view_ = std::string_view(static_cast<const char *>(base), mapped_size_);
+  }
+  close(fd);
+  return true;
+}
+
+void PlaylistBuffer::release()
+{
+  if (mapped_)
+    munmap(mapped_, mapped_size_);
+  mapped_ = nullptr;
+  mapped_size_ = 0;
+  owned_.clear();
+  view_ = {};
+}
+
+bool parseMediaPlaylist(std::string_view content, M3U8Playlist &playlist, int64_t min_sequence)
+{
+  playlist.clear();
+
+  // 按行数预留片段表（每个片段至少一行EXTINF和一行URI），解析过程中不再扩容
+  if (min_sequence == INT64_MIN)
+    playlist.segments.reserve(std::count(content.begin(), content.end(), '\n') / 2 + 1);
+
+  bool header_seen = false;
+  double duration = 0;
+  int key = -1;
+  int64_t sequence = 0;
+  size_t pos = 0;
+
+  while (pos < content.size())
+  {
+    size_t end = content.find('\n', pos);
+    if (end == std::string_view::npos)
+      end = content.size();
+    std::string_view raw = content.substr(pos, end - pos);
+    pos = end + 1;
+
+    if (!header_seen)
+    {
+      if (raw.find("#EXTM3U") == std::string_view::npos)
+        return false;
+      header_seen = true;
+      continue;
+    }
+
+    std::string_view line = trim(raw);
+    if (line.empty())
+      continue;
+
+    if (line[0] != '#')
+    {
+      if (sequence >= min_sequence)
+        playlist.segments.push_back({line, sequence, duration, key});
+      ++sequence;
+      duration = 0;
+      continue;
+    }
+
+    if (consumePrefix(line, "#EXTINF:"))
+      duration = parseNumber<double>(line);
+    else if (consumePrefix(line, "#EXT-X-KEY:"))
+    {
+      PlaylistKey parsed{playlistAttribute(line, "METHOD"), playlistAttribute(line, "URI"),
+                         playlistAttribute(line, "IV")};
+      if (parsed.method.empty() || parsed.method == "NONE")
+        key = -1;
+      else
+      {
+        playlist.keys.push_back(parsed);
+        key = static_cast<int>(playlist.keys.size() - 1);
+      }
+    }
+    else if (consumePrefix(line, "#EXT-X-MEDIA-SEQUENCE:"))
+    {
+      // 按规范该标签出现在第一个片段之前
+      playlist.media_sequence = parseNumber<int64_t>(line);
+      sequence = playlist.media_sequence;
+    }
+    else if (consumePrefix(line, "#EXT-X-SERVER-CONTROL:"))
+      playlist.can_block_reload = playlistAttribute(line, "CAN-BLOCK-RELOAD") == "YES";
+    else if (consumePrefix(line, "#EXT-X-TARGETDURATION:"))
+      playlist.target_duration = parseNumber<double>(line);
+    else if (line == "#EXT-X-ENDLIST")
+      playlist.endlist = true;
+  }
+
+  return header_seen;
+}
+
+bool segmentIv(const PlaylistKey &key, int64_t sequence, uint8_t iv[16])
+{
+  std::fill(iv, iv + 16, 0);
+  if (key.iv.empty())
+  {
+    for (int i = 0; i < 8; ++i)
+      iv[15 - i] = static_cast<uint8_t>(static_cast<uint64_t>(sequence) >> (8 * i));
+    return true;
+  }
+
+  std::string_view hex = key.iv;
+  if (hex.size() < 2 || hex[0] != '0' || (hex[1] != 'x' && hex[1] != 'X'))
+    return false;
+  hex.remove_prefix(2);
+  if (hex.empty() || hex.size() > 32)
+    return false;
+
+  // 从最低位开始逐个半字节填入，位数不足时高位补零
+  for (size_t i = 0; i < hex.size(); ++i)
+  {
+    const char c = hex[hex.size() - 1 - i];
+    int nibble;
+    if (c >= '0' && c <= '9')
+      nibble = c - '0';
+    else if (c >= 'a' && c <= 'f')
+      nibble = c - 'a' + 10;
+    else if (c >= 'A' && c <= 'F')
+      nibble = c - 'A' + 10;
+    else
+      return false;
+    iv[15 - i / 2] |= static_cast<uint8_t>(i % 2 ? nibble << 4 : nibble);
+  }
+  return true;
+}
+
+std::string_view playlistAttribute(std::string_view attributes, std::string_view name)
+{
+  size_t pos = 0;
+  while (pos < attributes.size())
+  {
+    size_t eq = attributes.find('=', pos);
+    if (eq == std::string_view::npos)
+      break;
+    std::string_view key = attributes.substr(pos, eq - pos);
+
+    size_t value_start = eq + 1;
+    size_t value_end;
+    std::string_view value;
+    if (value_start < attributes.size() && attributes[value_start] == '"')
+    {
+      // 引号内的值可能包含逗号
+      value_end = attributes.find('"', value_start + 1);
+      if (value_end == std::string_view::npos)
+        value_end = attributes.size();
+      value = attributes.substr(value_start + 1, value_end - value_start - 1);
+      value_end = attributes.find(',', value_end);
+    }
+    else
+    {
+      value_end = attributes.find(',', value_start);
+      value = attributes.substr(value_start, value_end == std::string_view::npos ? std::string_view::npos
+                                                                                 : value_end - value_start);
+    }
+
+    if (key == name)
+      return value;
+    if (value_end == std::string_view::npos)
+      break;
+    pos = value_end + 1;
+  }
+  return {};
+}
+
+SegmentUrlResolver::SegmentUrlResolver(std::string_view playlist_url, std::string_view baseurl)
+    : baseurl_(baseurl),
+      relative_to_playlist_(!playlist_url.empty())
+{
+  if (!relative_to_playlist_)
+    return;
+
+  // 绝对路径保留协议和主机部分
+  size_t scheme = playlist_url.find("://");
+  size_t host_end = playlist_url.find('/', scheme == std::string_view::npos ? 0 : scheme + 3);
+  origin_ = playlist_url.substr(0, host_end);
+
+  // 相对路径去掉播放列表文件名和查询参数
+  size_t query = playlist_url.find_first_of("?#");
+  size_t slash = playlist_url.rfind('/', query);
+  if (slash == std::string_view::npos || (scheme != std::string_view::npos && slash < scheme + 3))
+    directory_ = std::string(playlist_url) + "/";
+  else
+    directory_ = playlist_url.substr(0, slash + 1);
+}
+
+void SegmentUrlResolver::resolve(std::string_view uri, std::string &out) const
+{
+  if (uri.find("://") != std::string_view::npos)
+  {
+    out.assign(uri);
+    return;
+  }
+
+  if (relative_to_playlist_)
+  {
+    out.assign(!uri.empty() && uri[0] == '/' ? origin_ : directory_);
+    out.append(uri);
+    return;
+  }
+
+  out.assign(baseurl_);
+  if (!baseurl_.empty() && baseurl_.back() == '/' && !uri.empty() && uri[0] == '/')
+    uri.remove_prefix(1);
+  out.append(uri);
+}
+
+std::string SegmentUrlResolver::resolve(std::string_view uri) const
+{
+  std::string out;
+  resolve(uri, out);
+  return out;
+}
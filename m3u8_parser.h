@@ -0,0 +1,104 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Zero-copy M3U8 media playlist parsing.
+//
+// Every string in a parsed playlist is a view into the buffer it was parsed
+// from, and segments live in one contiguous table, so parsing a playlist of
+// any length costs a handful of allocations (the table growing) rather than
+// one per line. URLs are only built when a segment is actually requested,
+// see SegmentUrlResolver.
+
+struct PlaylistKey
+{
+  std::string_view method; // "AES-128", "SAMPLE-AES", ...
+  std::string_view uri;
+  std::string_view iv; // hex with 0x prefix as written, empty if absent
+};
+
+struct PlaylistSegment
+{
+  std::string_view uri;
+  int64_t sequence = 0; // media sequence number
+  double duration = 0;  // EXTINF seconds
+  int key = -1;         // index into M3U8Playlist::keys, -1 when unencrypted
+};
+
+struct M3U8Playlist
+{
+  int64_t media_sequence = 0;
+  double target_duration = 0;
+  bool endlist = false;
+  bool can_block_reload = false; // EXT-X-SERVER-CONTROL CAN-BLOCK-RELOAD=YES
+  std::vector<PlaylistKey> keys;
+  std::vector<PlaylistSegment> segments;
+
+  void clear();
+};
+
+// Owns the bytes a parsed playlist points into: either a downloaded string
+// or a read-only mapping of a local file.
+class PlaylistBuffer
+{
+public:
+  PlaylistBuffer() = default;
+  ~PlaylistBuffer();
+
+  PlaylistBuffer(const PlaylistBuffer &) = delete;
+  PlaylistBuffer &operator=(const PlaylistBuffer &) = delete;
+
+  void assign(std::string content);
+  bool mapFile(const std::string &path);
+  std::string_view view() const { return view_; }
+
+private:
+  void release();
+
+  std::string owned_;
+  void *mapped_ = nullptr;
+  size_t mapped_size_ = 0;
+  std::string_view view_;
+};
+
+// Parses a media playlist. content must outlive playlist. Returns false when
+// content does not start with #EXTM3U. Segments numbered below min_sequence
+// are counted but not stored, so a live refresh only materialises the
+// entries it has not seen yet.
+bool parseMediaPlaylist(std::string_view content, M3U8Playlist &playlist,
+                        int64_t min_sequence = INT64_MIN);
+
+// IV of one segment encrypted with key: the key's IV attribute (0x plus 32
+// hex digits, shorter values are zero-extended on the left) or, when it is
+// absent, the media sequence number as a big-endian 128-bit integer, as
+// HLS specifies. Returns false for a malformed attribute.
+bool segmentIv(const PlaylistKey &key, int64_t sequence, uint8_t iv[16]);
+
+// Value of one attribute of an attribute list such as
+// BANDWIDTH=1280000,CODECS="avc1.4d401f,mp4a.40.2" (quotes stripped).
+std::string_view playlistAttribute(std::string_view attributes, std::string_view name);
+
+// Turns segment URIs into absolute URLs.
+//
+// The base is split into its origin and directory once; resolve() then
+// only appends. URIs are resolved against playlist_url when it is set,
+// otherwise prefixed with the configured baseurl, and absolute URLs are
+// kept as they are.
+class SegmentUrlResolver
+{
+public:
+  SegmentUrlResolver(std::string_view playlist_url, std::string_view baseurl = {});
+
+  // Overwrites out, reusing its capacity.
+  void resolve(std::string_view uri, std::string &out) const;
+  std::string resolve(std::string_view uri) const;
+
+private:
+  std::string origin_;    // scheme://host, for URIs starting with '/'
+  std::string directory_; // ends with '/', for relative URIs
+  std::string baseurl_;
+  bool relative_to_playlist_ = false;
+};
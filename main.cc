@@ -1,5 +1,12 @@
 #include "video_downloader.h"
+#include "job_queue.h"
+#include <atomic>
+#include <functional>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <signal.h>
 
 void printUsage()
 {
@@ -13,17 +20,88 @@ void printUsage()
             << "4. Download only from local M3U8: " << std::endl
             << "   video-downloader --download-only -f <m3u8_file_path>" << std::endl
             << "5. Merge only: " << std::endl
-            << "   video-downloader --merge-only" << std::endl;
+            << "   video-downloader --merge-only" << std::endl
+            << "6. Direct download (e.g. mp4) with parallel byte ranges: " << std::endl
+            << "   video-downloader --direct <url> [output_file]" << std::endl
+            << "7. Record a live stream until EXT-X-ENDLIST: " << std::endl
+            << "   video-downloader --live [url]" << std::endl
+            << "8. Download a list of playlists (\"url [output_name] [priority]\" per line, - for stdin): " << std::endl
+            << "   video-downloader --jobs <file>" << std::endl
+            << "9. Stream the playlist to stdout or a named pipe while downloading (e.g. | ffplay -): " << std::endl
+            << "   video-downloader --pipe [path|-]" << std::endl;
 }
 
+// 收到SIGHUP时重新读取config.json中的bandwidth设置，下载过程中即可调整限速。
+// 析构时唤醒并回收等待线程，必须在reload用到的下载器之后创建、之前销毁
+class BandwidthReloader
+{
+public:
+  BandwidthReloader(std::function<void()> reload, const sigset_t &signals)
+      : reload_(std::move(reload)),
+        thread_([this, signals]
+                {
+                  int sig = 0;
+                  while (sigwait(&signals, &sig) == 0 && !stopping_.load())
+                  {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    reload_();
+                  } })
+  {
+  }
+
+  ~BandwidthReloader()
+  {
+    stopping_.store(true);
+    pthread_kill(thread_.native_handle(), SIGHUP);
+    thread_.join();
+  }
+
+  BandwidthReloader(const BandwidthReloader &) = delete;
+  BandwidthReloader &operator=(const BandwidthReloader &) = delete;
+
+  // 之后的SIGHUP改为调用reload；返回后不会再调用之前的函数
+  void setReload(std::function<void()> reload)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    reload_ = std::move(reload);
+  }
+
+private:
+  std::atomic<bool> stopping_{false};
+  std::mutex mutex_;
+  std::function<void()> reload_;
+  std::thread thread_;
+};
+
 int main(int argc, char *argv[])
 {
+  // 在创建任何线程之前屏蔽SIGHUP，开启reload_on_sighup时由专门的线程同步等待
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGHUP);
+  pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+  // 视频数据写到标准输出时，日志全部改走标准错误；读端退出时由写入失败结束下载而不是被SIGPIPE杀掉
+  bool pipe_to_stdout = argc >= 2 && std::string(argv[1]) == "--pipe" && (argc == 2 || std::string(argv[2]) == "-");
+  if (pipe_to_stdout)
+    std::cout.rdbuf(std::cerr.rdbuf());
+  if (argc >= 2 && std::string(argv[1]) == "--pipe")
+    signal(SIGPIPE, SIG_IGN);
+
   VideoDownloader downloader;
   if (!downloader.loadConfig("config.json"))
   {
     std::cerr << "Failed to load config" << std::endl;
     return 1;
   }
+  // 未开启时主线程恢复接收SIGHUP：其他线程仍屏蔽它，信号交给主线程按默认动作结束进程
+  std::unique_ptr<BandwidthReloader> reloader;
+  if (downloader.getConfig().bandwidth.reload_on_sighup)
+    reloader = std::make_unique<BandwidthReloader>([&downloader]
+                                                   { downloader.reloadBandwidthLimit("config.json"); },
+                                                   signals);
+  else
+    pthread_sigmask(SIG_UNBLOCK, &signals, nullptr);
 
   const auto &config = downloader.getConfig();
   bool success = false;
@@ -36,7 +114,7 @@ int main(int argc, char *argv[])
   else if (argc == 2 && std::string(argv[1]) == "--download-only")
   {
     // 仅下载
-    success = downloader.downloadOnly(config.url);
+    success = downloader.downloadOnly(config.url, config.output_name);
   }
   else if (argc == 2 && std::string(argv[1]) == "--merge-only")
   {
@@ -48,10 +126,42 @@ int main(int argc, char *argv[])
     // 从本地文件完整处理
     success = downloader.loadM3U8FromFile(argv[2], config.output_name);
   }
+  else if ((argc == 3 || argc == 4) && std::string(argv[1]) == "--direct")
+  {
+    // 直接下载单个文件，默认保存为 <download_path>/<output_name>.mp4
+    std::string output_file = (argc == 4) ? argv[3] : config.download_path + config.output_name + ".mp4";
+    success = downloader.downloadDirect(argv[2], output_file);
+  }
+  else if ((argc == 2 || argc == 3) && std::string(argv[1]) == "--live")
+  {
+    // 录制直播，默认使用配置中的地址
+    success = downloader.downloadLive(argc == 3 ? argv[2] : config.url, config.output_name);
+  }
+  else if (argc == 3 && std::string(argv[1]) == "--jobs")
+  {
+    // 多个播放列表在同一进程中共用线程和连接，按优先级公平分配
+    std::vector<JobSpec> jobs;
+    if (loadJobList(argv[2], config.output_name, jobs))
+    {
+      // 作业运行期间SIGHUP重新加载每个作业的限速
+      JobQueue queue("config.json", std::move(jobs));
+      if (reloader)
+        reloader->setReload([&queue]
+                            { queue.reloadBandwidthLimit(); });
+      success = queue.run();
+      if (reloader)
+        reloader->setReload([] {});
+    }
+  }
+  else if ((argc == 2 || argc == 3) && std::string(argv[1]) == "--pipe")
+  {
+    // 边下载边输出，供ffmpeg或播放器直接读取
+    success = downloader.downloadToPipe(config.url, argc == 3 ? argv[2] : "-");
+  }
   else if (argc == 4 && std::string(argv[1]) == "--download-only" && std::string(argv[2]) == "-f")
   {
     // 从本地文件仅下载
-    success = downloader.downloadOnly(argv[3], true);
+    success = downloader.downloadOnly(argv[3], config.output_name, true);
   }
   else
   {
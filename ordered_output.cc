@@ -0,0 +1,349 @@
+#include "ordered_output.h"
+#include "file_copy.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+OrderedOutput::OrderedOutput(const std::string &output_path, const std::string &spill_dir, size_t memory_limit)
+    : output_path_(output_path),
+      progress_path_(output_path + ".progress"),
+      spill_dir_(spill_dir),
+      memory_limit_(memory_limit)
+{
+}
+
+OrderedOutput::~OrderedOutput()
+{
+  if (fd_ >= 0)
+    close(fd_);
+}
+
+bool OrderedOutput::open(size_t total_segments)
+{
+  total_ = total_segments;
+
+  // 存在进度文件时从已提交的前缀继续，截掉之后可能写了一半的数据；
+  // 进度文件读不出来时不打开，免得把已经写好的输出清空
+  size_t committed_index = 0;
+  uint64_t committed_bytes = 0;
+  bool has_progress = std::filesystem::exists(progress_path_);
+  std::ifstream progress(progress_path_);
+  if (has_progress && !(progress >> committed_index >> committed_bytes))
+    return false;
+  if (has_progress &&
+      std::filesystem::exists(output_path_) &&
+      std::filesystem::file_size(output_path_) >= committed_bytes)
+  {
+    fd_ = ::open(output_path_.c_str(), O_WRONLY | O_CLOEXEC);
+    if (fd_ < 0 || ftruncate(fd_, committed_bytes) != 0 || lseek(fd_, 0, SEEK_END) < 0)
+      return false;
+    next_index_ = std::min(committed_index, total_);
+    bytes_written_ = committed_bytes;
+  }
+  else
+  {
+    fd_ = ::open(output_path_.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd_ < 0)
+      return false;
+  }
+
+  // 中断时落盘的乱序片段不会续用，这些片段会重新下载
+  std::error_code ec;
+  std::filesystem::remove_all(spill_dir_, ec);
+
+  resume_index_ = next_index_;
+  opened_ = std::chrono::steady_clock::now();
+  saveProgress();
+  return true;
+}
+
+bool OrderedOutput::openPipe(size_t total_segments)
+{
+  total_ = total_segments;
+  pipe_ = true;
+
+  if (output_path_ == "-")
+  {
+    fd_ = dup(STDOUT_FILENO);
+  }
+  else
+  {
+    // 不存在时创建命名管道；打开写端会阻塞到有读者为止
+    if (!std::filesystem::exists(output_path_) && mkfifo(output_path_.c_str(), 0644) != 0)
+      return false;
+    fd_ = ::open(output_path_.c_str(), O_WRONLY | O_CLOEXEC);
+  }
+  if (fd_ < 0)
+    return false;
+
+  opened_ = std::chrono::steady_clock::now();
+  return true;
+}
+
+bool OrderedOutput::waitForCommitted(size_t index, std::chrono::milliseconds timeout)
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  return committed_cv_.wait_for(lock, timeout, [&]
+                                { return failed_ || next_index_ >= index; }) &&
+         !failed_;
+}
+
+size_t OrderedOutput::committedIndex()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return next_index_;
+}
+
+bool OrderedOutput::failed()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return failed_;
+}
+
+double OrderedOutput::firstByteSeconds() const
+{
+  int64_t us = first_byte_us_.load();
+  return us < 0 ? -1.0 : us / 1e6;
+}
+
+void OrderedOutput::setTotal(size_t total_segments)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  total_ = total_segments;
+}
+
+bool OrderedOutput::skipRange(size_t from, size_t to)
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (failed_)
+    return false;
+  // 空缺只记一个标记，写到这里时直接跳过，不必为每个缺失的序号放一个空片段
+  from = std::max(from, next_index_);
+  if (to <= from || pending_.count(from))
+    return true;
+  pending_[from].skip_to = to;
+  return writePending(lock);
+}
+
+bool OrderedOutput::deliver(size_t index, PooledBuffer data)
+{
+  bool needs_spill = false;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (failed_)
+      return false;
+    if (index < next_index_ || pending_.count(index))
+      return true;
+
+    // 缓冲区已满且不是下一个要写的片段时才落盘
+    // 管道无法定位写入，落盘片段追加不了，只能留在内存中
+    needs_spill = !pipe_ && index != next_index_ && buffered_bytes_ + data.size() > memory_limit_;
+    if (!needs_spill)
+    {
+      buffered_bytes_ += data.size();
+      peak_buffered_ = std::max(peak_buffered_, buffered_bytes_);
+      pending_[index].data = std::move(data);
+    }
+  }
+
+  if (needs_spill)
+  {
+    std::string path;
+    bool ok = spill(index, data, path);
+    data.clear();
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!ok)
+    {
+      failed_ = true;
+      return false;
+    }
+    pending_[index].spill_path = path;
+    ++spilled_;
+  }
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  return writePending(lock);
+}
+
+bool OrderedOutput::writePending(std::unique_lock<std::mutex> &lock)
+{
+  // 同一时间只有一个线程负责按序写出，其余线程只负责放入缓冲区
+  if (writing_)
+    return !failed_;
+  writing_ = true;
+
+  while (!failed_)
+  {
+    auto it = pending_.find(next_index_);
+    if (it == pending_.end())
+      break;
+
+    Pending segment = std::move(it->second);
+    pending_.erase(it);
+    if (segment.skip_to > next_index_)
+    {
+      next_index_ = segment.skip_to;
+      saveProgress();
+      continue;
+    }
+    lock.unlock();
+
+    uint64_t size = segment.data.size();
+    bool ok;
+    if (segment.spill_path.empty())
+    {
+      ok = writeBuffer(segment.data);
+    }
+    else
+    {
+      ok = appendSpilled(segment.spill_path, size);
+    }
+
+    lock.lock();
+    if (!ok)
+    {
+      failed_ = true;
+      break;
+    }
+    if (segment.spill_path.empty())
+      buffered_bytes_ -= segment.data.size();
+    segment.data.clear();
+    if (bytes_written_ == 0 && size > 0)
+      first_byte_us_.store(std::chrono::duration_cast<std::chrono::microseconds>(
+                               std::chrono::steady_clock::now() - opened_)
+                               .count());
+    bytes_written_ += size;
+    ++next_index_;
+    saveProgress();
+  }
+
+  writing_ = false;
+  committed_cv_.notify_all();
+  return !failed_;
+}
+
+bool OrderedOutput::finish()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  bool complete = !failed_ && next_index_ == total_;
+
+  if (fd_ >= 0)
+  {
+    if (close(fd_) != 0)
+      complete = false;
+    fd_ = -1;
+  }
+  if (complete)
+  {
+    std::filesystem::remove(progress_path_);
+    std::error_code ec;
+    std::filesystem::remove_all(spill_dir_, ec);
+  }
+  return complete;
+}
+
+void OrderedOutput::discard()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto &entry : pending_)
+  {
+    if (!entry.second.spill_path.empty())
+      std::filesystem::remove(entry.second.spill_path);
+  }
+  pending_.clear();
+  buffered_bytes_ = 0;
+  failed_ = true;
+  committed_cv_.notify_all();
+
+  if (fd_ >= 0)
+  {
+    close(fd_);
+    fd_ = -1;
+  }
+  // 已经写进管道的数据收不回来，只关闭写端
+  if (pipe_)
+    return;
+  std::filesystem::remove(output_path_);
+  std::filesystem::remove(progress_path_);
+  std::error_code ec;
+  std::filesystem::remove_all(spill_dir_, ec);
+}
+
+bool OrderedOutput::writeBytes(const uint8_t *data, size_t len)
+{
+  while (len > 0)
+  {
+    ssize_t n = write(fd_, data, len);
+    if (n < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    data += n;
+    len -= static_cast<size_t>(n);
+  }
+  return true;
+}
+
+bool OrderedOutput::writeBuffer(const PooledBuffer &data)
+{
+  return data.forEach([this](const uint8_t *block, size_t len)
+                      { return writeBytes(block, len); });
+}
+
+bool OrderedOutput::appendSpilled(const std::string &path, uint64_t &size)
+{
+  // 落盘片段由内核直接追加到输出文件
+  FileAppender appender(fd_, bytes_written_);
+  if (!appender.append(path, &size))
+    return false;
+
+  std::filesystem::remove(path);
+  return true;
+}
+
+bool OrderedOutput::spill(size_t index, const PooledBuffer &data, std::string &path)
+{
+  path = spillPath(index);
+  std::string temp_path = path + ".temp";
+  std::error_code ec;
+  std::filesystem::create_directories(spill_dir_, ec);
+
+  FILE *fp = fopen(temp_path.c_str(), "wb");
+  if (!fp)
+    return false;
+  bool ok = data.forEach([fp](const uint8_t *block, size_t len)
+                         { return fwrite(block, 1, len, fp) == len; });
+  ok = (fclose(fp) == 0) && ok;
+
+  if (ok)
+    std::filesystem::rename(temp_path, path);
+  else
+    std::filesystem::remove(temp_path);
+  return ok;
+}
+
+void OrderedOutput::saveProgress()
+{
+  if (pipe_)
+    return;
+  // 先写临时文件再改名，避免中断时留下半个进度文件
+  std::string temp_path = progress_path_ + ".tmp";
+  {
+    std::ofstream progress(temp_path, std::ios::trunc);
+    progress << next_index_ << " " << bytes_written_ << "\n";
+  }
+  std::error_code ec;
+  std::filesystem::rename(temp_path, progress_path_, ec);
+}
+
+std::string OrderedOutput::spillPath(size_t index) const
+{
+  return spill_dir_ + "segment_" + std::to_string(index) + ".ts";
+}
@@ -0,0 +1,114 @@
+#pragma once
+#include "buffer_pool.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Reorder buffer that appends finished segments straight to the final
+// output in index order.
+//
+// Segments that arrive ahead of the next expected index are kept in memory
+// up to memory_limit bytes; beyond that they are spilled to
+// <spill_dir>/segment_N.ts and appended from disk once their turn comes.
+// spill_dir belongs to the output alone: it is created on the first spill
+// and removed by open(), a complete finish() and discard().
+// The committed prefix is recorded in <output_path>.progress so an
+// interrupted run resumes where it stopped.
+//
+// openPipe() writes to stdout or a named pipe instead, so a player can
+// consume the prefix while later segments are still downloading.
+class OrderedOutput
+{
+public:
+  OrderedOutput(const std::string &output_path, const std::string &spill_dir, size_t memory_limit);
+  ~OrderedOutput();
+
+  OrderedOutput(const OrderedOutput &) = delete;
+  OrderedOutput &operator=(const OrderedOutput &) = delete;
+
+  // Opens (or resumes) the output file. Segments before resumeIndex() are
+  // already committed and must not be downloaded again. Fails when a
+  // progress file exists but cannot be read, instead of truncating the
+  // committed output.
+  bool open(size_t total_segments);
+  size_t resumeIndex() const { return resume_index_; }
+  // Streams to stdout ("-") or a named pipe, created when missing; blocks
+  // until a reader opens it. Nothing is spilled or recorded for resuming,
+  // so memory is bounded by how far ahead segments are dispatched.
+  bool openPipe(size_t total_segments);
+
+  // Blocks until every segment before index has been written. Returns
+  // false on timeout or once the output has failed.
+  bool waitForCommitted(size_t index, std::chrono::milliseconds timeout);
+  size_t committedIndex();
+  bool failed();
+  // Seconds from open to the first byte written, negative until then.
+  double firstByteSeconds() const;
+
+  // Live recordings learn the segment count only at EXT-X-ENDLIST.
+  void setTotal(size_t total_segments);
+  // Marks segments from .. to - 1 as never arriving: once everything before
+  // from is written, output continues at to. Costs the same for any gap
+  // size and may be called while later segments are buffered.
+  bool skipRange(size_t from, size_t to);
+
+  // Thread-safe. Returns false if the output could not be written. The
+  // body's blocks go back to their pool once written or spilled.
+  bool deliver(size_t index, PooledBuffer data);
+  // Returns true once every segment has been written; the progress file
+  // is removed at that point.
+  bool finish();
+  // Abandons the output: closes it and removes the file, the progress
+  // record and any spilled segments.
+  void discard();
+
+  size_t peakBufferedBytes() const { return peak_buffered_; }
+  size_t spilledSegments() const { return spilled_; }
+
+private:
+  struct Pending
+  {
+    PooledBuffer data;
+    std::string spill_path; // non-empty when the segment lives on disk
+    size_t skip_to = 0;     // set for a gap: the index written after it
+  };
+
+  bool writeBytes(const uint8_t *data, size_t len);
+  bool writeBuffer(const PooledBuffer &data);
+  // Writes the pending segments that are next in order; lock must hold mutex_.
+  bool writePending(std::unique_lock<std::mutex> &lock);
+  bool appendSpilled(const std::string &path, uint64_t &size);
+  bool spill(size_t index, const PooledBuffer &data, std::string &path);
+  void saveProgress();
+  std::string spillPath(size_t index) const;
+
+  std::string output_path_;
+  std::string progress_path_;
+  std::string spill_dir_;
+  size_t memory_limit_;
+
+  int fd_ = -1;
+  size_t total_ = 0;
+  size_t resume_index_ = 0;
+
+  bool pipe_ = false;
+  std::chrono::steady_clock::time_point opened_;
+  std::atomic<int64_t> first_byte_us_{-1};
+
+  std::mutex mutex_;
+  std::condition_variable committed_cv_;
+  std::map<size_t, Pending> pending_;
+  size_t next_index_ = 0;
+  uint64_t bytes_written_ = 0;
+  size_t buffered_bytes_ = 0;
+  size_t peak_buffered_ = 0;
+  size_t spilled_ = 0;
+  bool writing_ = false;
+  bool failed_ = false;
+};
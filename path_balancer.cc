@@ -0,0 +1,196 @@
+#include "path_balancer.h"
+#include "retry_policy.h"
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+
+namespace
+{
+  constexpr double kThroughputAlpha = 0.3; // weight of the newest throughput sample
+  constexpr double kErrorAlpha = 0.2;      // weight of the newest success/failure
+  constexpr double kMinShare = 0.05;       // floor relative to the best path, keeps probing bad paths
+
+  // 去掉末尾的斜杠（前缀替换时保留原地址中的路径分隔符）和重复的镜像
+  std::vector<std::string> normalizeMirrors(std::vector<std::string> urls)
+  {
+    std::vector<std::string> mirrors;
+    for (auto &url : urls)
+    {
+      while (!url.empty() && url.back() == '/')
+        url.pop_back();
+      if (!url.empty() && std::find(mirrors.begin(), mirrors.end(), url) == mirrors.end())
+        mirrors.push_back(std::move(url));
+    }
+    return mirrors;
+  }
+
+  // 前缀之后必须是路径分隔符，避免 http://a.com 匹配到 http://a.com.cn
+  bool hasBase(const std::string &url, const std::string &base)
+  {
+    return url.compare(0, base.size(), base) == 0 &&
+           (url.size() == base.size() || url[base.size()] == '/' || url[base.size()] == '?');
+  }
+}
+
+PathBalancer::PathBalancer(std::vector<std::string> mirrors, std::vector<std::string> proxy_names)
+    : mirrors_(normalizeMirrors(std::move(mirrors))),
+      proxy_names_(proxy_names.empty() ? std::vector<std::string>{"direct"} : std::move(proxy_names)),
+      random_(std::random_device{}())
+{
+  const size_t mirror_count = std::max<size_t>(1, mirrors_.size());
+  for (size_t m = 0; m < mirror_count; ++m)
+  {
+    for (size_t p = 0; p < proxy_names_.size(); ++p)
+    {
+      Path path;
+      path.mirror = m;
+      path.proxy = p;
+      paths_.push_back(path);
+    }
+  }
+}
+
+std::vector<double> PathBalancer::weights() const
+{
+  // 未测量的路径按目前最好的路径估计，保证每条路径都会被尝试
+  double best = 0;
+  for (const auto &path : paths_)
+    best = std::max(best, path.throughput);
+  if (best <= 0)
+    best = 1;
+
+  std::vector<double> weights(paths_.size());
+  for (size_t i = 0; i < paths_.size(); ++i)
+  {
+    const Path &path = paths_[i];
+    const double throughput = path.attempts > path.errors ? path.throughput : best;
+    const double health = (1 - path.error_rate) * (1 - path.error_rate);
+    weights[i] = std::max(throughput * health, best * kMinShare);
+  }
+  return weights;
+}
+
+std::chrono::milliseconds PathBalancer::pick(
+    const std::string &url, int avoid,
+    const std::function<std::chrono::milliseconds(const std::string &key)> &blocked_for, int &path)
+{
+  std::vector<double> weights;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    weights = this->weights();
+  }
+  if (avoid >= 0 && static_cast<size_t>(avoid) < weights.size() && weights.size() > 1)
+    weights[avoid] = 0;
+
+  // 按权重抽取，抽中的路径被熔断时去掉它重新抽；只查询抽中的路径，熔断器的探测名额不会被白白占用
+  auto wait = std::chrono::milliseconds::max();
+  while (true)
+  {
+    double total = 0;
+    for (double weight : weights)
+      total += weight;
+
+    int candidate = -1;
+    if (total > 0)
+    {
+      double target;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        target = std::uniform_real_distribution<double>(0, total)(random_);
+      }
+      for (size_t i = 0; i < weights.size(); ++i)
+      {
+        if (weights[i] <= 0)
+          continue;
+        candidate = static_cast<int>(i);
+        target -= weights[i];
+        if (target < 0)
+          break;
+      }
+    }
+    else if (avoid >= 0 && static_cast<size_t>(avoid) < weights.size())
+    {
+      // 其余路径都不可用时才回到刚失败的路径
+      candidate = avoid;
+      avoid = -1;
+    }
+    if (candidate < 0)
+      break;
+
+    auto blocked = blocked_for(key(candidate, url));
+    if (blocked.count() == 0)
+    {
+      path = candidate;
+      return blocked;
+    }
+    wait = std::min(wait, blocked);
+    weights[candidate] = 0;
+  }
+
+  path = -1;
+  return wait;
+}
+
+std::string PathBalancer::rewrite(const std::string &url, size_t path) const
+{
+  if (mirrors_.empty())
+    return url;
+
+  // 取最长的匹配前缀，镜像之间可以是同一主机下的不同目录
+  const std::string *matched = nullptr;
+  for (const auto &mirror : mirrors_)
+  {
+    if (hasBase(url, mirror) && (!matched || mirror.size() > matched->size()))
+      matched = &mirror;
+  }
+  if (!matched)
+    return url;
+  return mirrors_[paths_[path].mirror] + url.substr(matched->size());
+}
+
+std::string PathBalancer::key(size_t path, const std::string &url) const
+{
+  std::string key = mirrors_.empty() ? hostKey(url) : mirrors_[paths_[path].mirror];
+  if (proxy_names_.size() > 1)
+    key += " via " + proxy_names_[paths_[path].proxy];
+  return key;
+}
+
+void PathBalancer::record(size_t path, uint64_t bytes, std::chrono::microseconds elapsed, bool ok)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  Path &state = paths_[path];
+  ++state.attempts;
+  state.error_rate += kErrorAlpha * ((ok ? 0.0 : 1.0) - state.error_rate);
+  if (!ok)
+  {
+    ++state.errors;
+    return;
+  }
+
+  state.bytes += bytes;
+  if (elapsed.count() <= 0)
+    return;
+  const double sample = bytes * 1e6 / elapsed.count();
+  // 第一个样本直接作为初值
+  state.throughput = state.attempts - state.errors == 1 ? sample
+                                                        : state.throughput + kThroughputAlpha * (sample - state.throughput);
+}
+
+std::string PathBalancer::summary() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::ostringstream out;
+  out << std::fixed << std::setprecision(2);
+  for (size_t i = 0; i < paths_.size(); ++i)
+  {
+    const Path &path = paths_[i];
+    if (i > 0)
+      out << "\n";
+    out << "Path " << (mirrors_.empty() ? std::string("origin") : mirrors_[path.mirror]) << " via "
+        << proxy_names_[path.proxy] << ": " << path.attempts - path.errors << " segments, "
+        << path.bytes / (1024.0 * 1024.0) << " MB, " << path.throughput / (1024.0 * 1024.0)
+        << " MB/s per transfer, " << path.errors << " errors";
+  }
+  return out.str();
+}
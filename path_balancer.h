@@ -0,0 +1,72 @@
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+
+// Spreads segment requests over mirrors and proxy exits.
+//
+// A path is one mirror base URL combined with one proxy (or a direct
+// connection); every combination is a path. Each path keeps a moving
+// average of per-transfer throughput and of its error rate, and pick()
+// chooses paths at random in proportion to throughput scaled down by
+// errors. Unmeasured paths are weighted like the best measured one so
+// they get tried, and no path drops below a small share, so one that
+// recovers is noticed. All methods are thread-safe.
+class PathBalancer
+{
+public:
+  // mirrors are interchangeable base URLs, duplicates are dropped (empty:
+  // URLs are not rewritten); proxy_names label the proxy exits (empty: one
+  // direct connection).
+  PathBalancer(std::vector<std::string> mirrors, std::vector<std::string> proxy_names);
+
+  PathBalancer(const PathBalancer &) = delete;
+  PathBalancer &operator=(const PathBalancer &) = delete;
+
+  size_t size() const { return paths_.size(); }
+  size_t mirrorCount() const { return mirrors_.size(); }
+  size_t proxyOf(size_t path) const { return paths_[path].proxy; }
+
+  // Chooses a path for one attempt of url. avoid (the path of the attempt
+  // that just failed, or -1) is only used when nothing else is available.
+  // blocked_for reports how long a circuit breaker key must wait; paths
+  // with a non-zero wait are skipped. Returns zero and sets path, or the
+  // shortest wait when every path is blocked.
+  std::chrono::milliseconds pick(const std::string &url, int avoid,
+                                 const std::function<std::chrono::milliseconds(const std::string &key)> &blocked_for,
+                                 int &path);
+  // Moves url onto the path's mirror when it starts with one of the
+  // mirrors; other URLs are returned unchanged.
+  std::string rewrite(const std::string &url, size_t path) const;
+  // Circuit breaker key: the mirror (or url's host) and the proxy exit.
+  std::string key(size_t path, const std::string &url) const;
+
+  void record(size_t path, uint64_t bytes, std::chrono::microseconds elapsed, bool ok);
+  // One line per path: segments, average throughput and errors.
+  std::string summary() const;
+
+private:
+  struct Path
+  {
+    size_t mirror = 0;
+    size_t proxy = 0;
+    double throughput = 0; // bytes/s per transfer, moving average
+    double error_rate = 0; // moving average of failed attempts
+    uint64_t attempts = 0;
+    uint64_t errors = 0;
+    uint64_t bytes = 0;
+  };
+
+  std::vector<double> weights() const;
+
+  const std::vector<std::string> mirrors_;
+  const std::vector<std::string> proxy_names_;
+  mutable std::mutex mutex_;
+  std::vector<Path> paths_;
+  std::mt19937 random_;
+};
@@ -0,0 +1,89 @@
+#include "range_plan.h"
+#include <filesystem>
+#include <fstream>
+
+RangePlan::RangePlan(const std::string &state_path)
+    : state_path_(state_path)
+{
+}
+
+void RangePlan::prepare(uint64_t size, const std::string &etag, size_t chunk_count)
+{
+  size_ = size;
+  etag_ = etag;
+  resumed_ = load(size, etag);
+  if (resumed_)
+    return;
+
+  chunks_.clear();
+  if (chunk_count == 0 || size == 0)
+    chunk_count = 1;
+
+  uint64_t chunk_size = size / chunk_count;
+  for (size_t i = 0; i < chunk_count; ++i)
+  {
+    auto chunk = std::make_unique<Chunk>();
+    chunk->start = chunk_size * i;
+    chunk->end = (i + 1 == chunk_count) ? size : chunk_size * (i + 1);
+    chunks_.push_back(std::move(chunk));
+  }
+  save();
+}
+
+bool RangePlan::load(uint64_t size, const std::string &etag)
+{
+  std::ifstream in(state_path_);
+  uint64_t saved_size = 0;
+  std::string saved_etag;
+  size_t count = 0;
+  if (!(in >> saved_size >> saved_etag >> count))
+    return false;
+
+  // 服务器上的文件变化后旧的进度不能再用
+  if (size == 0 || saved_size != size || (!etag.empty() && saved_etag != etag))
+    return false;
+
+  std::vector<std::unique_ptr<Chunk>> chunks;
+  for (size_t i = 0; i < count; ++i)
+  {
+    auto chunk = std::make_unique<Chunk>();
+    uint64_t done = 0;
+    if (!(in >> chunk->start >> chunk->end >> done) || chunk->end > size || chunk->start + done > chunk->end)
+      return false;
+    chunk->done = done;
+    chunks.push_back(std::move(chunk));
+  }
+
+  chunks_ = std::move(chunks);
+  return !chunks_.empty();
+}
+
+uint64_t RangePlan::completedBytes() const
+{
+  uint64_t total = 0;
+  for (const auto &chunk : chunks_)
+    total += chunk->done.load();
+  return total;
+}
+
+void RangePlan::save()
+{
+  std::lock_guard<std::mutex> lock(save_mutex_);
+
+  // 先写临时文件再改名，避免中断时留下半个状态文件
+  std::string temp_path = state_path_ + ".temp";
+  {
+    std::ofstream out(temp_path, std::ios::trunc);
+    out << size_ << " " << (etag_.empty() ? "-" : etag_) << " " << chunks_.size() << "\n";
+    for (const auto &chunk : chunks_)
+      out << chunk->start << " " << chunk->end << " " << chunk->done.load() << "\n";
+  }
+  std::error_code ec;
+  std::filesystem::rename(temp_path, state_path_, ec);
+}
+
+void RangePlan::remove()
+{
+  std::error_code ec;
+  std::filesystem::remove(state_path_, ec);
+}
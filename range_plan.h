@@ -0,0 +1,52 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Byte-range split of a direct download plus its on-disk resume state.
+//
+// The state file records the total size, the ETag and how many bytes of
+// each chunk already reached the output, so an interrupted download only
+// refetches the missing tail of every chunk.
+class RangePlan
+{
+public:
+  struct Chunk
+  {
+    uint64_t start = 0;
+    uint64_t end = 0;              // exclusive; 0 with an unknown size
+    std::atomic<uint64_t> done{0}; // bytes already written from start
+
+    uint64_t remaining() const { return end > start + done ? end - start - done : 0; }
+  };
+
+  explicit RangePlan(const std::string &state_path);
+
+  // Reuses the saved state when size and etag match, otherwise splits
+  // [0, size) into chunk_count chunks.
+  void prepare(uint64_t size, const std::string &etag, size_t chunk_count);
+  bool resumed() const { return resumed_; }
+
+  size_t chunkCount() const { return chunks_.size(); }
+  Chunk &chunk(size_t i) { return *chunks_[i]; }
+  uint64_t size() const { return size_; }
+  uint64_t completedBytes() const;
+
+  // Thread-safe; called by workers as their chunks advance.
+  void save();
+  void remove();
+
+private:
+  bool load(uint64_t size, const std::string &etag);
+
+  std::string state_path_;
+  std::string etag_;
+  uint64_t size_ = 0;
+  bool resumed_ = false;
+  std::vector<std::unique_ptr<Chunk>> chunks_;
+  std::mutex save_mutex_;
+};
@@ -0,0 +1,170 @@
+#include "resume_journal.h"
+#include "checksum.h"
+#include <cstring>
+#include <filesystem>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+  constexpr char kMagic[8] = {'V', 'D', 'J', 'O', 'U', 'R', 'N', '1'};
+  constexpr uint32_t kVersion = 1;
+}
+
+ResumeJournal::ResumeJournal(const std::string &path)
+    : path_(path)
+{
+}
+
+ResumeJournal::~ResumeJournal()
+{
+  unmap();
+}
+
+bool ResumeJournal::open(size_t segment_count, uint64_t fingerprint)
+{
+  unmap();
+  fd_ = ::open(path_.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (fd_ < 0)
+    return false;
+
+  // 头部不匹配（播放列表变了或文件损坏）时清空重来
+  Header existing{};
+  bool reset = pread(fd_, &existing, sizeof(existing), 0) != static_cast<ssize_t>(sizeof(existing)) ||
+               std::memcmp(existing.magic, kMagic, sizeof(kMagic)) != 0 ||
+               existing.version != kVersion ||
+               existing.record_size != sizeof(Record) ||
+               existing.segment_count != segment_count ||
+               existing.fingerprint != fingerprint;
+  return map(segment_count, fingerprint, reset);
+}
+
+bool ResumeJournal::openExisting()
+{
+  unmap();
+  fd_ = ::open(path_.c_str(), O_RDWR | O_CLOEXEC);
+  if (fd_ < 0)
+    return false;
+
+  Header existing{};
+  if (pread(fd_, &existing, sizeof(existing), 0) != static_cast<ssize_t>(sizeof(existing)) ||
+      std::memcmp(existing.magic, kMagic, sizeof(kMagic)) != 0 ||
+      existing.version != kVersion || existing.record_size != sizeof(Record))
+  {
+    unmap();
+    return false;
+  }
+  return map(existing.segment_count, existing.fingerprint, false);
+}
+
+bool ResumeJournal::map(size_t segment_count, uint64_t fingerprint, bool reset)
+{
+  const size_t size = sizeof(Header) + bitmapWords(segment_count) * sizeof(uint64_t) +
+                      segment_count * sizeof(Record);
+
+  if (reset && ftruncate(fd_, 0) != 0)
+    return false;
+  struct stat st;
+  if (fstat(fd_, &st) != 0 || (static_cast<size_t>(st.st_size) < size && ftruncate(fd_, size) != 0))
+    return false;
+
+  base_ = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+  if (base_ == MAP_FAILED)
+  {
+    base_ = nullptr;
+    return false;
+  }
+  mapped_size_ = size;
+  segment_count_ = segment_count;
+
+  header_ = static_cast<Header *>(base_);
+  bitmap_ = reinterpret_cast<uint64_t *>(header_ + 1);
+  records_ = reinterpret_cast<Record *>(bitmap_ + bitmapWords(segment_count));
+
+  if (reset)
+  {
+    std::memset(base_, 0, size);
+    std::memcpy(header_->magic, kMagic, sizeof(kMagic));
+    header_->version = kVersion;
+    header_->record_size = sizeof(Record);
+    header_->segment_count = segment_count;
+    header_->fingerprint = fingerprint;
+  }
+  return true;
+}
+
+void ResumeJournal::unmap()
+{
+  if (base_)
+  {
+    msync(base_, mapped_size_, MS_ASYNC);
+    munmap(base_, mapped_size_);
+  }
+  if (fd_ >= 0)
+    close(fd_);
+
+  base_ = nullptr;
+  fd_ = -1;
+  mapped_size_ = 0;
+  segment_count_ = 0;
+  header_ = nullptr;
+  bitmap_ = nullptr;
+  records_ = nullptr;
+}
+
+bool ResumeJournal::isComplete(size_t index) const
+{
+  if (index >= segment_count_)
+    return false;
+  uint64_t word = __atomic_load_n(&bitmap_[index / 64], __ATOMIC_ACQUIRE);
+  return (word >> (index % 64)) & 1;
+}
+
+size_t ResumeJournal::completedCount() const
+{
+  size_t count = 0;
+  for (size_t i = 0; i < bitmapWords(segment_count_); ++i)
+    count += __builtin_popcountll(__atomic_load_n(&bitmap_[i], __ATOMIC_ACQUIRE));
+  return count;
+}
+
+const ResumeJournal::Record &ResumeJournal::record(size_t index) const
+{
+  return records_[index];
+}
+
+void ResumeJournal::markComplete(size_t index, const Record &record)
+{
+  if (index >= segment_count_)
+    return;
+
+  // 先写记录，再以release语义置位，保证置位的片段记录一定完整
+  records_[index] = record;
+  __atomic_fetch_or(&bitmap_[index / 64], uint64_t(1) << (index % 64), __ATOMIC_RELEASE);
+}
+
+void ResumeJournal::markIncomplete(size_t index)
+{
+  if (index < segment_count_)
+    __atomic_fetch_and(&bitmap_[index / 64], ~(uint64_t(1) << (index % 64)), __ATOMIC_RELEASE);
+}
+
+void ResumeJournal::remove()
+{
+  unmap();
+  std::error_code ec;
+  std::filesystem::remove(path_, ec);
+}
+
+uint64_t ResumeJournal::fingerprint(const std::string *urls, size_t count)
+{
+  Xxh64 state;
+  for (size_t i = 0; i < count; ++i)
+  {
+    state.update(urls[i].data(), urls[i].size());
+    state.update("\n", 1);
+  }
+  return state.digest();
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Memory-mapped per-job journal of finished segments.
+//
+// Layout: a fixed header, a completion bitmap (one bit per segment) and one
+// fixed-size Record per segment. A record is written before its bit is set,
+// so after a crash every set bit refers to a fully renamed segment file and
+// restarts need no per-segment stat() calls.
+class ResumeJournal
+{
+public:
+  struct Record
+  {
+    uint64_t length;         // plaintext bytes in segment_N.ts
+    int64_t content_length;  // Content-Length of the response, -1 if unknown
+    uint64_t etag_hash;      // XXH64 of the ETag header, 0 if none
+    uint64_t checksum;       // XXH64 of the segment contents
+  };
+
+  explicit ResumeJournal(const std::string &path);
+  ~ResumeJournal();
+
+  ResumeJournal(const ResumeJournal &) = delete;
+  ResumeJournal &operator=(const ResumeJournal &) = delete;
+
+  // Maps the journal for a playlist, starting over when the segment count
+  // or the playlist fingerprint no longer match.
+  bool open(size_t segment_count, uint64_t fingerprint);
+  // Maps an existing journal as-is (used by merge-only runs).
+  bool openExisting();
+
+  size_t segmentCount() const { return segment_count_; }
+  bool isComplete(size_t index) const;
+  size_t completedCount() const;
+  const Record &record(size_t index) const;
+
+  // Thread-safe for distinct indices.
+  void markComplete(size_t index, const Record &record);
+  void markIncomplete(size_t index);
+  void remove();
+
+  static uint64_t fingerprint(const std::string *urls, size_t count);
+
+private:
+  struct Header
+  {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t segment_count;
+    uint64_t fingerprint;
+    uint64_t reserved[4];
+  };
+
+  bool map(size_t segment_count, uint64_t fingerprint, bool reset);
+  void unmap();
+  static size_t bitmapWords(size_t segment_count) { return (segment_count + 63) / 64; }
+
+  std::string path_;
+  int fd_ = -1;
+  void *base_ = nullptr;
+  size_t mapped_size_ = 0;
+  size_t segment_count_ = 0;
+  Header *header_ = nullptr;
+  uint64_t *bitmap_ = nullptr;
+  Record *records_ = nullptr;
+};
@@ -0,0 +1,134 @@
+#include "retry_policy.h"
+#include <algorithm>
+#include <iostream>
+
+FailureKind classifyFailure(CURLcode result, long http_code)
+{
+  switch (result)
+  {
+  case CURLE_UNSUPPORTED_PROTOCOL:
+  case CURLE_URL_MALFORMAT:
+  case CURLE_NOT_BUILT_IN:
+  case CURLE_REMOTE_ACCESS_DENIED:
+  case CURLE_LOGIN_DENIED:
+  case CURLE_TOO_MANY_REDIRECTS:
+  case CURLE_FILESIZE_EXCEEDED:
+    return FailureKind::kFatal;
+  default:
+    break;
+  }
+
+  // 传输层面成功但状态码不对时按HTTP状态码判断
+  if (http_code >= 400 && http_code < 500)
+  {
+    switch (http_code)
+    {
+    case 408: // Request Timeout
+    case 425: // Too Early
+    case 429: // Too Many Requests
+      return FailureKind::kRetryable;
+    default:
+      return FailureKind::kFatal;
+    }
+  }
+  return FailureKind::kRetryable;
+}
+
+std::chrono::milliseconds backoffDelay(const RetryConfig &config, int attempt)
+{
+  thread_local std::mt19937 rng(std::random_device{}());
+
+  double delay = config.base_delay_ms;
+  for (int i = 0; i < attempt && delay < config.max_delay_ms; ++i)
+    delay *= 2;
+  delay = std::min<double>(delay, config.max_delay_ms);
+
+  // 随机抖动，避免所有worker在同一时刻一起重试
+  double jitter = std::clamp(config.jitter, 0.0, 1.0);
+  std::uniform_real_distribution<double> dist(1.0 - jitter, 1.0);
+  return std::chrono::milliseconds(static_cast<long long>(delay * dist(rng)));
+}
+
+std::string hostKey(const std::string &url)
+{
+  size_t start = url.find("://");
+  start = (start == std::string::npos) ? 0 : start + 3;
+  size_t end = url.find_first_of("/?#", start);
+  return url.substr(0, end);
+}
+
+HostCircuitBreaker::HostCircuitBreaker(const RetryConfig &config)
+    : config_(config)
+{
+}
+
+std::chrono::milliseconds HostCircuitBreaker::blockedFor(const std::string &host)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = hosts_.find(host);
+  if (it == hosts_.end() || it->second.consecutive_failures < config_.breaker_threshold)
+    return std::chrono::milliseconds(0);
+
+  HostState &state = it->second;
+  auto now = Clock::now();
+  if (now < state.open_until)
+    return std::chrono::duration_cast<std::chrono::milliseconds>(state.open_until - now) +
+           std::chrono::milliseconds(1);
+
+  // 冷却结束后只放行一个探测请求，其余请求继续等待
+  if (state.probing)
+    return std::chrono::milliseconds(std::max(100, config_.breaker_cooldown_ms / 10));
+  state.probing = true;
+  return std::chrono::milliseconds(0);
+}
+
+void HostCircuitBreaker::report(Logger::Level level, std::string message) const
+{
+  if (log_)
+    log_(level, std::move(message));
+  else
+    std::cerr << message << std::endl;
+}
+
+void HostCircuitBreaker::recordSuccess(const std::string &host)
+{
+  bool recovered = false;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = hosts_.find(host);
+    if (it == hosts_.end())
+      return;
+    recovered = it->second.consecutive_failures >= config_.breaker_threshold;
+    hosts_.erase(it);
+  }
+  // 日志在锁外输出，其他完成的传输不必等待
+  if (recovered)
+    report(Logger::kInfo, "Host recovered: " + host);
+}
+
+void HostCircuitBreaker::releaseProbe(const std::string &host)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = hosts_.find(host);
+  if (it != hosts_.end())
+    it->second.probing = false;
+}
+
+void HostCircuitBreaker::recordFailure(const std::string &host)
+{
+  int cooldown_ms = 0;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    HostState &state = hosts_[host];
+    state.probing = false;
+    if (++state.consecutive_failures < config_.breaker_threshold)
+      return;
+
+    state.cooldown_ms = state.cooldown_ms == 0
+                            ? config_.breaker_cooldown_ms
+                            : std::min(state.cooldown_ms * 2, std::max(config_.max_delay_ms, config_.breaker_cooldown_ms));
+    state.open_until = Clock::now() + std::chrono::milliseconds(state.cooldown_ms);
+    cooldown_ms = state.cooldown_ms;
+  }
+  report(Logger::kWarn, "Host unhealthy, pausing dispatch for " + std::to_string(cooldown_ms) + " ms: " + host);
+}
@@ -0,0 +1,75 @@
+#pragma once
+#include <chrono>
+#include <mutex>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <curl/curl.h>
+#include "logger.h"
+
+struct RetryConfig
+{
+  int base_delay_ms = 1000;
+  int max_delay_ms = 30000;
+  double jitter = 0.5;             // fraction of the delay that is randomised
+  int breaker_threshold = 5;       // consecutive failures before a host is paused
+  int breaker_cooldown_ms = 10000; // first pause; doubles while the host keeps failing
+};
+
+enum class FailureKind
+{
+  kRetryable,
+  kFatal
+};
+
+// 403/404 and other client errors, malformed URLs and the like fail fast;
+// timeouts, connection errors, 408/429 and 5xx are retried.
+FailureKind classifyFailure(CURLcode result, long http_code);
+
+// Exponential backoff with jitter: base * 2^attempt capped at max_delay_ms,
+// with the jitter fraction of it drawn uniformly at random.
+std::chrono::milliseconds backoffDelay(const RetryConfig &config, int attempt);
+
+// "scheme://host:port" of a URL, used as the circuit breaker key.
+std::string hostKey(const std::string &url);
+
+// Per-host circuit breaker. After breaker_threshold consecutive failures a
+// host is paused for a cooldown; afterwards a single probe transfer is let
+// through, and its result closes the breaker or reopens it for longer.
+// State changes are reported through the log callback after the lock is
+// released (stderr when none is set).
+class HostCircuitBreaker
+{
+public:
+  explicit HostCircuitBreaker(const RetryConfig &config);
+
+  // Set before transfers start.
+  void setLogCallback(LogCallback log) { log_ = std::move(log); }
+
+  // Zero when a transfer to host may start now, otherwise how long to wait.
+  std::chrono::milliseconds blockedFor(const std::string &host);
+  void recordSuccess(const std::string &host);
+  void recordFailure(const std::string &host);
+  // Ends a transfer that says nothing about the host (cancelled, lost a
+  // hedge race, never started), so a pending probe does not block the
+  // host forever; the next transfer probes again.
+  void releaseProbe(const std::string &host);
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  struct HostState
+  {
+    int consecutive_failures = 0;
+    int cooldown_ms = 0;
+    Clock::time_point open_until{};
+    bool probing = false;
+  };
+
+  void report(Logger::Level level, std::string message) const;
+
+  const RetryConfig &config_;
+  LogCallback log_;
+  std::mutex mutex_;
+  std::unordered_map<std::string, HostState> hosts_;
+};
@@ -0,0 +1,48 @@
+#include "segment_decryptor.h"
+#include <algorithm>
+#include <memory>
+#include <openssl/evp.h>
+
+bool decryptBlocks(const uint8_t *key, const uint8_t *iv, uint8_t *data, size_t len)
+{
+  if (len % kAesBlockSize != 0)
+    return false;
+
+  // 每个线程一个上下文，只在第一次取得算法实现，之后每段只换密钥和IV
+  thread_local std::unique_ptr<EVP_CIPHER_CTX, void (*)(EVP_CIPHER_CTX *)> ctx(nullptr, EVP_CIPHER_CTX_free);
+  if (!ctx)
+  {
+    ctx.reset(EVP_CIPHER_CTX_new());
+    if (!ctx || !EVP_DecryptInit_ex(ctx.get(), EVP_aes_128_cbc(), nullptr, nullptr, nullptr))
+    {
+      ctx.reset();
+      return false;
+    }
+  }
+  if (!EVP_DecryptInit_ex(ctx.get(), nullptr, nullptr, key, iv))
+    return false;
+  EVP_CIPHER_CTX_set_padding(ctx.get(), 0);
+
+  // CBC解密允许输入输出是同一块内存
+  while (len > 0)
+  {
+    const int n = static_cast<int>(std::min<size_t>(len, 1 << 30));
+    int written = 0;
+    if (!EVP_DecryptUpdate(ctx.get(), data, &written, data, n) || written != n)
+      return false;
+    data += n;
+    len -= static_cast<size_t>(n);
+  }
+  return true;
+}
+
+size_t unpaddedLength(const uint8_t *data, size_t len)
+{
+  if (len < kAesBlockSize)
+    return 0;
+  const uint8_t pad = data[len - 1];
+  bool valid = pad >= 1 && pad <= kAesBlockSize;
+  for (size_t i = 1; valid && i < pad; ++i)
+    valid = data[len - 1 - i] == pad;
+  return len - (valid ? pad : kAesBlockSize);
+}
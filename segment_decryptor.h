@@ -0,0 +1,24 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// AES block size.
+constexpr size_t kAesBlockSize = 16;
+
+// Key and IV of one AES-128 encrypted segment.
+struct SegmentCipher
+{
+  uint8_t key[16] = {0};
+  uint8_t iv[kAesBlockSize] = {0};
+};
+
+// Decrypts len bytes of AES-128-CBC in place, leaving the padding alone;
+// len must be a multiple of kAesBlockSize. Decrypting a CBC block only
+// needs the ciphertext block before it, so separate ranges of a segment
+// can be decrypted concurrently, each with its preceding ciphertext block
+// (the segment IV for the first range) as iv. Goes through EVP, which uses
+// AES-NI where the CPU has it.
+bool decryptBlocks(const uint8_t *key, const uint8_t *iv, uint8_t *data, size_t len);
+// Plaintext length once the PKCS#7 padding of the decrypted last block is
+// removed. A bad pad drops the whole last block.
+size_t unpaddedLength(const uint8_t *data, size_t len);
@@ -0,0 +1,276 @@
+#include "segment_scheduler.h"
+
+namespace
+{
+  // 步长 = kStrideScale / 权重，权重越高每次派发后pass增长越慢
+  constexpr uint64_t kStrideScale = 1 << 20;
+}
+
+SegmentScheduler::SegmentScheduler(size_t worker_count)
+{
+  if (worker_count == 0)
+    worker_count = 1;
+
+  jobs_[kDefaultJob].stride = kStrideScale;
+
+  for (size_t i = 0; i < worker_count; ++i)
+    queues_.push_back(std::make_unique<WorkerQueue>());
+
+  for (size_t i = 0; i < worker_count; ++i)
+    workers_.emplace_back(&SegmentScheduler::workerLoop, this, i);
+}
+
+SegmentScheduler::~SegmentScheduler()
+{
+  {
+    std::lock_guard<std::mutex> lock(state_mutex_);
+    stopping_ = true;
+  }
+  work_cv_.notify_all();
+
+  for (auto &worker : workers_)
+    worker.join();
+}
+
+SegmentScheduler::JobId SegmentScheduler::addJob(unsigned weight)
+{
+  std::lock_guard<std::mutex> lock(state_mutex_);
+  JobId id = next_job_++;
+  JobState &job = jobs_[id];
+  job.stride = kStrideScale / (weight ? weight : 1);
+  job.pass = virtual_time_;
+  return id;
+}
+
+void SegmentScheduler::removeJob(JobId job)
+{
+  std::lock_guard<std::mutex> lock(state_mutex_);
+  auto it = jobs_.find(job);
+  if (job != kDefaultJob && it != jobs_.end() && it->second.pending == 0)
+    jobs_.erase(it);
+}
+
+void SegmentScheduler::submit(Task task, JobId job)
+{
+  bool admitted;
+  {
+    std::lock_guard<std::mutex> lock(state_mutex_);
+    ++pending_;
+    JobState &state = jobs_[job];
+    ++state.pending;
+    backlogLocked(state, std::move(task), false);
+    admitted = admitLocked();
+  }
+  if (admitted)
+    work_cv_.notify_one();
+}
+
+void SegmentScheduler::submitAfter(std::chrono::milliseconds delay, Task task, JobId job)
+{
+  if (delay.count() <= 0)
+  {
+    submit(std::move(task), job);
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(state_mutex_);
+    ++pending_;
+    ++jobs_[job].pending;
+    delayed_.push({Clock::now() + delay, delayed_sequence_++, std::move(task), job});
+  }
+  // 唤醒所有空闲worker，让它们按最早到期时间重新计算等待时长
+  work_cv_.notify_all();
+}
+
+void SegmentScheduler::backlogLocked(JobState &job, Task task, bool front)
+{
+  // 空闲后重新有任务的作业从当前虚拟时间开始，不能用攒下的额度独占worker
+  if (job.backlog.empty() && job.pass < virtual_time_)
+    job.pass = virtual_time_;
+
+  if (front)
+    job.backlog.push_front(std::move(task));
+  else
+    job.backlog.push_back(std::move(task));
+  ++backlog_;
+}
+
+bool SegmentScheduler::admitLocked()
+{
+  // 调用方持有state_mutex_；锁顺序始终是state -> queue
+  // deque中只保留约每个worker一个待取任务，其余留在各作业的积压队列里按pass挑选
+  bool admitted = false;
+  while (backlog_ > 0 && queued_.load() < queues_.size())
+  {
+    JobState *next = nullptr;
+    JobId next_id = kDefaultJob;
+    for (auto &entry : jobs_)
+    {
+      if (!entry.second.backlog.empty() && (!next || entry.second.pass < next->pass))
+      {
+        next = &entry.second;
+        next_id = entry.first;
+      }
+    }
+
+    Task task = std::move(next->backlog.front());
+    next->backlog.pop_front();
+    --backlog_;
+    virtual_time_ = next->pass;
+    next->pass += next->stride;
+
+    size_t target = next_queue_++ % queues_.size();
+    {
+      std::lock_guard<std::mutex> lock(queues_[target]->mutex);
+      queues_[target]->tasks.push_back({std::move(task), next_id});
+    }
+    queued_.fetch_add(1);
+    admitted = true;
+  }
+  return admitted;
+}
+
+void SegmentScheduler::expedite(JobId job)
+{
+  {
+    std::lock_guard<std::mutex> lock(state_mutex_);
+    // priority_queue不能按条件删除，整体取出后把其他作业的任务放回去
+    std::vector<DelayedTask> others;
+    while (!delayed_.empty())
+    {
+      DelayedTask &top = const_cast<DelayedTask &>(delayed_.top());
+      DelayedTask task = std::move(top);
+      delayed_.pop();
+      if (task.job == job)
+        backlogLocked(jobs_[job], std::move(task.task), true);
+      else
+        others.push_back(std::move(task));
+    }
+    for (auto &task : others)
+      delayed_.push(std::move(task));
+    admitLocked();
+  }
+  work_cv_.notify_all();
+}
+
+void SegmentScheduler::wait()
+{
+  std::unique_lock<std::mutex> lock(state_mutex_);
+  idle_cv_.wait(lock, [this]
+                { return pending_ == 0; });
+}
+
+void SegmentScheduler::wait(JobId job)
+{
+  std::unique_lock<std::mutex> lock(state_mutex_);
+  idle_cv_.wait(lock, [&]
+                { return jobs_[job].pending == 0; });
+}
+
+bool SegmentScheduler::promoteDueLocked()
+{
+  // 调用方持有state_mutex_；到期的重试排在所属作业积压队列的最前面
+  bool promoted = false;
+  auto now = Clock::now();
+  while (!delayed_.empty() && delayed_.top().due <= now)
+  {
+    DelayedTask &top = const_cast<DelayedTask &>(delayed_.top());
+    Task task = std::move(top.task);
+    JobId job = top.job;
+    delayed_.pop();
+
+    backlogLocked(jobs_[job], std::move(task), true);
+    promoted = true;
+  }
+  return admitLocked() || promoted;
+}
+
+bool SegmentScheduler::popLocal(size_t worker_id, QueuedTask &task)
+{
+  WorkerQueue &queue = *queues_[worker_id];
+  std::lock_guard<std::mutex> lock(queue.mutex);
+  if (queue.tasks.empty())
+    return false;
+
+  task = std::move(queue.tasks.front());
+  queue.tasks.pop_front();
+  queued_.fetch_sub(1);
+  return true;
+}
+
+bool SegmentScheduler::steal(size_t worker_id, QueuedTask &task)
+{
+  const size_t count = queues_.size();
+  for (size_t offset = 1; offset < count; ++offset)
+  {
+    WorkerQueue &victim = *queues_[(worker_id + offset) % count];
+    std::lock_guard<std::mutex> lock(victim.mutex);
+    if (victim.tasks.empty())
+      continue;
+
+    // 从队尾窃取，保留队首的低序号片段给队列所有者
+    task = std::move(victim.tasks.back());
+    victim.tasks.pop_back();
+    queued_.fetch_sub(1);
+    return true;
+  }
+  return false;
+}
+
+void SegmentScheduler::setConcurrencyLimit(size_t limit)
+{
+  {
+    std::lock_guard<std::mutex> lock(state_mutex_);
+    limit_ = limit ? limit : 1;
+  }
+  work_cv_.notify_all();
+}
+
+void SegmentScheduler::workerLoop(size_t worker_id)
+{
+  while (true)
+  {
+    {
+      std::unique_lock<std::mutex> lock(state_mutex_);
+      auto ready = [this]
+      { return queued_.load() > 0 && (running_ < limit_ || stopping_); };
+      while (true)
+      {
+        if (promoteDueLocked())
+          work_cv_.notify_all();
+        if (ready())
+          break;
+        if (stopping_)
+          return;
+
+        if (delayed_.empty())
+          work_cv_.wait(lock, [&]
+                        { return stopping_ || ready(); });
+        else
+          work_cv_.wait_until(lock, delayed_.top().due, [&]
+                              { return stopping_ || ready(); });
+      }
+      // 先占用并发名额再取任务，同时运行的任务数不会超过limit_
+      ++running_;
+    }
+
+    QueuedTask task;
+    bool found = popLocal(worker_id, task) || steal(worker_id, task);
+    if (found)
+      task.task(worker_id);
+
+    std::lock_guard<std::mutex> lock(state_mutex_);
+    --running_;
+    if (found)
+    {
+      bool job_idle = --jobs_[task.job].pending == 0;
+      if (--pending_ == 0 || job_idle)
+        idle_cv_.notify_all();
+    }
+    // 空出的位置从积压队列中按公平份额补上
+    admitLocked();
+    if (queued_.load() > 0)
+      work_cv_.notify_one();
+  }
+}
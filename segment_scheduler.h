@@ -0,0 +1,122 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+// Long-lived worker pool that feeds segment tasks continuously.
+//
+// Every worker owns a deque. Admitted tasks are dealt round-robin, the owner
+// pops from the front (lowest segment index first) and an idle worker steals
+// from the back of a peer's deque, so no worker waits on a slow neighbour.
+//
+// Tasks belong to jobs. Each job keeps a FIFO backlog and only about one
+// task per worker is admitted into the deques at a time; the next task is
+// taken from the job with the lowest stride-scheduling pass, so jobs that
+// share the pool get worker time in proportion to their weights.
+class SegmentScheduler
+{
+public:
+  using Task = std::function<void(size_t worker_id)>;
+  using JobId = size_t;
+  static constexpr JobId kDefaultJob = 0;
+
+  explicit SegmentScheduler(size_t worker_count);
+  ~SegmentScheduler();
+
+  SegmentScheduler(const SegmentScheduler &) = delete;
+  SegmentScheduler &operator=(const SegmentScheduler &) = delete;
+
+  // A job of weight 2 is dispatched twice as many tasks as a job of weight 1
+  // while both have work queued.
+  JobId addJob(unsigned weight);
+  // Forgets a job once all its tasks have finished.
+  void removeJob(JobId job);
+
+  void submit(Task task, JobId job = kDefaultJob);
+  // Queues task once delay has elapsed. Nothing occupies a worker meanwhile,
+  // so retries that back off leave the slot free for other segments.
+  void submitAfter(std::chrono::milliseconds delay, Task task, JobId job = kDefaultJob);
+  // Makes job's delayed tasks due now, so a cancelled job does not wait out
+  // retry backoffs before wait(job) returns.
+  void expedite(JobId job);
+  // Blocks until every submitted task has finished running.
+  void wait();
+  // Blocks until every task of job has finished running.
+  void wait(JobId job);
+  size_t workerCount() const { return workers_.size(); }
+  // Caps how many tasks run at once (adaptive concurrency); defaults to the
+  // worker count. Lowering it lets running tasks finish undisturbed.
+  void setConcurrencyLimit(size_t limit);
+
+private:
+  struct QueuedTask
+  {
+    Task task;
+    JobId job;
+  };
+
+  struct WorkerQueue
+  {
+    std::mutex mutex;
+    std::deque<QueuedTask> tasks;
+  };
+
+  using Clock = std::chrono::steady_clock;
+
+  struct DelayedTask
+  {
+    Clock::time_point due;
+    uint64_t sequence;
+    Task task;
+    JobId job;
+    bool operator>(const DelayedTask &other) const
+    {
+      return due != other.due ? due > other.due : sequence > other.sequence;
+    }
+  };
+
+  struct JobState
+  {
+    uint64_t stride;
+    uint64_t pass = 0;
+    std::deque<Task> backlog;
+    size_t pending = 0; // backlog + delayed + queued + running
+  };
+
+  void backlogLocked(JobState &job, Task task, bool front);
+  bool admitLocked();
+  bool promoteDueLocked();
+  bool popLocal(size_t worker_id, QueuedTask &task);
+  bool steal(size_t worker_id, QueuedTask &task);
+  void workerLoop(size_t worker_id);
+
+  std::vector<std::unique_ptr<WorkerQueue>> queues_;
+  std::vector<std::thread> workers_;
+
+  std::mutex state_mutex_;
+  std::condition_variable work_cv_;
+  std::condition_variable idle_cv_;
+  std::atomic<size_t> queued_{0}; // tasks sitting in deques
+  size_t pending_ = 0;            // delayed + queued + running
+  size_t running_ = 0;
+  size_t limit_ = std::numeric_limits<size_t>::max();
+  std::priority_queue<DelayedTask, std::vector<DelayedTask>, std::greater<DelayedTask>> delayed_;
+  uint64_t delayed_sequence_ = 0;
+  size_t next_queue_ = 0;
+  std::map<JobId, JobState> jobs_;
+  JobId next_job_ = kDefaultJob + 1;
+  size_t backlog_ = 0;       // tasks waiting in job backlogs
+  uint64_t virtual_time_ = 0; // pass of the last admitted task
+  bool stopping_ = false;
+};
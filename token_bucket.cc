@@ -0,0 +1,47 @@
+#include "token_bucket.h"
+#include <algorithm>
+
+TokenBucket::TokenBucket(uint64_t bytes_per_second, uint64_t burst_bytes)
+{
+  setRate(bytes_per_second, burst_bytes);
+}
+
+void TokenBucket::setRate(uint64_t bytes_per_second, uint64_t burst_bytes)
+{
+  if (burst_bytes == 0)
+    burst_bytes = bytes_per_second / 5;
+  burst_bytes_.store(burst_bytes, std::memory_order_relaxed);
+  rate_.store(bytes_per_second, std::memory_order_relaxed);
+
+  // 旧速率下积累的欠账不再计算，新限速立即生效
+  tat_ns_.store(nowNs(), std::memory_order_relaxed);
+}
+
+std::chrono::nanoseconds TokenBucket::consume(size_t bytes)
+{
+  const uint64_t rate = rate_.load(std::memory_order_relaxed);
+  if (rate == 0)
+    return std::chrono::nanoseconds(0);
+
+  const int64_t cost = static_cast<int64_t>(static_cast<unsigned __int128>(bytes) * 1000000000 / rate);
+  const int64_t burst = static_cast<int64_t>(
+      static_cast<unsigned __int128>(burst_bytes_.load(std::memory_order_relaxed)) * 1000000000 / rate);
+  const int64_t now = nowNs();
+
+  // 桶空闲时TAT落后于当前时间，最多只能积攒burst大小的额度
+  int64_t tat = tat_ns_.load(std::memory_order_relaxed);
+  int64_t next;
+  do
+  {
+    next = std::max(tat, now - burst) + cost;
+  } while (!tat_ns_.compare_exchange_weak(tat, next, std::memory_order_relaxed));
+
+  return std::chrono::nanoseconds(std::max<int64_t>(0, next - burst - now));
+}
+
+int64_t TokenBucket::nowNs()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
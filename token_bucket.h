@@ -0,0 +1,38 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+// Lock-free token bucket shared by concurrent transfers.
+//
+// Implemented as GCRA: a single atomic "theoretical arrival time" advances
+// by the cost of every chunk consumed, so a write callback pays one CAS per
+// chunk rather than taking a lock. burst_bytes worth of traffic may pass
+// without delay; beyond that callers are told how long to hold off, which
+// smooths the rate to bytes_per_second. A rate of 0 means unlimited.
+class TokenBucket
+{
+public:
+  explicit TokenBucket(uint64_t bytes_per_second = 0, uint64_t burst_bytes = 0);
+
+  TokenBucket(const TokenBucket &) = delete;
+  TokenBucket &operator=(const TokenBucket &) = delete;
+
+  // Safe to call while transfers are running; takes effect immediately.
+  // burst_bytes of 0 picks 200 ms worth of traffic.
+  void setRate(uint64_t bytes_per_second, uint64_t burst_bytes = 0);
+  uint64_t rate() const { return rate_.load(std::memory_order_relaxed); }
+  bool limited() const { return rate() != 0; }
+
+  // Accounts for bytes that were just received and returns how long the
+  // caller should wait before receiving more (zero while within the burst).
+  std::chrono::nanoseconds consume(size_t bytes);
+
+private:
+  static int64_t nowNs();
+
+  std::atomic<uint64_t> rate_{0};
+  std::atomic<uint64_t> burst_bytes_{0};
+  std::atomic<int64_t> tat_ns_{0}; // when the bucket would be full again
+};
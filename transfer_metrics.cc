@@ -0,0 +1,282 @@
+#include "transfer_metrics.h"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+namespace
+{
+  // 秒：覆盖局域网内的毫秒级到慢速链路上的一分钟
+  const std::vector<double> kSecondBounds = {0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1,
+                                             0.25, 0.5, 1, 2.5, 5, 10, 30, 60};
+  const std::vector<double> kByteBounds = {16 << 10, 64 << 10, 256 << 10, 1 << 20, 4 << 20, 16 << 20, 64 << 20};
+  const std::vector<double> kRetryBounds = {0, 1, 2, 3, 5, 10};
+
+  const CURLINFO kPhaseInfo[TransferMetrics::kPhaseCount] = {
+      CURLINFO_NAMELOOKUP_TIME_T, CURLINFO_CONNECT_TIME_T, CURLINFO_APPCONNECT_TIME_T,
+      CURLINFO_STARTTRANSFER_TIME_T, CURLINFO_TOTAL_TIME_T};
+
+  std::string formatBound(double bound)
+  {
+    std::ostringstream out;
+    out << bound;
+    return out.str();
+  }
+}
+
+Histogram::Histogram(std::vector<double> bounds)
+    : bounds_(std::move(bounds)),
+      buckets_(new std::atomic<uint64_t>[bounds_.size() + 1])
+{
+  for (size_t i = 0; i <= bounds_.size(); ++i)
+    buckets_[i].store(0);
+}
+
+void Histogram::record(double value)
+{
+  size_t bucket = std::lower_bound(bounds_.begin(), bounds_.end(), value) - bounds_.begin();
+  buckets_[bucket].fetch_add(1, std::memory_order_relaxed);
+  count_.fetch_add(1, std::memory_order_relaxed);
+
+  // C++17没有atomic<double>::fetch_add，用CAS循环累加
+  double sum = sum_.load(std::memory_order_relaxed);
+  while (!sum_.compare_exchange_weak(sum, sum + value, std::memory_order_relaxed))
+    ;
+}
+
+double Histogram::quantile(double q) const
+{
+  const uint64_t total = count();
+  if (total == 0)
+    return 0;
+
+  const double rank = q * total;
+  uint64_t seen = 0;
+  for (size_t i = 0; i <= bounds_.size(); ++i)
+  {
+    uint64_t in_bucket = buckets_[i].load(std::memory_order_relaxed);
+    if (in_bucket > 0 && seen + in_bucket >= rank)
+    {
+      // +Inf桶没有上界，只能报告最后一个有限边界
+      if (i == bounds_.size())
+        return bounds_.back();
+      double lower = i == 0 ? 0 : bounds_[i - 1];
+      return lower + (bounds_[i] - lower) * (rank - seen) / in_bucket;
+    }
+    seen += in_bucket;
+  }
+  return bounds_.back();
+}
+
+nlohmann::json Histogram::toJson() const
+{
+  nlohmann::json buckets = nlohmann::json::array();
+  for (size_t i = 0; i <= bounds_.size(); ++i)
+  {
+    buckets.push_back({{"le", i < bounds_.size() ? nlohmann::json(bounds_[i]) : nlohmann::json("+Inf")},
+                       {"count", buckets_[i].load(std::memory_order_relaxed)}});
+  }
+  return {{"count", count()},
+          {"sum", sum()},
+          {"p50", quantile(0.5)},
+          {"p90", quantile(0.9)},
+          {"p99", quantile(0.99)},
+          {"buckets", buckets}};
+}
+
+void Histogram::writePrometheus(std::ostream &out, const std::string &name, const std::string &labels) const
+{
+  const std::string prefix = labels.empty() ? "" : labels + ",";
+  uint64_t cumulative = 0;
+  for (size_t i = 0; i <= bounds_.size(); ++i)
+  {
+    cumulative += buckets_[i].load(std::memory_order_relaxed);
+    out << name << "_bucket{" << prefix << "le=\"" << (i < bounds_.size() ? formatBound(bounds_[i]) : "+Inf")
+        << "\"} " << cumulative << "\n";
+  }
+  const std::string braces = labels.empty() ? "" : "{" + labels + "}";
+  out << name << "_sum" << braces << " " << sum() << "\n";
+  out << name << "_count" << braces << " " << count() << "\n";
+}
+
+TransferMetrics::TransferMetrics()
+    : phases_{Histogram(kSecondBounds), Histogram(kSecondBounds), Histogram(kSecondBounds),
+              Histogram(kSecondBounds), Histogram(kSecondBounds)},
+      bytes_(kByteBounds),
+      retries_(kRetryBounds)
+{
+}
+
+const char *TransferMetrics::phaseName(Phase phase)
+{
+  switch (phase)
+  {
+  case kNameLookup:
+    return "namelookup";
+  case kConnect:
+    return "connect";
+  case kAppConnect:
+    return "appconnect";
+  case kStartTransfer:
+    return "starttransfer";
+  case kTotal:
+    return "total";
+  default:
+    return "unknown";
+  }
+}
+
+void TransferMetrics::record(CURL *easy, int retry, bool ok)
+{
+  long connects = 0;
+  curl_easy_getinfo(easy, CURLINFO_NUM_CONNECTS, &connects);
+
+  for (int phase = 0; phase < kPhaseCount; ++phase)
+  {
+    // 复用的连接上DNS、TCP和TLS耗时都是0，计入会把分布压低
+    if (connects == 0 && phase <= kAppConnect)
+      continue;
+    curl_off_t us = 0;
+    curl_easy_getinfo(easy, kPhaseInfo[phase], &us);
+    // 明文HTTP没有TLS握手，appconnect为0
+    if (phase == kAppConnect && us == 0)
+      continue;
+    phases_[phase].record(us / 1e6);
+  }
+
+  curl_off_t bytes = 0;
+  curl_easy_getinfo(easy, CURLINFO_SIZE_DOWNLOAD_T, &bytes);
+  bytes_.record(static_cast<double>(bytes));
+  bytes_total_.fetch_add(static_cast<uint64_t>(bytes), std::memory_order_relaxed);
+  retries_.record(retry);
+  (ok ? ok_ : failed_).fetch_add(1, std::memory_order_relaxed);
+
+  // 多路复用时只有第一个传输建立连接，其余传输的NUM_CONNECTS为0
+  connections_.fetch_add(static_cast<uint64_t>(connects), std::memory_order_relaxed);
+  long version = 0;
+  curl_easy_getinfo(easy, CURLINFO_HTTP_VERSION, &version);
+  if (version == CURL_HTTP_VERSION_2_0)
+    http2_.fetch_add(1, std::memory_order_relaxed);
+}
+
+nlohmann::json TransferMetrics::toJson() const
+{
+  nlohmann::json phases;
+  for (int phase = 0; phase < kPhaseCount; ++phase)
+    phases[phaseName(static_cast<Phase>(phase))] = phases_[phase].toJson();
+
+  return {{"transfers", {{"ok", ok_.load()}, {"failed", failed_.load()}}},
+          {"bytes_total", bytes_total_.load()},
+          {"connections_opened", connections_.load()},
+          {"http2_transfers", http2_.load()},
+          {"hedges", {{"fired", hedges_fired_.load()}, {"won", hedges_won_.load()}}},
+          {"phase_seconds", phases},
+          {"bytes", bytes_.toJson()},
+          {"retry", retries_.toJson()}};
+}
+
+std::string TransferMetrics::toPrometheus() const
+{
+  std::ostringstream out;
+  out << "# HELP video_downloader_transfers_total Finished segment and chunk transfers.\n"
+      << "# TYPE video_downloader_transfers_total counter\n"
+      << "video_downloader_transfers_total{result=\"ok\"} " << ok_.load() << "\n"
+      << "video_downloader_transfers_total{result=\"failed\"} " << failed_.load() << "\n"
+      << "# HELP video_downloader_received_bytes_total Bytes received by all transfers.\n"
+      << "# TYPE video_downloader_received_bytes_total counter\n"
+      << "video_downloader_received_bytes_total " << bytes_total_.load() << "\n"
+      << "# HELP video_downloader_connections_opened_total Connections opened by transfers (reused ones are not counted).\n"
+      << "# TYPE video_downloader_connections_opened_total counter\n"
+      << "video_downloader_connections_opened_total " << connections_.load() << "\n"
+      << "# HELP video_downloader_http2_transfers_total Transfers that ran as HTTP/2 streams.\n"
+      << "# TYPE video_downloader_http2_transfers_total counter\n"
+      << "video_downloader_http2_transfers_total " << http2_.load() << "\n"
+      << "# HELP video_downloader_hedges_fired_total Duplicate requests sent for straggler segments.\n"
+      << "# TYPE video_downloader_hedges_fired_total counter\n"
+      << "video_downloader_hedges_fired_total " << hedges_fired_.load() << "\n"
+      << "# HELP video_downloader_hedges_won_total Duplicate requests that finished before the original.\n"
+      << "# TYPE video_downloader_hedges_won_total counter\n"
+      << "video_downloader_hedges_won_total " << hedges_won_.load() << "\n";
+
+  out << "# HELP video_downloader_transfer_phase_seconds curl timings, cumulative from the start of the transfer.\n"
+      << "# TYPE video_downloader_transfer_phase_seconds histogram\n";
+  for (int phase = 0; phase < kPhaseCount; ++phase)
+    phases_[phase].writePrometheus(out, "video_downloader_transfer_phase_seconds",
+                                   std::string("phase=\"") + phaseName(static_cast<Phase>(phase)) + "\"");
+
+  out << "# HELP video_downloader_transfer_bytes Bytes received per transfer.\n"
+      << "# TYPE video_downloader_transfer_bytes histogram\n";
+  bytes_.writePrometheus(out, "video_downloader_transfer_bytes", "");
+  out << "# HELP video_downloader_transfer_retry Retry number of each attempt, 0 for the first try.\n"
+      << "# TYPE video_downloader_transfer_retry histogram\n";
+  retries_.writePrometheus(out, "video_downloader_transfer_retry", "");
+  return out.str();
+}
+
+std::string TransferMetrics::summary() const
+{
+  std::ostringstream out;
+  out << std::fixed << std::setprecision(1) << "Transfer timings p50/p90 (ms):";
+  for (int phase = 0; phase < kPhaseCount; ++phase)
+  {
+    const Histogram &histogram = phases_[phase];
+    if (histogram.count() == 0)
+      continue;
+    out << " " << phaseName(static_cast<Phase>(phase)) << " " << histogram.quantile(0.5) * 1000 << "/"
+        << histogram.quantile(0.9) * 1000;
+  }
+  out << " (" << transfers() << " transfers, " << failed_.load() << " failed)";
+  return out.str();
+}
+
+MetricsExporter::MetricsExporter(const TransferMetrics &metrics, std::string path, std::chrono::seconds interval)
+    : metrics_(metrics),
+      path_(std::move(path)),
+      interval_(interval.count() > 0 ? interval : std::chrono::seconds(1)),
+      thread_(&MetricsExporter::run, this)
+{
+}
+
+MetricsExporter::~MetricsExporter()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  cv_.notify_all();
+  thread_.join();
+  // 退出前写入最终结果
+  writeNow();
+}
+
+bool MetricsExporter::writeNow()
+{
+  return writeFileAtomically(path_, metrics_.toPrometheus());
+}
+
+void MetricsExporter::run()
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!cv_.wait_for(lock, interval_, [this]
+                       { return stopping_; }))
+  {
+    lock.unlock();
+    if (!writeNow())
+      std::cerr << "Failed to write metrics to " << path_ << std::endl;
+    lock.lock();
+  }
+}
+
+bool writeFileAtomically(const std::string &path, const std::string &content)
+{
+  const std::string temp_path = path + ".temp";
+  {
+    std::ofstream out(temp_path, std::ios::trunc);
+    out << content;
+    if (!out.flush())
+      return false;
+  }
+  return std::rename(temp_path.c_str(), path.c_str()) == 0;
+}
@@ -0,0 +1,128 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <curl/curl.h>
+#include <nlohmann/json.hpp>
+
+// Fixed-bucket histogram that can be recorded from any thread without
+// locking. Bucket i counts values <= bounds[i]; the last bucket is +Inf.
+class Histogram
+{
+public:
+  explicit Histogram(std::vector<double> bounds);
+
+  Histogram(const Histogram &) = delete;
+  Histogram &operator=(const Histogram &) = delete;
+
+  void record(double value);
+
+  uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+  double sum() const { return sum_.load(std::memory_order_relaxed); }
+  // Estimated by interpolating inside the bucket holding the q-th value.
+  double quantile(double q) const;
+
+  nlohmann::json toJson() const;
+  // Writes the _bucket/_sum/_count series of one Prometheus histogram.
+  // labels is either empty or a list like phase="connect".
+  void writePrometheus(std::ostream &out, const std::string &name, const std::string &labels) const;
+
+private:
+  const std::vector<double> bounds_;
+  std::unique_ptr<std::atomic<uint64_t>[]> buckets_;
+  std::atomic<uint64_t> count_{0};
+  std::atomic<double> sum_{0};
+};
+
+// Timing, size and retry statistics of every finished curl transfer.
+//
+// The phase timings are the cumulative CURLINFO_*_TIME_T values curl
+// reports (each measured from the start of the transfer). namelookup,
+// connect and appconnect are only recorded for transfers that opened a new
+// connection, since a reused connection reports them as zero.
+class TransferMetrics
+{
+public:
+  enum Phase
+  {
+    kNameLookup,
+    kConnect,
+    kAppConnect,
+    kStartTransfer,
+    kTotal,
+    kPhaseCount
+  };
+
+  TransferMetrics();
+
+  TransferMetrics(const TransferMetrics &) = delete;
+  TransferMetrics &operator=(const TransferMetrics &) = delete;
+
+  // Thread-safe. Call before the easy handle is reset or reused.
+  void record(CURL *easy, int retry, bool ok);
+
+  // Duplicate requests for straggler segments (see HedgePolicy).
+  void recordHedgeFired() { hedges_fired_.fetch_add(1, std::memory_order_relaxed); }
+  void recordHedgeWon() { hedges_won_.fetch_add(1, std::memory_order_relaxed); }
+
+  uint64_t transfers() const { return ok_.load() + failed_.load(); }
+  uint64_t connectionsOpened() const { return connections_.load(); }
+  uint64_t http2Transfers() const { return http2_.load(); }
+  nlohmann::json toJson() const;
+  std::string toPrometheus() const;
+  // p50/p90 of every phase in milliseconds, for the log.
+  std::string summary() const;
+
+  static const char *phaseName(Phase phase);
+
+private:
+  Histogram phases_[kPhaseCount];
+  Histogram bytes_;
+  Histogram retries_; // retry number of each attempt, 0 for the first try
+  std::atomic<uint64_t> ok_{0};
+  std::atomic<uint64_t> failed_{0};
+  std::atomic<uint64_t> bytes_total_{0};
+  std::atomic<uint64_t> connections_{0}; // new connections, summed CURLINFO_NUM_CONNECTS
+  std::atomic<uint64_t> http2_{0};       // transfers that negotiated HTTP/2
+  std::atomic<uint64_t> hedges_fired_{0};
+  std::atomic<uint64_t> hedges_won_{0};
+};
+
+// Rewrites a Prometheus text file (for node_exporter's textfile collector
+// or any scraper reading files) every interval until destroyed. Each
+// snapshot is written to a temporary file and renamed into place so
+// readers never see a partial file.
+class MetricsExporter
+{
+public:
+  MetricsExporter(const TransferMetrics &metrics, std::string path, std::chrono::seconds interval);
+  ~MetricsExporter();
+
+  MetricsExporter(const MetricsExporter &) = delete;
+  MetricsExporter &operator=(const MetricsExporter &) = delete;
+
+  bool writeNow();
+
+private:
+  void run();
+
+  const TransferMetrics &metrics_;
+  const std::string path_;
+  const std::chrono::seconds interval_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool stopping_ = false;
+  std::thread thread_;
+};
+
+// Writes content to path through a temporary file and rename().
+bool writeFileAtomically(const std::string &path, const std::string &content);
@@ -0,0 +1,194 @@
+#include "variant_selector.h"
+#include "m3u8_parser.h"
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+
+namespace
+{
+  std::string trim(const std::string &line)
+  {
+    size_t start = line.find_first_not_of(" \t\r\n");
+    if (start == std::string::npos)
+      return "";
+    return line.substr(start, line.find_last_not_of(" \t\r\n") - start + 1);
+  }
+}
+
+std::string resolveUri(const std::string &base, const std::string &uri)
+{
+  return SegmentUrlResolver(base).resolve(uri);
+}
+
+bool isMasterPlaylist(std::string_view content)
+{
+  return content.find("#EXT-X-STREAM-INF") != std::string_view::npos;
+}
+
+bool parseMasterPlaylist(const std::string &content, const std::string &base_url,
+                         std::vector<StreamVariant> &variants)
+{
+  std::istringstream stream(content);
+  std::string line;
+  bool pending = false;
+  StreamVariant variant;
+
+  while (std::getline(stream, line))
+  {
+    line = trim(line);
+    if (line.empty())
+      continue;
+
+    if (line.rfind("#EXT-X-STREAM-INF:", 0) == 0)
+    {
+      std::string attributes = line.substr(18);
+      variant = StreamVariant();
+      variant.bandwidth = std::strtoull(std::string(playlistAttribute(attributes, "BANDWIDTH")).c_str(), nullptr, 10);
+      variant.codecs = playlistAttribute(attributes, "CODECS");
+      std::string resolution(playlistAttribute(attributes, "RESOLUTION"));
+      size_t x = resolution.find('x');
+      if (x != std::string::npos)
+      {
+        variant.width = std::atoi(resolution.c_str());
+        variant.height = std::atoi(resolution.c_str() + x + 1);
+      }
+      pending = true;
+      continue;
+    }
+    if (line[0] == '#')
+      continue;
+
+    // EXT-X-STREAM-INF的下一行URI即该码率的媒体播放列表
+    if (pending)
+    {
+      variant.uri = resolveUri(base_url, line);
+      variants.push_back(variant);
+      pending = false;
+    }
+  }
+  return !variants.empty();
+}
+
+std::string describeVariant(const StreamVariant &variant)
+{
+  std::ostringstream out;
+  out << variant.bandwidth / 1000 << " kbps";
+  if (variant.height > 0)
+    out << ", " << variant.width << "x" << variant.height;
+  if (!variant.codecs.empty())
+    out << ", " << variant.codecs;
+  out << " (" << variant.uri << ")";
+  return out.str();
+}
+
+VariantSelector::VariantSelector(const VariantConfig &config, std::vector<StreamVariant> variants)
+    : config_(config),
+      variants_(std::move(variants))
+{
+  std::stable_sort(variants_.begin(), variants_.end(), [](const StreamVariant &a, const StreamVariant &b)
+                   { return a.bandwidth > b.bandwidth; });
+
+  // 超出上限的码率不参与选择；全部超出时只保留最低的一个
+  auto over_cap = [this](const StreamVariant &v)
+  {
+    return (config_.max_bandwidth > 0 && v.bandwidth > config_.max_bandwidth) ||
+           (config_.max_height > 0 && v.height > config_.max_height);
+  };
+  auto kept = std::stable_partition(variants_.begin(), variants_.end(),
+                                    [&](const StreamVariant &v)
+                                    { return !over_cap(v); });
+  if (kept == variants_.begin())
+    variants_.erase(variants_.begin(), variants_.end() - 1);
+  else
+    variants_.erase(kept, variants_.end());
+
+  current_ = config_.policy == "lowest" ? variants_.size() - 1 : 0;
+  job_start_ = Clock::now();
+}
+
+void VariantSelector::begin(size_t segment_count)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  variant_start_ = Clock::now();
+  segment_count_ = segment_count;
+  completed_ = 0;
+  bytes_ = 0;
+  switch_requested_.store(false);
+}
+
+bool VariantSelector::recordSegment(uint64_t bytes)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (switch_requested_.load())
+    return true;
+
+  ++completed_;
+  bytes_ += bytes;
+  if (completed_ < static_cast<size_t>(std::max(1, config_.probe_segments)) || completed_ >= segment_count_)
+    return false;
+
+  const auto now = Clock::now();
+  const double elapsed = std::chrono::duration<double>(now - variant_start_).count();
+  if (elapsed <= 0)
+    return false;
+
+  size_t target = current_;
+  const char *reason = nullptr;
+  if (config_.deadline_seconds > 0)
+  {
+    // 按已完成片段的平均耗时推算本码率的总耗时
+    const double projected = elapsed * segment_count_ / completed_;
+    const double left = config_.deadline_seconds - std::chrono::duration<double>(now - job_start_).count() + elapsed;
+    if (projected > left)
+    {
+      target = pickByDeadline(projected, left - elapsed);
+      reason = "cannot finish before the deadline";
+    }
+  }
+  else if (config_.policy == "throughput" && !probed_)
+  {
+    probed_ = true;
+    target = pickByThroughput(bytes_ * 8 / elapsed);
+    reason = "measured throughput";
+  }
+
+  if (target == current_)
+    return false;
+
+  std::cout << "Switching variant (" << reason << ", " << bytes_ * 8 / elapsed / 1000 << " kbps measured): "
+            << describeVariant(variants_[current_]) << " -> " << describeVariant(variants_[target]) << std::endl;
+  target_ = target;
+  switch_requested_.store(true);
+  return true;
+}
+
+void VariantSelector::applySwitch()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (switch_requested_.load())
+    current_ = target_;
+  switch_requested_.store(false);
+}
+
+size_t VariantSelector::pickByThroughput(double bits_per_second) const
+{
+  // 能以实时速度下载的最高码率；都不行时取最低
+  for (size_t i = 0; i < variants_.size(); ++i)
+  {
+    if (variants_[i].bandwidth <= bits_per_second)
+      return i;
+  }
+  return variants_.size() - 1;
+}
+
+size_t VariantSelector::pickByDeadline(double projected_seconds, double seconds_left) const
+{
+  // 换码率需要重新下载：按码率比例估算耗时，取剩余时间内能完成的最高码率
+  const double current_bandwidth = static_cast<double>(std::max<uint64_t>(1, variants_[current_].bandwidth));
+  for (size_t i = current_ + 1; i < variants_.size(); ++i)
+  {
+    if (projected_seconds * variants_[i].bandwidth / current_bandwidth <= seconds_left)
+      return i;
+  }
+  return variants_.size() - 1;
+}
@@ -0,0 +1,84 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+struct StreamVariant
+{
+  std::string uri; // resolved media playlist URL
+  uint64_t bandwidth = 0;
+  int width = 0;
+  int height = 0;
+  std::string codecs;
+};
+
+struct VariantConfig
+{
+  std::string policy = "highest"; // "highest", "lowest" or "throughput"
+  uint64_t max_bandwidth = 0;     // bits/s, 0 = no cap
+  int max_height = 0;             // 0 = no cap
+  int deadline_seconds = 0;       // switch down when the job cannot finish in time
+  int probe_segments = 3;         // segments measured before judging throughput
+};
+
+// Resolves uri against the playlist URL it appeared in (or a base directory
+// ending in '/').
+std::string resolveUri(const std::string &base, const std::string &uri);
+
+bool isMasterPlaylist(std::string_view content);
+// Parses the EXT-X-STREAM-INF entries (BANDWIDTH, RESOLUTION, CODECS) of a
+// master playlist.
+bool parseMasterPlaylist(const std::string &content, const std::string &base_url,
+                         std::vector<StreamVariant> &variants);
+std::string describeVariant(const StreamVariant &variant);
+
+// Picks the variant to download and watches whether it can be sustained.
+//
+// "highest"/"lowest" pick by BANDWIDTH within the caps. "throughput" starts
+// at the highest variant and, after probe_segments segments, moves to the
+// highest one the measured aggregate throughput can download in real time.
+// With a deadline the projected finish time is re-checked after every
+// segment, and a lower variant whose projected time fits is requested when
+// the current one would overrun.
+class VariantSelector
+{
+public:
+  VariantSelector(const VariantConfig &config, std::vector<StreamVariant> variants);
+
+  const StreamVariant &current() const { return variants_[current_]; }
+  const std::vector<StreamVariant> &variants() const { return variants_; }
+
+  // Starts measuring a download of segment_count segments of current().
+  void begin(size_t segment_count);
+  // Thread-safe. Returns true once the download should be abandoned in
+  // favour of switchTarget().
+  bool recordSegment(uint64_t bytes);
+  bool switchRequested() const { return switch_requested_.load(); }
+  // Makes the requested variant current.
+  void applySwitch();
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  size_t pickByThroughput(double bits_per_second) const;
+  size_t pickByDeadline(double projected_seconds, double seconds_left) const;
+
+  const VariantConfig config_;
+  std::vector<StreamVariant> variants_; // sorted by bandwidth, highest first
+  size_t current_ = 0;
+
+  std::mutex mutex_;
+  Clock::time_point job_start_;
+  Clock::time_point variant_start_;
+  size_t segment_count_ = 0;
+  size_t completed_ = 0;
+  uint64_t bytes_ = 0;
+  bool probed_ = false;
+  size_t target_ = 0;
+  std::atomic<bool> switch_requested_{false};
+};
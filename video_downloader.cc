@@ -1,21 +1,53 @@
 #include "video_downloader.h"
+#include "curl_multi_engine.h"
+#include "curl_handle_pool.h"
+#include "segment_decryptor.h"
+#include "ordered_output.h"
+#include "file_copy.h"
+#include "range_plan.h"
+#include "checksum.h"
 #include <fstream>
 #include <iostream>
+#include <iomanip>
+#include <sstream>
 #include <thread>
 #include <filesystem>
 #include <regex>
 #include <mutex>
-#include <openssl/evp.h>
+#include <atomic>
+#include <functional>
+#include <algorithm>
+#include <map>
+#include <limits>
+#include <deque>
+#include <cstring>
+#include <cerrno>
+#include <strings.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// 片段临时文件的stdio缓冲和校验片段时的读缓冲大小
+constexpr size_t kSegmentIoBufferSize = 1 << 20;
 
 VideoDownloader::VideoDownloader()
 {
-  curl_global_init(CURL_GLOBAL_ALL);
   curl_ = std::shared_ptr<CURL>(curl_easy_init(), curl_easy_cleanup);
+  share_ = std::make_shared<CurlShare>();
+  metrics_ = std::make_shared<TransferMetrics>();
+  logger_ = std::make_shared<Logger>();
+  // 熔断状态变化发生在传输完成的线程上，经异步日志输出；共用worker时logger_会被替换，每次调用时再取
+  breaker_.setLogCallback([this](Logger::Level level, std::string message)
+                          { logger_->log(level, std::move(message)); });
 }
 
 VideoDownloader::~VideoDownloader()
 {
-  curl_global_cleanup();
+  // 先停止工作线程，curl全局资源由最后析构的curl_global_释放；共用的调度器只注销本作业
+  if (scheduler_ && job_id_ != SegmentScheduler::kDefaultJob)
+    scheduler_->removeJob(job_id_);
+  scheduler_.reset();
+  handle_pool_.reset();
+  share_.reset();
 }
 
 bool VideoDownloader::loadConfig(const std::string &config_path)
@@ -27,31 +59,201 @@ bool VideoDownloader::loadConfig(const std::string &config_path)
     f >> j;
 
     config_.download_path = j["download_path"];
+    config_.log_path = j.value("log_path", "");
+    config_.log_level = j.value("log_level", "info");
     config_.thread_count = j["thread_count"];
     config_.timeout_seconds = j["timeout_seconds"];
     config_.retry_count = j["retry_count"];
     config_.user_agent = j["user_agent"];
+    config_.engine = j.value("engine", "threads");
+    config_.max_transfers = j.value("max_transfers", 64);
+    config_.output_mode = j.value("output_mode", "merge");
+    config_.reorder_buffer_mb = j.value("reorder_buffer_mb", 256);
+    if (j.contains("buffer_pool"))
+      config_.buffer_pool.max_mb = j["buffer_pool"].value("max_mb", config_.buffer_pool.max_mb);
+    config_.stream_window = j.value("stream_window", 0);
+    config_.direct_chunks = j.value("direct_chunks", config_.thread_count);
+    config_.verify_checksums = j.value("verify_checksums", false);
+
+    // 重试退避与熔断设置，均为可选项
+    if (j.contains("retry"))
+    {
+      const auto &retry = j["retry"];
+      config_.retry.base_delay_ms = retry.value("base_delay_ms", config_.retry.base_delay_ms);
+      config_.retry.max_delay_ms = retry.value("max_delay_ms", config_.retry.max_delay_ms);
+      config_.retry.jitter = retry.value("jitter", config_.retry.jitter);
+      config_.retry.breaker_threshold = retry.value("breaker_threshold", config_.retry.breaker_threshold);
+      config_.retry.breaker_cooldown_ms = retry.value("breaker_cooldown_ms", config_.retry.breaker_cooldown_ms);
+    }
+
+    // 自适应并发：按实测吞吐、延迟和错误率调整同时下载的片段数
+    if (j.contains("concurrency"))
+    {
+      const auto &concurrency = j["concurrency"];
+      config_.concurrency.adaptive = concurrency.value("adaptive", config_.concurrency.adaptive);
+      config_.concurrency.min = concurrency.value("min", config_.concurrency.min);
+      config_.concurrency.max = concurrency.value("max", config_.concurrency.max);
+      config_.concurrency.initial = concurrency.value("initial", config_.concurrency.initial);
+      config_.concurrency.window_ms = concurrency.value("window_ms", config_.concurrency.window_ms);
+    }
+
+    // 对冲请求：片段耗时超过近期分位数时在新连接上重复请求，先完成者胜出
+    if (j.contains("hedge"))
+    {
+      const auto &hedge = j["hedge"];
+      config_.hedge.enabled = hedge.value("enabled", config_.hedge.enabled);
+      config_.hedge.percentile = hedge.value("percentile", config_.hedge.percentile);
+      config_.hedge.min_samples = hedge.value("min_samples", config_.hedge.min_samples);
+      config_.hedge.min_delay_ms = hedge.value("min_delay_ms", config_.hedge.min_delay_ms);
+      config_.hedge.max_ratio = hedge.value("max_ratio", config_.hedge.max_ratio);
+    }
+
+    // 带宽限制，单位KB/s
+    if (j.contains("bandwidth"))
+    {
+      const auto &bandwidth = j["bandwidth"];
+      config_.bandwidth.global_kbps = bandwidth.value("global_kbps", config_.bandwidth.global_kbps);
+      config_.bandwidth.job_kbps = bandwidth.value("job_kbps", config_.bandwidth.job_kbps);
+      config_.bandwidth.burst_kb = bandwidth.value("burst_kb", config_.bandwidth.burst_kb);
+      config_.bandwidth.reload_on_sighup = bandwidth.value("reload_on_sighup", config_.bandwidth.reload_on_sighup);
+    }
+
+    // 主播放列表的码率选择
+    if (j.contains("variant"))
+    {
+      const auto &variant = j["variant"];
+      config_.variant.policy = variant.value("policy", config_.variant.policy);
+      config_.variant.max_bandwidth = variant.value("max_bandwidth", config_.variant.max_bandwidth);
+      config_.variant.max_height = variant.value("max_height", config_.variant.max_height);
+      config_.variant.deadline_seconds = variant.value("deadline_seconds", config_.variant.deadline_seconds);
+      config_.variant.probe_segments = variant.value("probe_segments", config_.variant.probe_segments);
+    }
+
+    if (j.contains("live"))
+    {
+      const auto &live = j["live"];
+      config_.live.stall_timeout_seconds = live.value("stall_timeout_seconds", config_.live.stall_timeout_seconds);
+      config_.live.blocking_reload = live.value("blocking_reload", config_.live.blocking_reload);
+    }
+
+    if (j.contains("http2"))
+    {
+      const auto &http2 = j["http2"];
+      config_.http2.enabled = http2.value("enabled", config_.http2.enabled);
+      config_.http2.max_streams = http2.value("max_streams", config_.http2.max_streams);
+    }
+
+    if (j.contains("decrypt"))
+      config_.decrypt.threads = j["decrypt"].value("threads", config_.decrypt.threads);
+
+    // 每次传输的耗时直方图，任务结束时输出JSON，下载过程中定期刷新Prometheus文本文件
+    if (j.contains("metrics"))
+    {
+      const auto &metrics = j["metrics"];
+      config_.metrics.json_path = metrics.value("json_path", config_.metrics.json_path);
+      config_.metrics.prometheus_path = metrics.value("prometheus_path", config_.metrics.prometheus_path);
+      config_.metrics.interval_seconds = metrics.value("interval_seconds", config_.metrics.interval_seconds);
+    }
+
+    if (j.contains("job_queue"))
+      config_.job_queue.max_active_jobs = j["job_queue"].value("max_active_jobs", config_.job_queue.max_active_jobs);
 
     // Load proxy settings
     config_.proxy.enabled = j["proxy"]["enabled"];
     config_.proxy.type = j["proxy"]["type"];
     config_.proxy.host = j["proxy"]["host"];
     config_.proxy.port = j["proxy"]["port"];
+    // 多个代理出口：片段请求按实测吞吐分摊到各出口，enabled为false的一项表示直连
+    if (j.contains("proxies"))
+    {
+      config_.proxies.clear();
+      for (const auto &entry : j["proxies"])
+      {
+        ProxyConfig proxy;
+        proxy.enabled = entry.value("enabled", true);
+        proxy.type = entry.value("type", proxy.type);
+        proxy.host = entry.value("host", proxy.host);
+        proxy.port = entry.value("port", proxy.port);
+        config_.proxies.push_back(proxy);
+      }
+    }
 
     // Load video settings
     config_.url = j["video"]["url"];
     config_.baseurl = j["video"]["baseurl"];
     config_.key_baseurl = j["video"]["key_baseurl"];
+    if (j["video"].contains("mirrors"))
+      config_.mirrors = j["video"]["mirrors"].get<std::vector<std::string>>();
     config_.output_name = j["video"]["output_name"];
-
-    std::filesystem::create_directories(config_.download_path);
-    return true;
   }
   catch (const std::exception &e)
   {
     std::cerr << "Failed to load config: " << e.what() << std::endl;
     return false;
   }
+  return applyConfig();
+}
+
+bool VideoDownloader::setConfig(const Config &config)
+{
+  config_ = config;
+  return applyConfig();
+}
+
+bool VideoDownloader::applyConfig()
+{
+  setBandwidthLimit(config_.bandwidth.global_kbps, config_.bandwidth.job_kbps);
+  bufferPool().setLimit(static_cast<size_t>(std::max(0, config_.buffer_pool.max_mb)) << 20);
+
+  // 每个片段的下载、重试信息写入日志文件，控制台只保留进度行
+  Logger::Level level;
+  if (!Logger::parseLevel(config_.log_level, level))
+  {
+    std::cerr << "Unknown log_level: " << config_.log_level << std::endl;
+    return false;
+  }
+  logger_->setLevel(level);
+  if (!config_.log_path.empty() && !logger_->open(config_.log_path))
+    std::cerr << "Failed to open log file " << config_.log_path << ", logging to stderr" << std::endl;
+
+  return setDownloadPath(config_.download_path);
+}
+
+void VideoDownloader::cancel()
+{
+  stop_requested_.store(true);
+  job_cancelled_.store(true);
+  resume();
+
+  // 退避中的重试立即到期，worker取到后发现已取消直接返回，不必等满退避时间
+  std::lock_guard<std::mutex> lock(pause_mutex_);
+  if (scheduler_)
+    scheduler_->expedite(job_id_);
+}
+
+void VideoDownloader::pause()
+{
+  paused_.store(true);
+}
+
+void VideoDownloader::resume()
+{
+  {
+    std::lock_guard<std::mutex> lock(pause_mutex_);
+    paused_.store(false);
+  }
+  pause_cv_.notify_all();
+}
+
+bool VideoDownloader::waitWhilePaused()
+{
+  if (paused_.load())
+  {
+    std::unique_lock<std::mutex> lock(pause_mutex_);
+    pause_cv_.wait(lock, [this]
+                   { return !paused_.load() || stop_requested_.load(); });
+  }
+  return !stop_requested_.load();
 }
 
 void VideoDownloader::setupCurlSSL(CURL *curl)
@@ -66,9 +268,10 @@ void VideoDownloader::setupCurlSSL(CURL *curl)
   // 使用系统默认的SSL版本，而不是强制TLS版本
   curl_easy_setopt(curl, CURLOPT_SSLVERSION, CURL_SSLVERSION_DEFAULT);
 
-  // 禁用其他SSL相关选项
-  curl_easy_setopt(curl, CURLOPT_SSL_ENABLE_ALPN, 0L);
-  curl_easy_setopt(curl, CURLOPT_SSL_SESSIONID_CACHE, 0L);
+  // 只有开启http2时才通过ALPN协商h2，服务器不接受时这个主机继续使用HTTP/1.1；
+  // TLS会话缓存保持开启，通过share在片段之间复用
+  curl_easy_setopt(curl, CURLOPT_SSL_ENABLE_ALPN, config_.http2.enabled ? 1L : 0L);
+  curl_easy_setopt(curl, CURLOPT_SSL_SESSIONID_CACHE, 1L);
 
   // 设置SSL选项为最大兼容模式
   curl_easy_setopt(curl, CURLOPT_SSL_OPTIONS,
@@ -94,6 +297,11 @@ void VideoDownloader::setupCurlCommonOpts(CURL *curl, char *error_buffer)
   curl_easy_setopt(curl, CURLOPT_FAILONERROR, 0L);
   curl_easy_setopt(curl, CURLOPT_TCP_FASTOPEN, 1L);
 
+  // HTTP/2: 明文http仍走HTTP/1.1；PIPEWAIT让新请求等待已有连接确认能否多路复用，而不是另开连接
+  curl_easy_setopt(curl, CURLOPT_HTTP_VERSION,
+                   config_.http2.enabled ? static_cast<long>(CURL_HTTP_VERSION_2TLS) : static_cast<long>(CURL_HTTP_VERSION_1_1));
+  curl_easy_setopt(curl, CURLOPT_PIPEWAIT, config_.http2.enabled ? 1L : 0L);
+
   // 缓冲区设置
   curl_easy_setopt(curl, CURLOPT_BUFFERSIZE, 102400L);
   curl_easy_setopt(curl, CURLOPT_TCP_NODELAY, 1L);
@@ -103,20 +311,31 @@ void VideoDownloader::setupCurlCommonOpts(CURL *curl, char *error_buffer)
   curl_easy_setopt(curl, CURLOPT_TCP_KEEPIDLE, 120L);
   curl_easy_setopt(curl, CURLOPT_TCP_KEEPINTVL, 60L);
 
+  // 共享DNS缓存、TLS会话和连接池；缓存上限需覆盖全部并发连接，否则会互相挤掉
+  if (share_ && share_->handle())
+    curl_easy_setopt(curl, CURLOPT_SHARE, share_->handle());
+  curl_easy_setopt(curl, CURLOPT_MAXCONNECTS,
+                   static_cast<long>(std::max<size_t>(workerCount(), config_.max_transfers)));
+
   // 设置代理先于SSL
-  setupCurlProxy(curl);
+  setupCurlProxy(curl, defaultProxy());
   setupCurlSSL(curl);
 }
 
-void VideoDownloader::setupCurlProxy(CURL *curl)
+void VideoDownloader::setupCurlProxy(CURL *curl, const ProxyConfig &proxy)
 {
-  if (!config_.proxy.enabled)
+  // handle会在不同代理出口之间复用，直连时清除上一次设置的代理
+  if (!proxy.enabled)
+  {
+    curl_easy_setopt(curl, CURLOPT_PROXY, nullptr);
+    curl_easy_setopt(curl, CURLOPT_HTTPPROXYTUNNEL, 0L);
     return;
+  }
 
-  std::string proxy_url = config_.proxy.host + ":" + std::to_string(config_.proxy.port);
+  std::string proxy_url = proxy.host + ":" + std::to_string(proxy.port);
   curl_easy_setopt(curl, CURLOPT_PROXY, proxy_url.c_str());
   curl_easy_setopt(curl, CURLOPT_PROXYTYPE,
-                   (config_.proxy.type == "http") ? CURLPROXY_HTTP : CURLPROXY_SOCKS5);
+                   (proxy.type == "http") ? CURLPROXY_HTTP : CURLPROXY_SOCKS5);
 
   // 禁用所有代理SSL验证
   curl_easy_setopt(curl, CURLOPT_PROXY_SSL_VERIFYPEER, 0L);
@@ -127,18 +346,20 @@ void VideoDownloader::setupCurlProxy(CURL *curl)
   curl_easy_setopt(curl, CURLOPT_HTTPPROXYTUNNEL, 1L);
   curl_easy_setopt(curl, CURLOPT_SUPPRESS_CONNECT_HEADERS, 0L);
 
-  std::cout << "Using proxy: " << proxy_url << " (Type: " << config_.proxy.type << ")" << std::endl;
+  logger_->line(Logger::kDebug) << "Using proxy: " << proxy_url << " (Type: " << proxy.type << ")";
 }
 
 size_t VideoDownloader::WriteCallback(void *contents, size_t size, size_t nmemb, void *userp)
 {
-  ((std::string *)userp)->append((char *)contents, size * nmemb);
+  // 播放列表和密钥很小，不受缓冲池上限约束，直播刷新不会排在片段后面等待
+  if (!static_cast<PooledBuffer *>(userp)->append(static_cast<const uint8_t *>(contents), size * nmemb, true))
+    return 0;
   return size * nmemb;
 }
 
 bool VideoDownloader::downloadKey(const std::string &key_url, std::vector<uint8_t> &key_data)
 {
-  std::string key_content;
+  PooledBuffer key_content(&bufferPool());
   char error_buffer[CURL_ERROR_SIZE] = {0};
 
   CURL *curl = curl_easy_init();
@@ -156,537 +377,1807 @@ bool VideoDownloader::downloadKey(const std::string &key_url, std::vector<uint8_
 
   if (res != CURLE_OK && res != CURLE_SSL_CONNECT_ERROR)
   {
-    std::cerr << "Failed to download key: " << curl_easy_strerror(res) << std::endl;
+    logger_->line(Logger::kError) << "Failed to download key: " << curl_easy_strerror(res);
     return false;
   }
 
-  key_data.assign(key_content.begin(), key_content.end());
+  key_data.clear();
+  key_content.forEach([&key_data](const uint8_t *data, size_t len)
+                      {
+                        key_data.insert(key_data.end(), data, data + len);
+                        return true; });
   return true;
 }
 
-bool VideoDownloader::decryptSegment(const std::string &input_file, const std::string &output_file,
-                                     const std::vector<uint8_t> &key_data)
+bool VideoDownloader::parseM3U8(std::string_view content, std::vector<std::string> &segments,
+                                const std::string &playlist_url)
 {
-  std::ifstream in(input_file, std::ios::binary);
-  std::ofstream out(output_file, std::ios::binary);
-
-  if (!in || !out)
-    return false;
+  // 新的播放列表重新下载密钥
+  keys_.clear();
+  segment_ciphers_.clear();
 
-  // Initialize OpenSSL
-  EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
-  if (!ctx)
+  M3U8Playlist playlist;
+  if (!parseMediaPlaylist(content, playlist))
     return false;
 
-  // Initialize decryption
-  if (!EVP_DecryptInit_ex(ctx, EVP_aes_128_cbc(), nullptr,
-                          key_data.data(), nullptr))
+  // 每个片段按自己的EXT-X-KEY解密，播放列表中途换密钥也能正确处理；
+  // 没有加密片段时segment_ciphers_保持为空
+  std::vector<std::shared_ptr<const SegmentCipher>> ciphers;
+  if (!playlist.keys.empty())
   {
-    EVP_CIPHER_CTX_free(ctx);
-    return false;
-  }
-
-  std::vector<unsigned char> inbuf(1024), outbuf(1024 + EVP_MAX_BLOCK_LENGTH);
-  int outlen;
-
-  // Read and decrypt
-  while (in.good())
-  {
-    in.read(reinterpret_cast<char *>(inbuf.data()), inbuf.size());
-    std::streamsize bytes_read = in.gcount();
-
-    if (bytes_read > 0)
+    ciphers.resize(segments.size());
+    ciphers.reserve(segments.size() + playlist.segments.size());
+    for (const auto &segment : playlist.segments)
     {
-      if (!EVP_DecryptUpdate(ctx, outbuf.data(), &outlen,
-                             inbuf.data(), bytes_read))
-      {
-        EVP_CIPHER_CTX_free(ctx);
+      std::shared_ptr<const SegmentCipher> cipher;
+      if (!segmentCipher(segment.key >= 0 ? &playlist.keys[segment.key] : nullptr, segment.sequence, cipher))
         return false;
-      }
-      out.write(reinterpret_cast<char *>(outbuf.data()), outlen);
+      ciphers.push_back(std::move(cipher));
     }
   }
 
-  // Finalize decryption
-  if (EVP_DecryptFinal_ex(ctx, outbuf.data(), &outlen))
-    out.write(reinterpret_cast<char *>(outbuf.data()), outlen);
+  // 片段URL在这里才拼接，playlist_url非空时相对URI按该地址解析，否则沿用baseurl配置
+  SegmentUrlResolver resolver(playlist_url, config_.baseurl);
+  segments.reserve(segments.size() + playlist.segments.size());
+  for (const auto &segment : playlist.segments)
+    segments.push_back(resolver.resolve(segment.uri));
 
-  EVP_CIPHER_CTX_free(ctx);
-  return true;
+  segment_ciphers_ = std::move(ciphers);
+  return !segments.empty();
 }
 
-bool VideoDownloader::parseM3U8(const std::string &content, std::vector<std::string> &segments)
+bool VideoDownloader::segmentCipher(const PlaylistKey *key, int64_t sequence,
+                                    std::shared_ptr<const SegmentCipher> &cipher)
 {
-  std::istringstream stream(content);
-  std::string line;
-  bool isValidM3U8 = false;
-
-  // Reset encryption info
-  encryption_ = EncryptionInfo();
+  cipher.reset();
+  if (!key)
+    return true;
 
-  if (std::getline(stream, line))
+  // Handle relative key URI
+  std::string key_uri(key->uri);
+  if (!key_uri.empty() && key_uri[0] == '/' && !config_.key_baseurl.empty())
   {
-    if (line.find("#EXTM3U") == std::string::npos)
-      return false;
-    isValidM3U8 = true;
+    // Remove trailing slash from key_baseurl if present
+    std::string base = config_.key_baseurl;
+    if (base.back() == '/')
+      base.pop_back();
+    key_uri = base + key_uri;
   }
 
-  while (std::getline(stream, line))
+  auto it = keys_.find(key_uri);
+  if (it == keys_.end())
   {
-    line.erase(0, line.find_first_not_of(" \t\r\n"));
-    line.erase(line.find_last_not_of(" \t\r\n") + 1);
+    logger_->line(Logger::kInfo) << "Using key URL: " << key_uri;
 
-    if (line.empty())
-      continue;
-
-    if (line[0] == '#')
+    // Download key
+    std::vector<uint8_t> key_data;
+    if (!downloadKey(key_uri, key_data) || key_data.size() < 16)
     {
-      // Handle encryption key
-      if (line.find("#EXT-X-KEY:") != std::string::npos)
-      {
-        encryption_.enabled = true;
+      logger_->line(Logger::kError) << "Failed to download decryption key: " << key_uri;
+      return false;
+    }
+    it = keys_.emplace(key_uri, std::move(key_data)).first;
+  }
+
+  auto result = std::make_shared<SegmentCipher>();
+  std::memcpy(result->key, it->second.data(), sizeof(result->key));
+  if (!segmentIv(*key, sequence, result->iv))
+  {
+    logger_->line(Logger::kError) << "Invalid IV in EXT-X-KEY: " << key->iv;
+    return false;
+  }
+  cipher = std::move(result);
+  return true;
+}
 
-        // Parse encryption method
-        size_t method_start = line.find("METHOD=") + 7;
-        size_t method_end = line.find(",", method_start);
-        encryption_.method = line.substr(method_start, method_end - method_start);
+TokenBucket &VideoDownloader::globalBandwidth()
+{
+  // 全局限速在进程内所有下载器之间共享
+  static TokenBucket bucket;
+  return bucket;
+}
 
-        // Parse key URI
-        size_t uri_start = line.find("URI=\"") + 5;
-        size_t uri_end = line.find("\"", uri_start);
-        std::string key_uri = line.substr(uri_start, uri_end - uri_start);
+BufferPool &VideoDownloader::bufferPool()
+{
+  // 内存上限同样在进程内所有下载器之间共享
+  static BufferPool pool;
+  return pool;
+}
 
-        // Handle relative key URI
-        if (key_uri[0] == '/' && !config_.key_baseurl.empty())
-        {
-          // Remove trailing slash from key_baseurl if present
-          std::string base = config_.key_baseurl;
-          if (!base.empty() && base.back() == '/' && key_uri[0] == '/')
-          {
-            base.pop_back();
-          }
-          encryption_.key_uri = base + key_uri;
-        }
-        else
-        {
-          encryption_.key_uri = key_uri;
-        }
+size_t VideoDownloader::reorderBufferBytes() const
+{
+  size_t bytes = static_cast<size_t>(std::max(0, config_.reorder_buffer_mb)) << 20;
+  if (const size_t pool_limit = bufferPool().limit())
+    bytes = std::min(bytes, pool_limit / 2);
+  return bytes;
+}
 
-        std::cout << "Using key URL: " << encryption_.key_uri << std::endl;
+void VideoDownloader::setBandwidthLimit(int global_kbps, int job_kbps)
+{
+  config_.bandwidth.global_kbps = std::max(0, global_kbps);
+  config_.bandwidth.job_kbps = std::max(0, job_kbps);
+  const uint64_t burst = static_cast<uint64_t>(std::max(0, config_.bandwidth.burst_kb)) * 1024;
+  globalBandwidth().setRate(static_cast<uint64_t>(config_.bandwidth.global_kbps) * 1024, burst);
+  job_bandwidth_.setRate(static_cast<uint64_t>(config_.bandwidth.job_kbps) * 1024, burst);
+}
 
-        // Download key
-        if (!downloadKey(encryption_.key_uri, encryption_.key_data))
-        {
-          std::cerr << "Failed to download decryption key" << std::endl;
-          return false;
-        }
-      }
-      continue;
-    }
+bool VideoDownloader::reloadBandwidthLimit(const std::string &config_path)
+{
+  try
+  {
+    std::ifstream f(config_path);
+    nlohmann::json j;
+    f >> j;
 
-    // Handle segment URL (same as before)
-    if (line.find("://") != std::string::npos)
-      segments.push_back(line);
-    else if (!config_.baseurl.empty())
-    {
-      if (!config_.baseurl.empty() && config_.baseurl.back() == '/' && !line.empty() && line[0] == '/')
-        line = line.substr(1);
-      segments.push_back(config_.baseurl + line);
-    }
-    else
-      segments.push_back(line);
+    const auto &bandwidth = j.value("bandwidth", nlohmann::json::object());
+    config_.bandwidth.burst_kb = bandwidth.value("burst_kb", 0);
+    setBandwidthLimit(bandwidth.value("global_kbps", 0), bandwidth.value("job_kbps", 0));
+    // 作业队列中的下载器由队列统一输出一行
+    if (!quiet_)
+      std::cout << "Bandwidth limit: global " << config_.bandwidth.global_kbps << " KB/s, job "
+                << config_.bandwidth.job_kbps << " KB/s (0 = unlimited)" << std::endl;
+    return true;
+  }
+  catch (const std::exception &e)
+  {
+    std::cerr << "Failed to reload bandwidth limit: " << e.what() << std::endl;
+    return false;
   }
-
-  return isValidM3U8 && !segments.empty();
 }
 
-bool VideoDownloader::downloadSegment(const std::string &url, const std::string &output_path)
+std::chrono::nanoseconds VideoDownloader::throttleDelay(TokenBucket *job_bandwidth, size_t len)
 {
-  for (int retry = 0; retry < config_.retry_count; ++retry)
-  {
-    CURL *curl = curl_easy_init();
-    if (!curl)
-      continue;
+  auto delay = globalBandwidth().consume(len);
+  if (job_bandwidth)
+    delay = std::max(delay, job_bandwidth->consume(len));
+  return delay;
+}
 
-    std::string temp_path = output_path + ".temp";
-    FILE *fp = fopen(temp_path.c_str(), "wb");
-    if (!fp)
-    {
-      curl_easy_cleanup(curl);
-      continue;
-    }
+bool VideoDownloader::writeSegmentData(SegmentAttempt &attempt, const uint8_t *data, size_t len)
+{
+  // 加密片段先原样保存密文，校验和由解密阶段按明文计算
+  if (!attempt.cipher)
+    attempt.checksum.update(data, len);
+  attempt.written += len;
+  // 空间已在写回调开头预留
+  if (attempt.to_memory)
+    return attempt.body.append(data, len, true);
+  return fwrite(data, 1, len, attempt.fp) == len;
+}
 
-    char error_buffer[CURL_ERROR_SIZE] = {0};
-    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, fwrite);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, fp);
-    setupCurlCommonOpts(curl, error_buffer);
+size_t VideoDownloader::SegmentWriteCallback(void *contents, size_t size, size_t nmemb, void *userp)
+{
+  auto *attempt = static_cast<SegmentAttempt *>(userp);
+  const size_t len = size * nmemb;
+  const auto *data = static_cast<const uint8_t *>(contents);
 
-    CURLcode res = curl_easy_perform(curl);
-    long response_code;
-    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response_code);
+  if (attempt->cancelled && attempt->cancelled->load())
+    return 0;
 
-    fclose(fp);
-    curl_easy_cleanup(curl);
+  // multi模式下限速等待期间暂停接收，恢复后curl会重新投递这批数据
+  if (attempt->pause && attempt->resume_at > std::chrono::steady_clock::now())
+  {
+    attempt->pause(attempt->resume_at);
+    return CURL_WRITEFUNC_PAUSE;
+  }
 
-    if ((res == CURLE_OK || res == CURLE_SSL_CONNECT_ERROR) && response_code == 200)
+  // 内存中的片段先从缓冲池预留空间，池用尽时停止接收：
+  // multi模式暂停传输，线程模式在回调中等待。输出正在等待的片段可以超出上限，
+  // 否则缓冲池被后面的片段占满时谁也无法完成；合并模式的加密片段没有输出顺序，
+  // 解密阶段空闲、不会再有缓冲块归还时可以超出上限
+  if (attempt->to_memory && !attempt->body.reserve(len))
+  {
+    while (!attempt->body.reserve(len, attempt->output ? attempt->index <= attempt->output->committedIndex()
+                                                       : attempt->decrypt_backlog->load() == 0))
     {
-      if (encryption_.enabled)
-      {
-        if (!decryptSegment(temp_path, output_path, encryption_.key_data))
-        {
-          std::cerr << "Failed to decrypt segment: " << url << std::endl;
-          std::filesystem::remove(temp_path);
-          continue;
-        }
-        std::filesystem::remove(temp_path);
-      }
-      else
+      if (attempt->pause)
       {
-        std::filesystem::rename(temp_path, output_path);
+        attempt->resume_at = std::chrono::steady_clock::now() + kBufferPoll;
+        attempt->pause(attempt->resume_at);
+        return CURL_WRITEFUNC_PAUSE;
       }
-      return true;
+      if ((attempt->cancelled && attempt->cancelled->load()) || (attempt->race && attempt->race->won.load()))
+        return 0;
+      std::this_thread::sleep_for(kBufferPoll);
     }
+  }
+  attempt->received += len;
+  if (!writeSegmentData(*attempt, data, len))
+    return 0;
 
-    std::cerr << "Failed to download segment: " << url
-              << " (Attempt " << (retry + 1) << "/" << config_.retry_count << ")" << std::endl;
-    std::cerr << "Error: " << curl_easy_strerror(res) << std::endl;
-    std::cerr << "Detailed error: " << error_buffer << std::endl;
-    std::cerr << "HTTP response code: " << response_code << std::endl;
+  // 令牌不足时线程模式直接在回调中等待，multi模式则记下恢复时间，下次回调时暂停
+  auto delay = throttleDelay(attempt->job_bandwidth, len);
+  if (delay >= std::chrono::milliseconds(1))
+  {
+    if (attempt->pause)
+      attempt->resume_at = std::chrono::steady_clock::now() + delay;
+    else
+      std::this_thread::sleep_for(delay);
+  }
+  return len;
+}
 
-    std::filesystem::remove(temp_path);
+size_t VideoDownloader::SegmentHeaderCallback(char *buffer, size_t size, size_t nitems, void *userp)
+{
+  auto *attempt = static_cast<SegmentAttempt *>(userp);
+  const size_t len = size * nitems;
 
-    if (retry < config_.retry_count - 1)
-    {
-      std::cout << "Retrying in 3 second..." << std::endl;
-      std::this_thread::sleep_for(std::chrono::seconds(3));
-    }
+  if (len > 5 && strncasecmp(buffer, "etag:", 5) == 0)
+  {
+    std::string value(buffer + 5, len - 5);
+    value.erase(0, value.find_first_not_of(" \t"));
+    value.erase(value.find_last_not_of(" \t\r\n") + 1);
+    attempt->etag = value;
   }
-  return false;
+  else if (len > 12 && strncasecmp(buffer, "retry-after:", 12) == 0)
+  {
+    // 只处理秒数形式，HTTP日期形式按普通退避处理
+    long seconds = strtol(buffer + 12, nullptr, 10);
+    if (seconds > 0)
+      attempt->retry_after = std::chrono::seconds(seconds);
+  }
+  return len;
 }
 
-bool VideoDownloader::mergeSegments(const std::vector<std::string> &segments, const std::string &output_file)
+bool VideoDownloader::prepareSegmentAttempt(CURL *curl, SegmentAttempt &attempt)
 {
-  std::ofstream out(output_file, std::ios::binary);
-  if (!out)
-    return false;
-
-  for (const auto &segment : segments)
+  // 流式输出模式下片段先留在内存中，由重排序缓冲区按序写入最终文件；
+  // 加密片段的密文也留在内存中，解密后只写一次明文
+  attempt.to_memory = ordered_output_ != nullptr || attempt.cipher;
+  attempt.output = ordered_output_.get();
+  attempt.decrypt_backlog = &decrypt_backlog_;
+  attempt.body = PooledBuffer(&bufferPool());
+  attempt.checksum = Xxh64();
+  attempt.received = 0;
+  attempt.written = 0;
+  attempt.etag.clear();
+  attempt.failure = FailureKind::kRetryable;
+  attempt.retry_after = std::chrono::milliseconds(0);
+  attempt.job_bandwidth = &job_bandwidth_;
+  attempt.cancelled = &job_cancelled_;
+  attempt.lost = false;
+  attempt.resume_at = {};
+  if (!attempt.to_memory)
   {
-    std::ifstream in(segment, std::ios::binary);
-    if (!in)
+    // 对冲请求与原请求同时写入，各用各的临时文件
+    attempt.temp_path = attempt.output_path + (attempt.hedge ? ".hedge.temp" : ".temp");
+    attempt.fp = fopen(attempt.temp_path.c_str(), "wb");
+    if (!attempt.fp)
       return false;
-    out << in.rdbuf();
-    in.close();
-    std::filesystem::remove(segment);
+    setvbuf(attempt.fp, nullptr, _IOFBF, kSegmentIoBufferSize);
+  }
+
+  // 按选定的路径换成对应的镜像地址
+  if (paths_ && attempt.path >= 0)
+    attempt.url = paths_->rewrite(attempt.url, attempt.path);
+
+  attempt.error_buffer[0] = '\0';
+  curl_easy_setopt(curl, CURLOPT_URL, attempt.url.c_str());
+  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, SegmentWriteCallback);
+  curl_easy_setopt(curl, CURLOPT_WRITEDATA, &attempt);
+  curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, SegmentHeaderCallback);
+  curl_easy_setopt(curl, CURLOPT_HEADERDATA, &attempt);
+  setupCurlCommonOpts(curl, attempt.error_buffer);
+  if (paths_ && attempt.path >= 0)
+  {
+    const size_t proxy = paths_->proxyOf(attempt.path);
+    setupCurlProxy(curl, config_.proxies.empty() ? config_.proxy : config_.proxies[proxy]);
   }
-  out.close();
+  // 进度回调在连接停滞、写回调不再触发时也会定期调用，用来中止输掉竞争的传输
+  curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, SegmentProgressCallback);
+  curl_easy_setopt(curl, CURLOPT_XFERINFODATA, &attempt);
+  curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+  // 慢片段往往是某个CDN节点或TCP连接出了问题，对冲请求不复用连接
+  if (attempt.hedge)
+    curl_easy_setopt(curl, CURLOPT_FRESH_CONNECT, 1L);
   return true;
 }
 
-bool VideoDownloader::isSegmentComplete(const std::string &filepath) const
+int VideoDownloader::SegmentProgressCallback(void *userp, curl_off_t, curl_off_t, curl_off_t, curl_off_t)
 {
-  if (!std::filesystem::exists(filepath))
-  {
-    return false;
-  }
-  // 检查文件大小是否大于0
-  return std::filesystem::file_size(filepath) > 0;
+  auto *attempt = static_cast<SegmentAttempt *>(userp);
+  if (attempt->cancelled && attempt->cancelled->load())
+    return 1;
+  return attempt->race && attempt->race->won.load() ? 1 : 0;
 }
 
-bool VideoDownloader::downloadM3U8(const std::string &url, const std::string &output_name)
+bool VideoDownloader::completeSegmentAttempt(CURL *curl, SegmentAttempt &attempt, CURLcode res)
 {
-  std::string m3u8_content;
-  char error_buffer[CURL_ERROR_SIZE] = {0};
+  // 有多个镜像时熔断按镜像和代理出口分别计算；不说明主机状况的结束方式也要释放探测名额，
+  // 否则熔断器一直等待探测结果，该主机再也不会被派发
+  const std::string host = breakerKey(attempt.url, attempt.path);
 
-  // Download M3U8 file
-  CURL *curl = curl_easy_init();
-  if (!curl)
+  // 任务已取消（例如切换码率）时中断的传输只做清理
+  if (res != CURLE_OK && jobCancelled())
   {
-    std::cerr << "Failed to initialize CURL" << std::endl;
+    breaker_.releaseProbe(host);
+    abandonSegmentAttempt(attempt);
+    return false;
+  }
+  // 同一片段的另一个请求已经胜出，被中止的传输不计为失败
+  if (res != CURLE_OK && attempt.race && attempt.race->won.load())
+  {
+    breaker_.releaseProbe(host);
+    attempt.lost = true;
+    abandonSegmentAttempt(attempt);
     return false;
   }
 
-  curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
-  curl_easy_setopt(curl, CURLOPT_WRITEDATA, &m3u8_content);
-
-  setupCurlCommonOpts(curl, error_buffer);
-
-  // Perform request
-  CURLcode res = curl_easy_perform(curl);
-
-  // Get response code
-  long response_code;
+  long response_code = 0;
   curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response_code);
+  handle_pool_->recordTransfer(curl);
 
-  curl_easy_cleanup(curl);
+  bool ok = (res == CURLE_OK || res == CURLE_SSL_CONNECT_ERROR) && response_code == 200;
 
-  if (res != CURLE_OK && res != CURLE_SSL_CONNECT_ERROR)
+  // 实际收到的字节数必须与Content-Length一致，否则视为不完整片段重新下载
+  curl_off_t content_length = -1;
+  curl_easy_getinfo(curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &content_length);
+  if (ok && content_length >= 0 && attempt.received != static_cast<uint64_t>(content_length))
   {
-    std::cerr << "Failed to download M3U8 file: " << curl_easy_strerror(res) << std::endl;
-    std::cerr << "Detailed error: " << error_buffer << std::endl;
-    std::cerr << "URL: " << url << std::endl;
-    return false;
+    logger_->line(Logger::kWarn) << "Truncated segment: " << attempt.url << " (" << attempt.received << "/"
+                                 << content_length << " bytes)";
+    ok = false;
   }
 
-  if (response_code != 200)
+  // 对冲时只有第一个完成的请求写入输出，其余的丢弃已收到的数据
+  if (ok && attempt.race && attempt.race->won.exchange(true))
   {
-    std::cerr << "Server returned HTTP code: " << response_code << std::endl;
-    std::cerr << "Response content: " << m3u8_content << std::endl;
+    breaker_.releaseProbe(host);
+    attempt.lost = true;
+    abandonSegmentAttempt(attempt);
     return false;
   }
 
-  std::cout << "M3U8 content received: " << m3u8_content.substr(0, 100) << "..." << std::endl;
+  if (attempt.fp)
+    fclose(attempt.fp);
+  attempt.fp = nullptr;
 
-  // Parse M3U8
-  std::vector<std::string> segments;
-  if (!parseM3U8(m3u8_content, segments))
+  metrics_->record(curl, attempt.retry, ok);
+  if (ok && hedge_)
   {
-    std::cerr << "Failed to parse M3U8 file" << std::endl;
-    return false;
+    curl_off_t total_time = 0;
+    curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME_T, &total_time);
+    hedge_->recordLatency(std::chrono::microseconds(total_time));
+    if (attempt.hedge)
+    {
+      hedge_->recordWin();
+      metrics_->recordHedgeWon();
+    }
   }
 
-  // Prepare download tasks
-  std::vector<DownloadTask> tasks;
-  size_t segment_index = 0;
-  std::vector<std::string> segment_files;
+  if (limiter_)
+  {
+    curl_off_t total_time = 0;
+    curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME_T, &total_time);
+    limiter_->record(attempt.received, std::chrono::microseconds(total_time), ok,
+                     response_code == 429 || response_code == 503);
+  }
 
-  for (const auto &segment_url : segments)
+  if (paths_ && attempt.path >= 0)
   {
-    std::string segment_path = config_.download_path + "segment_" +
-                               std::to_string(segment_index) + ".ts";
-    segment_files.push_back(segment_path);
+    curl_off_t total_time = 0;
+    curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME_T, &total_time);
+    paths_->record(attempt.path, attempt.received, std::chrono::microseconds(total_time), ok);
+  }
 
-    // 只有当片段未下载或下载不完整时才添加到任务列表
-    if (!isSegmentComplete(segment_path))
+  // 只有可重试的失败才计入主机健康状况，404之类是单个资源的问题：
+  // 主机能正常应答，熔断探测同样以成功结束
+  if (ok)
+    breaker_.recordSuccess(host);
+  else
+  {
+    attempt.failure = classifyFailure(res, response_code);
+    if (attempt.failure == FailureKind::kRetryable)
+      breaker_.recordFailure(host);
+    else
     {
-      tasks.push_back({segment_url, segment_path, segment_index});
+      if (response_code > 0)
+        breaker_.recordSuccess(host);
+      else
+        breaker_.releaseProbe(host);
+      // 某个镜像缺少文件时换一个镜像重试
+      if (attempt.path >= 0 && paths_->mirrorCount() > 1 && response_code >= 400)
+        attempt.failure = FailureKind::kRetryable;
     }
-    else
+  }
+
+  if (ok)
+    bytes_received_.fetch_add(attempt.received);
+
+  // 码率监测：按实测吞吐或截止时间判断是否需要换成更低的码率，需要时取消本次下载
+  if (ok && variant_selector_ && variant_selector_->recordSegment(attempt.received))
+    job_cancelled_.store(true);
+
+  // 加密片段在解密线程上完成剩下的步骤，传输线程（或事件循环）直接去接收下一个片段
+  if (ok && attempt.cipher)
+  {
+    submitDecrypt(attempt, static_cast<int64_t>(content_length));
+    return true;
+  }
+  if (ok && attempt.to_memory)
+  {
+    if (!ordered_output_->deliver(attempt.index, std::move(attempt.body)))
+    {
+      // 输出写不进去（磁盘满、管道读端已关闭）时重新下载也没有用
+      logger_->line(Logger::kError) << "Failed to write segment " << attempt.index + 1 << " to output";
+      attempt.failure = FailureKind::kFatal;
+      return false;
+    }
+    return true;
+  }
+  if (ok)
+  {
+    // 临时文件已是明文，重命名不会再复制数据；改名完成后才写入日志
+    std::filesystem::rename(attempt.temp_path, attempt.output_path);
+    if (journal_)
     {
-      std::cout << "Segment " << segment_index + 1 << " already downloaded, skipping..." << std::endl;
+      journal_->markComplete(attempt.index, {attempt.written, static_cast<int64_t>(content_length),
+                                             attempt.etag.empty() ? 0 : Xxh64::hash(attempt.etag.data(), attempt.etag.size()),
+                                             attempt.checksum.digest()});
     }
-    segment_index++;
+    return true;
   }
 
-  // Download segments in parallel
-  if (!processDownloadTasks(tasks))
+  logger_->line(Logger::kWarn) << "Failed to download segment: " << attempt.url
+                               << " (Attempt " << (attempt.retry + 1) << "/" << config_.retry_count
+                               << "): " << curl_easy_strerror(res) << ", detail: " << attempt.error_buffer
+                               << ", HTTP " << response_code
+                               << (attempt.failure == FailureKind::kFatal ? ", not retryable" : "");
+
+  if (!attempt.to_memory)
+    std::filesystem::remove(attempt.temp_path);
+  attempt.body.clear();
+  return false;
+}
+
+void VideoDownloader::abandonSegmentAttempt(SegmentAttempt &attempt)
+{
+  if (attempt.fp)
   {
-    std::cerr << "Failed to download segments" << std::endl;
-    return false;
+    fclose(attempt.fp);
+    std::filesystem::remove(attempt.temp_path);
   }
+  attempt.fp = nullptr;
+  attempt.body.clear();
+}
 
-  // Merge segments
-  std::string output_path = config_.download_path + output_name + ".ts";
-  if (!mergeSegments(segment_files, output_path))
+void VideoDownloader::submitDecrypt(SegmentAttempt &attempt, int64_t content_length)
+{
   {
-    std::cerr << "Failed to merge segments" << std::endl;
-    return false;
+    std::lock_guard<std::mutex> lock(decrypt_mutex_);
+    if (!decrypt_stage_)
+      decrypt_stage_ = std::make_unique<DecryptStage>(static_cast<size_t>(std::max(0, config_.decrypt.threads)));
   }
 
-  return true;
+  // 任务要能复制才能放进std::function，缓冲区由shared_ptr持有
+  auto body = std::make_shared<PooledBuffer>(std::move(attempt.body));
+  decrypt_backlog_.fetch_add(1);
+  decrypt_stage_->submit(
+      [this, body, cipher = attempt.cipher, index = attempt.index, to_output = attempt.output != nullptr,
+       output_path = attempt.output_path, etag = attempt.etag, content_length]
+      {
+        bool ok = to_output ? decryptToOutput(index, *cipher, *body)
+                            : decryptToFile(index, *cipher, *body, output_path, content_length, etag);
+        body->clear();
+        decrypt_backlog_.fetch_sub(1);
+        if (!ok)
+          decrypt_failed_.store(true);
+      });
 }
-bool VideoDownloader::loadM3U8FromFile(const std::string &file_path, const std::string &output_name)
+
+bool VideoDownloader::decryptBody(size_t index, const SegmentCipher &cipher, PooledBuffer &body)
 {
-  // 读取M3U8文件内容
-  std::ifstream file(file_path);
-  if (!file.is_open())
+  const size_t size = body.size();
+  auto ranges = body.ranges();
+  if (!decrypt_stage_->decrypt(cipher, ranges))
   {
-    std::cerr << "Failed to open M3U8 file: " << file_path << std::endl;
+    logger_->line(Logger::kError) << "Failed to decrypt segment " << index + 1;
     return false;
   }
 
-  std::string m3u8_content((std::istreambuf_iterator<char>(file)),
-                           std::istreambuf_iterator<char>());
-  file.close();
+  // 去掉PKCS#7填充；缓冲块大小是分组长度的整数倍，最后一个完整分组不会跨块。
+  // 与之前的实现一致，填充无效时丢弃最后一块，不完整的尾部也丢弃
+  const size_t aligned = size - size % kAesBlockSize;
+  size_t plain = 0;
+  size_t offset = 0;
+  for (const auto &range : ranges)
+  {
+    if (aligned >= kAesBlockSize && aligned - kAesBlockSize >= offset && aligned <= offset + range.second)
+      plain = aligned - kAesBlockSize + unpaddedLength(range.first + (aligned - kAesBlockSize - offset), kAesBlockSize);
+    offset += range.second;
+  }
+  body.truncate(plain);
+  decrypted_segments_.fetch_add(1);
+  decrypted_bytes_.fetch_add(size);
+  return true;
+}
 
-  // 解析M3U8内容
-  std::vector<std::string> segments;
-  if (!parseM3U8(m3u8_content, segments))
+bool VideoDownloader::decryptToOutput(size_t index, const SegmentCipher &cipher, PooledBuffer &body)
+{
+  if (!decryptBody(index, cipher, body))
+    return false;
+  if (!ordered_output_->deliver(index, std::move(body)))
   {
-    std::cerr << "Failed to parse M3U8 content from file" << std::endl;
+    // 输出写不进去（磁盘满、管道读端已关闭）时重新下载也没有用
+    logger_->line(Logger::kError) << "Failed to write segment " << index + 1 << " to output";
     return false;
   }
-
-  // 准备下载任务
+  return true;
+}
+
+bool VideoDownloader::decryptToFile(size_t index, const SegmentCipher &cipher, PooledBuffer &body,
+                                    const std::string &output_path, int64_t content_length, const std::string &etag)
+{
+  // 密文在缓冲块中原地解密，明文只写一次：写入临时文件后改名，与明文片段相同
+  if (!decryptBody(index, cipher, body))
+    return false;
+
+  const std::string temp_path = output_path + ".temp";
+  int fd = ::open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0)
+  {
+    logger_->line(Logger::kError) << "Failed to create segment file: " << temp_path;
+    return false;
+  }
+  Xxh64 checksum;
+  bool ok = body.forEach([&](const uint8_t *data, size_t len)
+                         {
+                           checksum.update(data, len);
+                           size_t written = 0;
+                           while (written < len)
+                           {
+                             ssize_t n = ::write(fd, data + written, len - written);
+                             if (n <= 0)
+                               return false;
+                             written += static_cast<size_t>(n);
+                           }
+                           return true;
+                         });
+  ok = ::close(fd) == 0 && ok;
+  std::error_code ec;
+  if (ok)
+    std::filesystem::rename(temp_path, output_path, ec);
+  if (!ok || ec)
+  {
+    logger_->line(Logger::kError) << "Failed to write segment " << index + 1 << ": " << temp_path;
+    std::filesystem::remove(temp_path, ec);
+    return false;
+  }
+
+  // 改名完成后才写入日志
+  if (journal_)
+  {
+    journal_->markComplete(index, {body.size(), content_length,
+                                   etag.empty() ? 0 : Xxh64::hash(etag.data(), etag.size()), checksum.digest()});
+  }
+  return true;
+}
+
+bool VideoDownloader::drainDecrypt()
+{
+  std::lock_guard<std::mutex> lock(decrypt_mutex_);
+  if (decrypt_stage_)
+    decrypt_stage_->wait();
+  return !decrypt_failed_.exchange(false);
+}
+
+std::chrono::milliseconds VideoDownloader::retryDelay(const SegmentAttempt &attempt) const
+{
+  // 服务器给出Retry-After时不早于该时间重试
+  return std::max(backoffDelay(config_.retry, attempt.retry), attempt.retry_after);
+}
+
+bool VideoDownloader::downloadSegment(const DownloadTask &task, size_t worker_id, SegmentAttempt &attempt)
+{
+  // 只做一次尝试；重试由调用方按退避时间重新提交，不占用worker
+  attempt.url = task.url;
+  attempt.output_path = task.output_path;
+  attempt.index = task.index;
+  attempt.cipher = task.cipher;
+
+  CURL *curl = handle_pool_->acquire(worker_id);
+  if (!curl || !prepareSegmentAttempt(curl, attempt))
+  {
+    if (curl)
+      handle_pool_->release(worker_id, curl);
+    breaker_.releaseProbe(breakerKey(task.url, attempt.path));
+    return false;
+  }
+
+  CURLcode res = curl_easy_perform(curl);
+  bool ok = completeSegmentAttempt(curl, attempt, res);
+  handle_pool_->release(worker_id, curl);
+  return ok;
+}
+
+bool VideoDownloader::mergeSegments(const std::vector<std::string> &segments, const std::string &output_file,
+                                    ResumeJournal *journal)
+{
+  int out_fd = open(output_file.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (out_fd < 0)
+    return false;
+
+  // 预先分配输出文件空间，之后由内核直接在文件之间复制数据
+  uint64_t total_size = 0;
+  for (const auto &segment : segments)
+  {
+    std::error_code ec;
+    uintmax_t size = std::filesystem::file_size(segment, ec);
+    if (!ec)
+      total_size += size;
+  }
+
+  FileAppender appender(out_fd, 0);
+  appender.preallocate(total_size);
+
+  for (size_t i = 0; i < segments.size(); ++i)
+  {
+    const std::string &segment = segments[i];
+    if (journal && config_.verify_checksums && !verifySegment(segment, journal->record(i)))
+    {
+      logger_->line(Logger::kWarn) << "Checksum mismatch for segment " << i + 1 << ": " << segment;
+      journal->markIncomplete(i);
+      close(out_fd);
+      return false;
+    }
+
+    uint64_t bytes = 0;
+    if (!appender.append(segment, &bytes))
+    {
+      close(out_fd);
+      return false;
+    }
+
+    // 与日志中记录的长度不一致说明片段文件被截断或替换
+    if (journal && bytes != journal->record(i).length)
+    {
+      logger_->line(Logger::kWarn) << "Size mismatch for segment " << i + 1 << ": " << segment << " (" << bytes
+                                   << " bytes, expected " << journal->record(i).length << ")";
+      journal->markIncomplete(i);
+      close(out_fd);
+      return false;
+    }
+  }
+
+  for (const auto &segment : segments)
+    std::filesystem::remove(segment);
+
+  if (close(out_fd) != 0)
+    return false;
+
+  std::cout << "Merged " << segments.size() << " segments ("
+            << FileAppender::methodName(FileAppender::kReflink) << ": " << appender.count(FileAppender::kReflink) << ", "
+            << FileAppender::methodName(FileAppender::kCopyFileRange) << ": " << appender.count(FileAppender::kCopyFileRange) << ", "
+            << FileAppender::methodName(FileAppender::kSendfile) << ": " << appender.count(FileAppender::kSendfile) << ", "
+            << FileAppender::methodName(FileAppender::kBuffered) << ": " << appender.count(FileAppender::kBuffered) << ")"
+            << std::endl;
+  return true;
+}
+
+bool VideoDownloader::verifySegment(const std::string &path, const ResumeJournal::Record &record) const
+{
+  FILE *fp = fopen(path.c_str(), "rb");
+  if (!fp)
+    return false;
+
+  Xxh64 checksum;
+  std::vector<uint8_t> buffer(kSegmentIoBufferSize);
+  size_t n;
+  uint64_t total = 0;
+  while ((n = fread(buffer.data(), 1, buffer.size(), fp)) > 0)
+  {
+    checksum.update(buffer.data(), n);
+    total += n;
+  }
+  fclose(fp);
+  return total == record.length && checksum.digest() == record.checksum;
+}
+
+bool VideoDownloader::fetchPlaylist(const std::string &url, std::string &content, PlaylistValidators *validators)
+{
+  char error_buffer[CURL_ERROR_SIZE] = {0};
+  std::map<std::string, std::string> headers;
+  struct curl_slist *request_headers = nullptr;
+
+  CURL *curl = curl_easy_init();
+  if (!curl)
+  {
+    std::cerr << "Failed to initialize CURL" << std::endl;
+    return false;
+  }
+
+  curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+  PooledBuffer body(&bufferPool());
+  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
+  curl_easy_setopt(curl, CURLOPT_WRITEDATA, &body);
+
+  setupCurlCommonOpts(curl, error_buffer);
+
+  // 播放列表是文本，接受服务器支持的任意压缩格式
+  curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");
+
+  // 轮询时带上上次的校验信息，未变化时服务器只返回304
+  if (validators)
+  {
+    if (!validators->etag.empty())
+      request_headers = curl_slist_append(request_headers, ("If-None-Match: " + validators->etag).c_str());
+    if (!validators->last_modified.empty())
+      request_headers = curl_slist_append(request_headers, ("If-Modified-Since: " + validators->last_modified).c_str());
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, request_headers);
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, HeaderCallback);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, &headers);
+    validators->not_modified = false;
+  }
+
+  // Perform request
+  CURLcode res = curl_easy_perform(curl);
+
+  // Get response code
+  long response_code = 0;
+  curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response_code);
+
+  curl_easy_cleanup(curl);
+  curl_slist_free_all(request_headers);
+  // 一次拼成连续的字符串交给解析器，不随收到的数据反复扩容
+  body.appendTo(content);
+
+  if (validators && res == CURLE_OK)
+  {
+    if (response_code == 304)
+    {
+      validators->not_modified = true;
+      return true;
+    }
+    if (response_code == 200)
+    {
+      validators->etag = headers["etag"];
+      validators->last_modified = headers["last-modified"];
+    }
+  }
+
+  if (res != CURLE_OK && res != CURLE_SSL_CONNECT_ERROR)
+  {
+    std::cerr << "Failed to download M3U8 file: " << curl_easy_strerror(res) << std::endl;
+    std::cerr << "Detailed error: " << error_buffer << std::endl;
+    std::cerr << "URL: " << url << std::endl;
+    return false;
+  }
+
+  if (response_code != 200)
+  {
+    std::cerr << "Server returned HTTP code: " << response_code << std::endl;
+    std::cerr << "Response content: " << content << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool VideoDownloader::resolvePlaylist(std::string_view content, const std::string &playlist_url,
+                                      std::vector<std::string> &segments)
+{
+  variant_selector_.reset();
+  // 媒体播放列表按配置的baseurl拼接片段地址；未配置时（如库调用方直接填写Config）相对于播放列表地址
+  if (!isMasterPlaylist(content))
+    return parseM3U8(content, segments, config_.baseurl.empty() ? playlist_url : "");
+
+  // 主播放列表：码率列表中的URI相对于主播放列表地址（本地文件则相对于baseurl）
+  std::vector<StreamVariant> variants;
+  if (!parseMasterPlaylist(std::string(content), playlist_url.empty() ? config_.baseurl : playlist_url, variants))
+  {
+    std::cerr << "Master playlist has no variants" << std::endl;
+    return false;
+  }
+
+  std::cout << "Master playlist with " << variants.size() << " variants:" << std::endl;
+  for (const auto &variant : variants)
+    std::cout << "  " << describeVariant(variant) << std::endl;
+
+  variant_selector_ = std::make_unique<VariantSelector>(config_.variant, std::move(variants));
+  return loadVariant(segments);
+}
+
+bool VideoDownloader::loadVariant(std::vector<std::string> &segments)
+{
+  const StreamVariant &variant = variant_selector_->current();
+  std::cout << "Selected variant: " << describeVariant(variant) << std::endl;
+
+  std::string content;
+  if (!fetchPlaylist(variant.uri, content))
+    return false;
+
+  segments.clear();
+  if (!parseM3U8(content, segments, variant.uri))
+  {
+    std::cerr << "Failed to parse variant playlist: " << variant.uri << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool VideoDownloader::downloadWithVariants(std::vector<std::string> &segments,
+                                           const std::function<bool(const std::vector<std::string> &)> &download)
+{
+  // 当前码率来不及完成时换成更低的码率重新下载
+  while (true)
+  {
+    if (download(segments))
+      return true;
+    if (stop_requested_.load() || !variant_selector_ || !variant_selector_->switchRequested())
+      return false;
+
+    variant_selector_->applySwitch();
+    if (!loadVariant(segments))
+      return false;
+  }
+}
+
+bool VideoDownloader::downloadM3U8(const std::string &url, const std::string &output_name)
+{
+  std::string m3u8_content;
+  if (!fetchPlaylist(url, m3u8_content))
+    return false;
+
+  std::cout << "M3U8 content received: " << m3u8_content.substr(0, 100) << "..." << std::endl;
+
+  // Parse M3U8
+  std::vector<std::string> segments;
+  if (!resolvePlaylist(m3u8_content, url, segments))
+  {
+    std::cerr << "Failed to parse M3U8 file" << std::endl;
+    return false;
+  }
+
+  return downloadWithVariants(segments, [&](const std::vector<std::string> &variant_segments)
+                              { return downloadAndMerge(variant_segments, output_name); });
+}
+
+bool VideoDownloader::downloadToPipe(const std::string &url, const std::string &pipe_path)
+{
+  std::string m3u8_content;
+  if (!fetchPlaylist(url, m3u8_content))
+    return false;
+
+  std::vector<std::string> segments;
+  if (!resolvePlaylist(m3u8_content, url, segments))
+  {
+    std::cerr << "Failed to parse M3U8 file" << std::endl;
+    return false;
+  }
+
+  // 写进管道的数据无法撤回，只使用开始时选定的码率，下载中途不再切换
+  if (variant_selector_ && (config_.variant.policy == "throughput" || config_.variant.deadline_seconds > 0))
+    std::cout << "Variant switching is disabled while streaming to a pipe" << std::endl;
+  variant_selector_.reset();
+
+  return downloadStreaming(segments, pipe_path, true);
+}
+
+bool VideoDownloader::loadM3U8FromFile(const std::string &file_path, const std::string &output_name)
+{
+  // 映射M3U8文件，解析时直接引用映射内容
+  PlaylistBuffer m3u8_content;
+  if (!m3u8_content.mapFile(file_path))
+  {
+    std::cerr << "Failed to open M3U8 file: " << file_path << std::endl;
+    return false;
+  }
+
+  // 解析M3U8内容
+  std::vector<std::string> segments;
+  if (!resolvePlaylist(m3u8_content.view(), "", segments))
+  {
+    std::cerr << "Failed to parse M3U8 content from file" << std::endl;
+    return false;
+  }
+
+  return downloadWithVariants(segments, [&](const std::vector<std::string> &variant_segments)
+                              { return downloadAndMerge(variant_segments, output_name); });
+}
+
+bool VideoDownloader::downloadAndMerge(const std::vector<std::string> &segments, const std::string &output_name)
+{
+  std::string output_path = config_.download_path + output_name + ".ts";
+  if (config_.output_mode == "stream")
+    return downloadStreaming(segments, output_path);
+
+  // 准备下载任务，日志中已完成的片段直接跳过
   std::vector<DownloadTask> tasks;
-  size_t segment_index = 0;
   std::vector<std::string> segment_files;
+  if (!prepareSegmentTasks(segments, output_name, tasks, segment_files))
+    return false;
+
+  // 下载所有片段；失败时保留日志，重新运行即可续传
+  if (!processDownloadTasks(tasks))
+  {
+    // 切换码率导致的中止不是错误
+    if (!jobCancelled())
+      std::cerr << "Failed to download segments" << std::endl;
+    journal_.reset();
+    return false;
+  }
+
+  // 合并片段
+  if (!mergeSegments(segment_files, output_path, journal_.get()))
+  {
+    std::cerr << "Failed to merge segments" << std::endl;
+    journal_.reset();
+    return false;
+  }
+
+  journal_->remove();
+  journal_.reset();
+  std::cout << "Successfully downloaded and merged video to: " << output_path << std::endl;
+  return true;
+}
+
+bool VideoDownloader::prepareSegmentTasks(const std::vector<std::string> &segments, const std::string &output_name,
+                                          std::vector<DownloadTask> &tasks, std::vector<std::string> &segment_files)
+{
+  journal_ = std::make_unique<ResumeJournal>(journalPath(output_name));
+  if (!journal_->open(segments.size(), ResumeJournal::fingerprint(segments.data(), segments.size())))
+  {
+    std::cerr << "Failed to open resume journal: " << journalPath(output_name) << std::endl;
+    journal_.reset();
+    return false;
+  }
+
+  size_t skipped = 0;
+  for (size_t i = 0; i < segments.size(); ++i)
+  {
+    std::string segment_path = config_.download_path + "segment_" + std::to_string(i) + ".ts";
+    segment_files.push_back(segment_path);
+
+    // 只有当片段未下载或下载不完整时才添加到任务列表
+    if (journal_->isComplete(i))
+      ++skipped;
+    else
+      tasks.push_back({segments[i], segment_path, i, nullptr, i < segment_ciphers_.size() ? segment_ciphers_[i] : nullptr});
+  }
+
+  if (skipped > 0)
+    std::cout << skipped << " segments already downloaded, skipping..." << std::endl;
+  return true;
+}
+
+std::string VideoDownloader::journalPath(const std::string &output_name) const
+{
+  return config_.download_path + output_name + ".journal";
+}
+
+bool VideoDownloader::downloadStreaming(const std::vector<std::string> &segments, const std::string &output_path,
+                                        bool pipe)
+{
+  // 片段完成后经重排序缓冲区直接追加到最终文件，不再生成segment_N.ts再合并
+  ordered_output_ = std::make_unique<OrderedOutput>(
+      output_path, output_path + ".spill/", reorderBufferBytes());
+  if (pipe && output_path != "-")
+    std::cout << "Waiting for a reader on " << output_path << "..." << std::endl;
+  if (!(pipe ? ordered_output_->openPipe(segments.size()) : ordered_output_->open(segments.size())))
+  {
+    std::cerr << "Failed to open output file: " << output_path << std::endl;
+    if (!pipe && std::filesystem::exists(output_path + ".progress"))
+      std::cerr << "Remove " << output_path << ".progress to start over if it is damaged" << std::endl;
+    ordered_output_.reset();
+    return false;
+  }
+
+  size_t first = ordered_output_->resumeIndex();
+  if (first > 0)
+    std::cout << "Resuming output after segment " << first << std::endl;
+
+  std::vector<DownloadTask> tasks;
+  for (size_t i = first; i < segments.size(); ++i)
+    tasks.push_back({segments[i], "", i, nullptr, i < segment_ciphers_.size() ? segment_ciphers_[i] : nullptr});
+
+  // 写管道时不能落盘，窗口默认取并发数的两倍，内存占用不超过窗口内的片段
+  dispatch_window_ = static_cast<size_t>(std::max(0, config_.stream_window));
+  if (pipe && dispatch_window_ == 0)
+    dispatch_window_ = 2 * (config_.engine == "multi" ? static_cast<size_t>(config_.max_transfers) : workerCount());
+
+  bool success = processDownloadTasks(tasks);
+  dispatch_window_ = 0;
+  std::cout << "Reorder buffer peak: " << (ordered_output_->peakBufferedBytes() >> 20) << " MB, "
+            << ordered_output_->spilledSegments() << " segments spilled to disk" << std::endl;
+  if (ordered_output_->firstByteSeconds() >= 0)
+    std::cout << "First output byte after " << ordered_output_->firstByteSeconds() << " s" << std::endl;
+
+  // 切换码率时已写入的内容属于旧码率，整体丢弃；用户取消时保留进度以便续传
+  if (jobCancelled() && !stop_requested_.load())
+    ordered_output_->discard();
+  success = ordered_output_->finish() && success;
+  ordered_output_.reset();
+
+  if (!success)
+  {
+    if (!jobCancelled())
+      std::cerr << "Failed to download segments" << std::endl;
+    return false;
+  }
+
+  std::cout << "Successfully downloaded video to: " << output_path << std::endl;
+  return true;
+}
+
+bool VideoDownloader::downloadLive(const std::string &url, const std::string &output_name)
+{
+  std::string playlist_url = url;
+  std::string content;
+  PlaylistValidators validators;
+  if (!fetchPlaylist(playlist_url, content, &validators))
+    return false;
+
+  // 主播放列表按策略选定一个码率，之后只轮询该码率的媒体播放列表
+  if (isMasterPlaylist(content))
+  {
+    std::vector<StreamVariant> variants;
+    if (!parseMasterPlaylist(content, url, variants))
+    {
+      std::cerr << "Master playlist has no variants" << std::endl;
+      return false;
+    }
+    VariantSelector selector(config_.variant, std::move(variants));
+    playlist_url = selector.current().uri;
+    std::cout << "Selected variant: " << describeVariant(selector.current()) << std::endl;
+
+    content.clear();
+    validators = PlaylistValidators();
+    if (!fetchPlaylist(playlist_url, content, &validators))
+      return false;
+  }
+
+  if (config_.engine == "multi")
+    std::cout << "Live mode downloads segments with the threaded engine" << std::endl;
+
+  // 输出按媒体序号排序：进度文件记录的就是下一个序号，中断后重新运行从该处继续录制
+  const std::string output_path = config_.download_path + output_name + ".ts";
+  ordered_output_ = std::make_unique<OrderedOutput>(
+      output_path, output_path + ".spill/", reorderBufferBytes());
+  if (!ordered_output_->open(std::numeric_limits<size_t>::max()))
+  {
+    std::cerr << "Failed to open output file: " << output_path << std::endl;
+    if (std::filesystem::exists(output_path + ".progress"))
+      std::cerr << "Remove " << output_path << ".progress to start over if it is damaged" << std::endl;
+    ordered_output_.reset();
+    return false;
+  }
+
+  int64_t next_sequence = static_cast<int64_t>(ordered_output_->resumeIndex());
+  const bool resumed = next_sequence > 0;
+  if (resumed)
+    std::cout << "Resuming live recording at media sequence " << next_sequence << std::endl;
+
+  beginJob(0);
+  ThreadedJob job;
+  job.skip_failed = true;
+  std::deque<DownloadTask> tasks; // 地址稳定，worker持有指针
+  M3U8Playlist playlist;
+  SegmentUrlResolver resolver(playlist_url, config_.baseurl);
+  keys_.clear();
+  bool started = false;
+  bool success = true;
+  int fetch_failures = 0;
+  auto last_growth = std::chrono::steady_clock::now();
+
+  while (success && !job.failed.load() && !decrypt_failed_.load() && waitWhilePaused())
+  {
+    const auto fetch_start = std::chrono::steady_clock::now();
+    bool grew = false;
+
+    if (!validators.not_modified)
+    {
+      // 只解析上次之后的片段
+      if (!parseMediaPlaylist(content, playlist, next_sequence))
+      {
+        std::cerr << "Failed to parse live playlist: " << playlist_url << std::endl;
+        success = false;
+        break;
+      }
+
+      for (const auto &segment : playlist.segments)
+      {
+        // 窗口已越过尚未下载的片段：这些片段再也取不到，在输出中跳过
+        if (segment.sequence > next_sequence)
+        {
+          if (started || resumed)
+            logger_->line(Logger::kWarn) << "Missed segments " << next_sequence << "-" << segment.sequence - 1
+                                         << " (no longer in the playlist)";
+          ordered_output_->skipRange(static_cast<size_t>(next_sequence), static_cast<size_t>(segment.sequence));
+        }
+
+        // 每个片段带着自己的密钥和IV，换密钥时不必等在途片段完成
+        std::shared_ptr<const SegmentCipher> cipher;
+        if (!segmentCipher(segment.key >= 0 ? &playlist.keys[segment.key] : nullptr, segment.sequence, cipher))
+        {
+          success = false;
+          break;
+        }
+
+        tasks.push_back({resolver.resolve(segment.uri), "", static_cast<size_t>(segment.sequence), nullptr, cipher});
+        if (hedge_)
+          tasks.back().race = std::make_shared<SegmentRace>();
+        job.total.fetch_add(1);
+        submitThreadedAttempt(job, &tasks.back(), 0);
+        next_sequence = segment.sequence + 1;
+        started = true;
+        grew = true;
+      }
+    }
+
+    if (!success)
+      break;
+    if (playlist.endlist)
+    {
+      std::cout << "Live playlist ended at media sequence " << next_sequence - 1 << std::endl;
+      ordered_output_->setTotal(static_cast<size_t>(next_sequence));
+      break;
+    }
+
+    const auto now = std::chrono::steady_clock::now();
+    if (grew)
+      last_growth = now;
+    else if (config_.live.stall_timeout_seconds > 0 &&
+             now - last_growth > std::chrono::seconds(config_.live.stall_timeout_seconds))
+    {
+      std::cout << "Live playlist has not grown for " << config_.live.stall_timeout_seconds
+                << " seconds, stopping" << std::endl;
+      ordered_output_->setTotal(static_cast<size_t>(next_sequence));
+      break;
+    }
+
+    // 支持阻塞刷新时直接请求下一个序号，服务器在片段出现时才返回；
+    // 否则按规范在播放列表变化后等一个目标时长，未变化时等半个目标时长
+    std::string request_url = playlist_url;
+    if (config_.live.blocking_reload && playlist.can_block_reload)
+    {
+      request_url += (request_url.find('?') == std::string::npos ? "?" : "&");
+      request_url += "_HLS_msn=" + std::to_string(next_sequence);
+    }
+    else
+    {
+      const double target = playlist.target_duration > 0 ? playlist.target_duration : 2.0;
+      const auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(
+          std::chrono::duration<double>(grew ? target : target / 2));
+      std::this_thread::sleep_until(fetch_start + wait);
+    }
+
+    content.clear();
+    if (fetchPlaylist(request_url, content, &validators))
+    {
+      fetch_failures = 0;
+      continue;
+    }
+
+    // 刷新失败按退避时间重试，连续失败retry_count次后停止录制
+    validators.not_modified = true;
+    if (++fetch_failures >= config_.retry_count)
+    {
+      std::cerr << "Giving up on live playlist after " << fetch_failures << " failed refreshes" << std::endl;
+      success = false;
+      break;
+    }
+    std::this_thread::sleep_for(backoffDelay(config_.retry, fetch_failures - 1));
+  }
+
+  scheduler_->wait(job_id_);
+  success = drainDecrypt() && success;
+  endJob();
+
+  success = ordered_output_->finish() && success && !job.failed.load();
+  ordered_output_.reset();
+
+  if (!success)
+  {
+    std::cerr << "Live recording incomplete; run again to continue from " << output_path << ".progress" << std::endl;
+    return false;
+  }
+
+  std::cout << "Successfully recorded " << job.processed.load() << " segments to: " << output_path << std::endl;
+  return true;
+}
+
+size_t VideoDownloader::workerCount() const
+{
+  // 自适应模式下线程数按上限创建，实际并发由调度器的限额控制
+  int count = config_.concurrency.adaptive ? config_.concurrency.max : config_.thread_count;
+  return static_cast<size_t>(std::max(1, count));
+}
+
+void VideoDownloader::shareWorkers(std::shared_ptr<CurlShare> share, std::shared_ptr<CurlHandlePool> handle_pool,
+                                   std::shared_ptr<SegmentScheduler> scheduler, std::shared_ptr<TransferMetrics> metrics,
+                                   std::shared_ptr<Logger> logger, unsigned priority)
+{
+  share_ = std::move(share);
+  handle_pool_ = std::move(handle_pool);
+  scheduler_ = std::move(scheduler);
+  metrics_ = std::move(metrics);
+  logger_ = std::move(logger);
+  job_id_ = scheduler_->addJob(priority);
+
+  // multi引擎的事件循环固定使用0号handle槽位，自适应并发会改动共用调度器的全局限额，共用时都不适用
+  config_.engine = "threads";
+  config_.concurrency.adaptive = false;
+}
+
+bool VideoDownloader::setDownloadPath(const std::string &path)
+{
+  std::error_code ec;
+  std::filesystem::create_directories(path, ec);
+  if (ec)
+  {
+    std::cerr << "Failed to create download directory " << path << ": " << ec.message() << std::endl;
+    return false;
+  }
+  config_.download_path = path;
+  return true;
+}
+
+void VideoDownloader::ensureWorkers()
+{
+  if (!handle_pool_)
+    handle_pool_ = std::make_shared<CurlHandlePool>(workerCount());
+  // cancel()会从其他线程读取scheduler_
+  std::lock_guard<std::mutex> lock(pause_mutex_);
+  if (!scheduler_)
+    scheduler_ = std::make_shared<SegmentScheduler>(workerCount());
+}
+
+std::chrono::milliseconds VideoDownloader::choosePath(const std::string &url, int avoid, int &path)
+{
+  path = -1;
+  if (paused_.load())
+    return kPausePoll;
+  if (!paths_)
+    return breaker_.blockedFor(hostKey(url));
+  return paths_->pick(url, avoid, [this](const std::string &key)
+                      { return breaker_.blockedFor(key); }, path);
+}
+
+std::string VideoDownloader::breakerKey(const std::string &url, int path) const
+{
+  return path >= 0 ? paths_->key(path, url) : hostKey(url);
+}
 
-  for (const auto &segment_url : segments)
-  {
-    std::string segment_path = config_.download_path + "segment_" +
-                               std::to_string(segment_index) + ".ts";
-    segment_files.push_back(segment_path);
+bool VideoDownloader::processDownloadTasks(std::vector<DownloadTask> &tasks)
+{
+  const size_t total_segments = tasks.size();
+  if (total_segments == 0)
+    return true;
 
-    // 只有当片段未下载或下载不完整时才添加到任务列表
-    if (!isSegmentComplete(segment_path))
-    {
-      tasks.push_back({segment_url, segment_path, segment_index});
-    }
-    else
-    {
-      std::cout << "Segment " << segment_index + 1 << " already downloaded, skipping..." << std::endl;
-    }
-    segment_index++;
+  beginJob(total_segments);
+  if (hedge_)
+  {
+    for (auto &task : tasks)
+      task.race = std::make_shared<SegmentRace>();
   }
+  bool success = (config_.engine == "multi") ? processDownloadTasksMulti(tasks)
+                                             : processDownloadTasksThreaded(tasks);
+  // 传输都结束后，解密阶段里可能还有片段没有写出
+  success = drainDecrypt() && success;
+  endJob();
+  return success;
+}
 
-  // 下载所有片段
-  if (!processDownloadTasks(tasks))
+void VideoDownloader::beginJob(size_t total_segments)
+{
+  ensureWorkers();
+  // cancel()可能在作业开始之前调用
+  job_cancelled_.store(stop_requested_.load());
+  last_progress_ms_.store(0);
+  // 共用worker的作业由作业队列统一导出指标
+  if (!metrics_exporter_ && !config_.metrics.prometheus_path.empty() && job_id_ == SegmentScheduler::kDefaultJob)
+    metrics_exporter_ = std::make_unique<MetricsExporter>(*metrics_, config_.metrics.prometheus_path,
+                                                          std::chrono::seconds(config_.metrics.interval_seconds));
+  // 延迟分位数跨作业保留，队列里后面的作业不必重新积累样本
+  if (config_.hedge.enabled && !hedge_)
+    hedge_ = std::make_unique<HedgePolicy>(config_.hedge);
+  // 各路径的吞吐和错误率同样跨作业保留；baseurl本身也是一个镜像
+  if (!paths_ && (!config_.mirrors.empty() || config_.proxies.size() > 1))
   {
-    std::cerr << "Failed to download segments" << std::endl;
-    return false;
+    std::vector<std::string> mirrors = config_.mirrors;
+    if (!mirrors.empty() && !config_.baseurl.empty())
+      mirrors.insert(mirrors.begin(), config_.baseurl);
+    std::vector<std::string> proxy_names;
+    for (const auto &proxy : config_.proxies)
+      proxy_names.push_back(proxy.enabled ? proxy.type + "://" + proxy.host + ":" + std::to_string(proxy.port)
+                                          : "direct");
+    paths_ = std::make_unique<PathBalancer>(std::move(mirrors), std::move(proxy_names));
+    if (paths_->size() < 2)
+      paths_.reset();
   }
+  if (variant_selector_)
+    variant_selector_->begin(total_segments);
+  if (config_.concurrency.adaptive)
+  {
+    limiter_ = std::make_unique<ConcurrencyLimiter>(config_.concurrency);
+    limiter_->setLogCallback([this](Logger::Level level, std::string message)
+                             { logger_->log(level, std::move(message)); });
+    std::cout << "Adaptive concurrency: starting with " << limiter_->limit() << " in-flight segments (min "
+              << config_.concurrency.min << ", max " << config_.concurrency.max << ")" << std::endl;
+  }
+}
 
-  // 合并片段
-  std::string output_path = config_.download_path + output_name + ".ts";
-  if (!mergeSegments(segment_files, output_path))
+void VideoDownloader::endJob()
+{
+  if (limiter_)
   {
-    std::cerr << "Failed to merge segments" << std::endl;
-    return false;
+    std::cout << "Adaptive concurrency: finished with limit " << limiter_->limit() << std::endl;
+    limiter_.reset();
   }
+  logger_->flush();
 
-  std::cout << "Successfully downloaded and merged video to: " << output_path << std::endl;
-  return true;
+  // 共用的handle池和指标统计的是所有作业，由作业队列在结束时统一输出
+  if (job_id_ != SegmentScheduler::kDefaultJob)
+    return;
+  if (metrics_exporter_)
+    metrics_exporter_->writeNow();
+  if (!config_.metrics.json_path.empty() && !writeFileAtomically(config_.metrics.json_path, metrics_->toJson().dump(2)))
+    std::cerr << "Failed to write metrics to " << config_.metrics.json_path << std::endl;
+
+  if (quiet_)
+    return;
+  if (metrics_->transfers() > 0)
+    std::cout << metrics_->summary() << std::endl;
+  if (paths_)
+    std::cout << paths_->summary() << std::endl;
+  if (hedge_ && hedge_->fired() > 0)
+    std::cout << "Hedged requests: " << hedge_->fired() << " fired, " << hedge_->won() << " won" << std::endl;
+  std::cout << "Connection reuse: " << handle_pool_->reusedConnections() << "/"
+            << handle_pool_->transfers() << " transfers reused a connection, "
+            << handle_pool_->newConnections() << " new connections" << std::endl;
+  if (config_.buffer_pool.max_mb > 0)
+    std::cout << "Buffer pool: peak " << std::fixed << std::setprecision(2) << bufferPool().peakBytes() / (1024.0 * 1024.0)
+              << " MB of " << config_.buffer_pool.max_mb << " MB, " << bufferPool().exhausted()
+              << " requests for a block had to wait" << std::defaultfloat << std::endl;
+  if (decrypted_segments_.load() > 0)
+    std::cout << "Decrypt stage: " << decrypt_stage_->threads() << " threads, " << decrypted_segments_.exchange(0)
+              << " segments, " << std::fixed << std::setprecision(1) << decrypted_bytes_.exchange(0) / (1024.0 * 1024.0)
+              << " MB" << std::defaultfloat << std::endl;
+  if (config_.http2.enabled)
+    std::cout << "HTTP/2: " << metrics_->http2Transfers() << "/" << metrics_->transfers()
+              << " transfers as h2 streams, " << metrics_->connectionsOpened() << " new connections" << std::endl;
+}
+
+void VideoDownloader::reportProgress(size_t done, size_t total, const char *unit, uint64_t bytes)
+{
+  constexpr int64_t kProgressIntervalMs = 1000;
+  if (progress_callback_)
+    progress_callback_({done, total, bytes});
+  if (quiet_)
+    return;
+
+  // 抢到时间片的线程负责打印，其余线程直接返回，不在控制台输出上排队
+  const int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(
+                          std::chrono::steady_clock::now().time_since_epoch())
+                          .count();
+  int64_t last = last_progress_ms_.load();
+  if (done < total && (now - last < kProgressIntervalMs || !last_progress_ms_.compare_exchange_strong(last, now)))
+    return;
+
+  std::ostringstream line;
+  line << "Progress: " << done << "/" << total << " " << unit << ", " << std::fixed << std::setprecision(1)
+       << bytes / (1024.0 * 1024.0) << " MB";
+  std::cout << line.str() << std::endl;
 }
-void VideoDownloader::downloadSegmentsParallel(const std::vector<DownloadTask> &tasks)
+
+bool VideoDownloader::processDownloadTasksThreaded(std::vector<DownloadTask> &tasks)
 {
-  std::mutex cout_mutex;
-  auto worker = [this, &cout_mutex](const DownloadTask &task)
+  ThreadedJob job;
+  job.total.store(tasks.size());
+
+  if (limiter_)
   {
-    if (downloadSegment(task.url, task.output_path))
-    {
-      std::lock_guard<std::mutex> lock(cout_mutex);
-      std::cout << "Successfully downloaded segment " << task.index + 1 << ":" << task.url << std::endl;
-    }
-  };
+    scheduler_->setConcurrencyLimit(limiter_->limit());
+    limiter_->setChangeCallback([this](size_t limit)
+                                { scheduler_->setConcurrencyLimit(limit); });
+  }
 
-  std::vector<std::thread> threads;
   for (const auto &task : tasks)
   {
-    if (threads.size() >= static_cast<size_t>(config_.thread_count))
+    // 流式输出限制下载位置领先已写出前缀的距离，worker优先处理最前面缺失的片段
+    if (dispatch_window_ > 0 && task.index >= dispatch_window_)
     {
-      threads.front().join();
-      threads.erase(threads.begin());
+      while (!ordered_output_->waitForCommitted(task.index - dispatch_window_ + 1, std::chrono::milliseconds(100)))
+      {
+        if (job.failed.load() || jobCancelled() || ordered_output_->failed() || decrypt_failed_.load())
+          break;
+      }
     }
-    threads.emplace_back(worker, task);
+    if (job.failed.load() || jobCancelled() || (ordered_output_ && ordered_output_->failed()) || decrypt_failed_.load())
+      break;
+    submitThreadedAttempt(job, &task, 0);
   }
 
-  for (auto &thread : threads)
+  scheduler_->wait(job_id_);
+  if (limiter_)
+    scheduler_->setConcurrencyLimit(workerCount());
+  return !job.failed.load() && !jobCancelled();
+}
+
+void VideoDownloader::submitThreadedAttempt(ThreadedJob &job, const DownloadTask *task, int retry, int avoid_path)
+{
+  // 与multi模式相同：失败的尝试按退避时间重新提交，等待期间worker去处理其他片段
+  auto run = [this, &job, task, retry, avoid_path](size_t worker_id)
   {
-    thread.join();
-  }
+    // 已有片段失败或需要切换码率，剩余任务直接放弃
+    if (job.failed.load() || jobCancelled())
+      return;
+
+    // 主机处于熔断状态或下载被暂停时推迟派发，不计入重试次数，也不占用worker
+    int path = -1;
+    auto blocked = choosePath(task->url, avoid_path, path);
+    if (blocked.count() > 0)
+    {
+      scheduler_->submitAfter(blocked, [this, &job, task, retry, avoid_path](size_t)
+                              { submitThreadedAttempt(job, task, retry, avoid_path); }, job_id_);
+      return;
+    }
+
+    // 对冲请求已经交付了该片段
+    if (task->race && task->race->won.load())
+    {
+      breaker_.releaseProbe(breakerKey(task->url, path));
+      return;
+    }
+    if (hedge_ && task->race && retry == 0)
+    {
+      auto delay = hedge_->onSegmentStart();
+      if (delay.count() > 0)
+        submitThreadedHedge(job, task, retry, delay);
+    }
+
+    SegmentAttempt attempt;
+    attempt.retry = retry;
+    attempt.race = task->race;
+    attempt.path = path;
+    if (task->race)
+    {
+      task->race->path.store(path);
+      task->race->running.fetch_add(1);
+    }
+    bool ok = downloadSegment(*task, worker_id, attempt);
+    if (task->race)
+      task->race->running.fetch_sub(1);
+    if (ok)
+    {
+      finishThreadedSegment(job, task);
+      return;
+    }
+
+    if (attempt.lost || jobCancelled())
+      return;
+    if (attempt.failure == FailureKind::kFatal || retry + 1 >= config_.retry_count)
+    {
+      if (!job.skip_failed)
+      {
+        job.failed.store(true);
+        logger_->line(Logger::kError) << "Giving up on segment " << task->index + 1 << ": " << task->url;
+        return;
+      }
+
+      // 直播片段过期后无法再下载，留下空缺继续录制
+      logger_->line(Logger::kWarn) << "Skipping segment " << task->index + 1 << ": " << task->url;
+      if (ordered_output_ && !ordered_output_->deliver(task->index, {}))
+        job.failed.store(true);
+      return;
+    }
+
+    auto delay = retryDelay(attempt);
+    logger_->line(Logger::kInfo) << "Retrying segment " << task->index + 1 << " in " << delay.count() << " ms";
+    scheduler_->submitAfter(delay, [this, &job, task, retry, path](size_t)
+                            { submitThreadedAttempt(job, task, retry + 1, path); }, job_id_);
+  };
+  scheduler_->submit(run, job_id_);
 }
 
-bool VideoDownloader::processDownloadTasks(std::vector<DownloadTask> &tasks)
+void VideoDownloader::submitThreadedHedge(ThreadedJob &job, const DownloadTask *task, int retry,
+                                          std::chrono::milliseconds delay)
 {
-  const size_t total_segments = tasks.size();
-  size_t processed = 0;
-  size_t batch_size = config_.thread_count;
+  scheduler_->submitAfter(delay, [this, &job, task, retry, delay](size_t worker_id)
+                          {
+                            // 原请求已经结束（成功，或失败后在退避中等待重试）时不再对冲
+                            SegmentRace &race = *task->race;
+                            if (job.failed.load() || jobCancelled() || race.won.load() || race.running.load() == 0)
+                              return;
+                            // 有多条路径时对冲请求走另一个镜像或代理
+                            int path = -1;
+                            if (choosePath(task->url, race.path.load(), path).count() > 0)
+                              return;
+                            if (!hedge_->tryHedge())
+                            {
+                              breaker_.releaseProbe(breakerKey(task->url, path));
+                              return;
+                            }
+
+                            metrics_->recordHedgeFired();
+                            logger_->line(Logger::kInfo) << "Hedging segment " << task->index + 1 << " after "
+                                                         << delay.count() << " ms: " << task->url;
+                            SegmentAttempt attempt;
+                            attempt.retry = retry;
+                            attempt.race = task->race;
+                            attempt.hedge = true;
+                            attempt.path = path;
+                            race.running.fetch_add(1);
+                            bool ok = downloadSegment(*task, worker_id, attempt);
+                            race.running.fetch_sub(1);
+                            // 对冲请求失败时由原请求照常重试
+                            if (ok)
+                              finishThreadedSegment(job, task);
+                          },
+                          job_id_);
+}
 
-  while (processed < total_segments)
-  {
-    size_t current_batch_size = std::min(batch_size, total_segments - processed);
-    std::vector<DownloadTask> current_batch(
-        tasks.begin() + processed,
-        tasks.begin() + processed + current_batch_size);
+void VideoDownloader::finishThreadedSegment(ThreadedJob &job, const DownloadTask *task)
+{
+  size_t done = job.processed.fetch_add(1) + 1;
+  logger_->line(Logger::kInfo) << "Successfully downloaded segment " << task->index + 1 << ":" << task->url;
+  reportProgress(done, job.total.load(), "segments", bytes_received_.load());
+}
 
-    downloadSegmentsParallel(current_batch);
+bool VideoDownloader::processDownloadTasksMulti(std::vector<DownloadTask> &tasks)
+{
+  const size_t total_segments = tasks.size();
+  // 自适应模式下以并发上限创建引擎，再按当前限额放行传输
+  CurlMultiEngine engine(limiter_ ? config_.concurrency.max : config_.max_transfers);
+  if (!engine.valid())
+  {
+    std::cerr << "Failed to initialize curl multi engine" << std::endl;
+    return false;
+  }
+  if (config_.http2.enabled)
+    engine.enableMultiplexing(static_cast<size_t>(std::max(1, config_.http2.max_streams)));
+  if (limiter_)
+  {
+    engine.setMaxTransfers(limiter_->limit());
+    limiter_->setChangeCallback([&engine](size_t limit)
+                                { engine.setMaxTransfers(limit); });
+  }
 
-    // Verify all files in the batch were downloaded
-    bool batch_success = true;
-    for (const auto &task : current_batch)
+  size_t processed = 0;
+  bool failed = false;
+  // 对冲时同一片段可能同时有两个传输，先完成的一方取消另一方
+  std::map<size_t, std::vector<std::shared_ptr<SegmentAttempt>>> in_flight;
+
+  // 单线程事件循环驱动全部传输，失败的片段通过定时器重新加入而不是阻塞等待
+  std::function<void(const DownloadTask *, int, bool, int)> start_attempt;
+  std::function<void()> dispatch;
+  start_attempt = [&](const DownloadTask *task, int retry, bool hedge, int avoid_path)
+  {
+    if (failed || jobCancelled())
+      return;
+    // 对冲请求已经交付了该片段
+    if (task->race && task->race->won.load())
+      return;
+
+    int path = -1;
+    if (hedge)
     {
-      if (!std::filesystem::exists(task.output_path))
+      // 原请求已经结束（成功，或失败后在退避中等待重试）时不再对冲；有多条路径时走另一个镜像或代理
+      auto it = in_flight.find(task->index);
+      if (it == in_flight.end() || it->second.empty() || choosePath(task->url, avoid_path, path).count() > 0)
+        return;
+      if (!hedge_->tryHedge())
       {
-        std::cerr << "Failed to download segment: " << task.url << std::endl;
-        batch_success = false;
-        break;
+        breaker_.releaseProbe(breakerKey(task->url, path));
+        return;
+      }
+      metrics_->recordHedgeFired();
+      logger_->line(Logger::kInfo) << "Hedging segment " << task->index + 1 << ": " << task->url;
+    }
+    else
+    {
+      // 主机处于熔断状态或下载被暂停时推迟派发，不计入重试次数
+      auto blocked = choosePath(task->url, avoid_path, path);
+      if (blocked.count() > 0)
+      {
+        engine.schedule(blocked, [&, task, retry, avoid_path]
+                        { start_attempt(task, retry, false, avoid_path); });
+        return;
       }
     }
 
-    if (!batch_success)
+    // multi模式只有一个事件循环线程，统一使用0号槽位
+    CURL *curl = handle_pool_->acquire(0);
+    auto attempt = std::make_shared<SegmentAttempt>();
+    attempt->url = task->url;
+    attempt->output_path = task->output_path;
+    attempt->index = task->index;
+    attempt->cipher = task->cipher;
+    attempt->retry = retry;
+    attempt->race = task->race;
+    attempt->hedge = hedge;
+    attempt->easy = curl;
+    attempt->path = path;
+
+    if (!curl || !prepareSegmentAttempt(curl, *attempt))
     {
-      return false;
+      handle_pool_->release(0, curl);
+      breaker_.releaseProbe(breakerKey(task->url, path));
+      logger_->line(Logger::kError) << "Failed to prepare segment: " << task->url;
+      // 对冲请求准备失败不影响原请求
+      if (!hedge)
+        failed = true;
+      return;
     }
 
-    processed += current_batch_size;
-    std::cout << "Progress: " << processed << "/" << total_segments << " segments" << std::endl;
-  }
+    // 限速时不能阻塞事件循环：暂停该传输，到时间后由定时器恢复
+    std::weak_ptr<SegmentAttempt> weak = attempt;
+    attempt->pause = [&engine, curl, weak](std::chrono::steady_clock::time_point resume_at)
+    {
+      auto delay = std::chrono::ceil<std::chrono::milliseconds>(resume_at - std::chrono::steady_clock::now());
+      engine.schedule(delay, [curl, weak]
+                      {
+                        if (weak.lock())
+                          curl_easy_pause(curl, CURLPAUSE_CONT);
+                      });
+    };
+
+    in_flight[task->index].push_back(attempt);
+    engine.add(curl, [&, task, attempt, retry](CURL *easy, CURLcode res)
+               {
+                 bool ok = completeSegmentAttempt(easy, *attempt, res);
+                 handle_pool_->release(0, easy);
+
+                 // 取消同伴会重入完成回调并修改in_flight，这里先取出副本
+                 std::vector<std::shared_ptr<SegmentAttempt>> peers;
+                 auto it = in_flight.find(task->index);
+                 if (it != in_flight.end())
+                 {
+                   auto &list = it->second;
+                   list.erase(std::remove(list.begin(), list.end(), attempt), list.end());
+                   peers = list;
+                   if (list.empty())
+                     in_flight.erase(it);
+                 }
+
+                 // 任务被取消：其余传输直接结束，不计为失败
+                 if (jobCancelled())
+                 {
+                   engine.cancelAll();
+                   return;
+                 }
+
+                 if (ok)
+                 {
+                   for (const auto &peer : peers)
+                     engine.cancel(peer->easy);
+                   ++processed;
+                   logger_->line(Logger::kInfo) << "Successfully downloaded segment " << task->index + 1 << ":" << task->url;
+                   reportProgress(processed, total_segments, "segments", bytes_received_.load());
+                   dispatch();
+                   return;
+                 }
+
+                 // 输给了另一方的传输，或对冲请求失败：都由原请求负责重试
+                 if (attempt->lost || attempt->hedge)
+                   return;
+
+                 if (attempt->failure == FailureKind::kFatal || retry + 1 >= config_.retry_count)
+                 {
+                   logger_->line(Logger::kError) << "Giving up on segment " << task->index + 1 << ": " << task->url;
+                   failed = true;
+                   return;
+                 }
+
+                 auto delay = retryDelay(*attempt);
+                 logger_->line(Logger::kInfo) << "Retrying segment " << task->index + 1 << " in " << delay.count() << " ms";
+                 engine.schedule(delay, [&, task, retry, path = attempt->path]
+                                 { start_attempt(task, retry + 1, false, path); });
+               },
+               hedge || (dispatch_window_ > 0 && retry > 0),
+               [&, task, retry, hedge, path]
+               {
+                 // 从传输真正开始时计时，排队时间不算在内
+                 if (hedge || retry > 0 || !hedge_ || !task->race)
+                   return;
+                 auto delay = hedge_->onSegmentStart();
+                 if (delay.count() > 0)
+                   engine.schedule(delay, [&, task, retry, path]
+                                   { start_attempt(task, retry, true, path); });
+               });
+  };
 
-  return true;
+  // 流式输出时只放行已写出前缀之后窗口内的片段，每完成一个片段再继续放行
+  size_t next_task = 0;
+  bool dispatch_scheduled = false;
+  dispatch = [&]
+  {
+    while (next_task < tasks.size() && !failed && !decrypt_failed_.load() &&
+           (dispatch_window_ == 0 || tasks[next_task].index < ordered_output_->committedIndex() + dispatch_window_))
+      start_attempt(&tasks[next_task++], 0, false, -1);
+    // 加密片段由解密线程交付，窗口可能在没有传输完成时前移，定期再检查一次
+    if (next_task < tasks.size() && tasks[next_task].cipher && dispatch_window_ > 0 && !failed &&
+        !decrypt_failed_.load() && !dispatch_scheduled)
+    {
+      dispatch_scheduled = true;
+      engine.schedule(kBufferPoll, [&]
+                      {
+                        dispatch_scheduled = false;
+                        dispatch();
+                      });
+    }
+  };
+  dispatch();
+
+  engine.setStopCondition([this]
+                          { return jobCancelled(); });
+  engine.run();
+  return !failed && !jobCancelled() && processed == total_segments;
 }
 
-bool VideoDownloader::downloadOnly(const std::string &url_or_file, bool is_file)
+bool VideoDownloader::downloadOnly(const std::string &url_or_file, const std::string &output_name, bool is_file)
 {
-  std::string m3u8_content;
+  PlaylistBuffer m3u8_content;
 
   if (is_file)
   {
-    std::ifstream file(url_or_file);
-    if (!file.is_open())
+    if (!m3u8_content.mapFile(url_or_file))
     {
       std::cerr << "Failed to open M3U8 file: " << url_or_file << std::endl;
       return false;
     }
-    m3u8_content = std::string((std::istreambuf_iterator<char>(file)),
-                               std::istreambuf_iterator<char>());
-    file.close();
   }
   else
   {
     // 下载M3U8文件
-    char error_buffer[CURL_ERROR_SIZE] = {0};
-    CURL *curl = curl_easy_init();
-    if (!curl)
-      return false;
-
-    curl_easy_setopt(curl, CURLOPT_URL, url_or_file.c_str());
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &m3u8_content);
-    setupCurlCommonOpts(curl, error_buffer);
-
-    CURLcode res = curl_easy_perform(curl);
-    curl_easy_cleanup(curl);
-
-    if (res != CURLE_OK && res != CURLE_SSL_CONNECT_ERROR)
-    {
-      std::cerr << "Failed to download M3U8 file" << std::endl;
+    std::string content;
+    if (!fetchPlaylist(url_or_file, content))
       return false;
-    }
+    m3u8_content.assign(std::move(content));
   }
 
   // 解析M3U8
   std::vector<std::string> segments;
-  if (!parseM3U8(m3u8_content, segments))
+  if (!resolvePlaylist(m3u8_content.view(), is_file ? "" : url_or_file, segments))
   {
     std::cerr << "Failed to parse M3U8 content" << std::endl;
     return false;
   }
 
-  // 准备下载任务
-  std::vector<DownloadTask> tasks;
-  size_t segment_index = 0;
+  return downloadWithVariants(segments, [&](const std::vector<std::string> &variant_segments)
+                              {
+                                // 准备下载任务；日志保留给之后的--merge-only使用
+                                std::vector<DownloadTask> tasks;
+                                std::vector<std::string> segment_files;
+                                if (!prepareSegmentTasks(variant_segments, output_name, tasks, segment_files))
+                                  return false;
+
+                                bool success = processDownloadTasks(tasks);
+                                journal_.reset();
+                                return success; });
+}
+
+bool VideoDownloader::mergeOnly(const std::string &output_name)
+{
+  std::string output_path = config_.download_path + output_name + ".ts";
 
-  for (const auto &segment_url : segments)
+  // 有日志时直接按日志中的片段列表合并，不再扫描目录
+  ResumeJournal journal(journalPath(output_name));
+  if (journal.openExisting())
   {
-    std::string segment_path = config_.download_path + "segment_" +
-                               std::to_string(segment_index) + ".ts";
-    if (!isSegmentComplete(segment_path))
+    const size_t total = journal.segmentCount();
+    const size_t completed = journal.completedCount();
+    if (completed != total)
     {
-      tasks.push_back({segment_url, segment_path, segment_index});
+      std::cerr << (total - completed) << " of " << total
+                << " segments are missing, run --download-only again first" << std::endl;
+      return false;
     }
-    segment_index++;
-  }
 
-  return processDownloadTasks(tasks);
-}
+    std::vector<std::string> segment_files;
+    for (size_t i = 0; i < total; ++i)
+      segment_files.push_back(config_.download_path + "segment_" + std::to_string(i) + ".ts");
 
-bool VideoDownloader::mergeOnly(const std::string &output_name)
-{
-  // 扫描下载目录中的所有片段
-  std::vector<std::string> segment_files;
+    std::cout << "Found " << total << " segments to merge" << std::endl;
+    if (!mergeSegments(segment_files, output_path, &journal))
+      return false;
+
+    journal.remove();
+    std::cout << "Successfully merged segments to: " << output_path << std::endl;
+    return true;
+  }
+
+  // 没有日志时扫描下载目录中的所有片段
+  std::vector<std::pair<size_t, std::string>> indexed_files;
   std::string pattern = "segment_";
   std::string extension = ".ts";
 
@@ -695,12 +2186,16 @@ bool VideoDownloader::mergeOnly(const std::string &output_name)
     for (const auto &entry : std::filesystem::directory_iterator(config_.download_path))
     {
       std::string filename = entry.path().filename().string();
-      // 检查文件是否以pattern开头且以.ts结尾
+      // 检查文件是否以pattern开头且以.ts结尾，序号只解析一次
       if (filename.find(pattern) == 0 &&
-          filename.length() > extension.length() &&
+          filename.length() > pattern.length() + extension.length() &&
           filename.compare(filename.length() - extension.length(), extension.length(), extension) == 0)
       {
-        segment_files.push_back(entry.path().string());
+        std::string number = filename.substr(pattern.length(),
+                                             filename.length() - pattern.length() - extension.length());
+        if (number.find_first_not_of("0123456789") != std::string::npos)
+          continue;
+        indexed_files.emplace_back(std::stoul(number), entry.path().string());
       }
     }
   }
@@ -710,31 +2205,21 @@ bool VideoDownloader::mergeOnly(const std::string &output_name)
     return false;
   }
 
-  if (segment_files.empty())
+  if (indexed_files.empty())
   {
     std::cerr << "No segments found in directory: " << config_.download_path << std::endl;
     return false;
   }
 
   // 对片段进行排序，确保按正确顺序合并
-  std::sort(segment_files.begin(), segment_files.end(),
-            [&pattern](const std::string &a, const std::string &b)
-            {
-              // 提取segment_X.ts中的X号码进行比较
-              auto get_number = [&pattern](const std::string &filename)
-              {
-                size_t start = pattern.length();
-                size_t end = filename.find(".ts");
-                return std::stoi(filename.substr(start, end - start));
-              };
-
-              return get_number(std::filesystem::path(a).filename().string()) <
-                     get_number(std::filesystem::path(b).filename().string());
-            });
+  std::sort(indexed_files.begin(), indexed_files.end());
+
+  std::vector<std::string> segment_files;
+  for (auto &entry : indexed_files)
+    segment_files.push_back(std::move(entry.second));
 
   std::cout << "Found " << segment_files.size() << " segments to merge" << std::endl;
 
-  std::string output_path = config_.download_path + output_name + ".ts";
   bool success = mergeSegments(segment_files, output_path);
 
   if (success)
@@ -744,3 +2229,298 @@ bool VideoDownloader::mergeOnly(const std::string &output_name)
 
   return success;
 }
+
+size_t VideoDownloader::HeaderCallback(char *buffer, size_t size, size_t nitems, void *userp)
+{
+  auto *headers = static_cast<std::map<std::string, std::string> *>(userp);
+  std::string line(buffer, size * nitems);
+
+  // 跟随重定向时只保留最后一个响应的头部
+  if (line.compare(0, 5, "HTTP/") == 0)
+  {
+    headers->clear();
+    return size * nitems;
+  }
+
+  size_t colon = line.find(':');
+  if (colon == std::string::npos)
+    return size * nitems;
+
+  std::string name = line.substr(0, colon);
+  std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+  std::string value = line.substr(colon + 1);
+  value.erase(0, value.find_first_not_of(" \t"));
+  value.erase(value.find_last_not_of(" \t\r\n") + 1);
+  (*headers)[name] = value;
+  return size * nitems;
+}
+
+bool VideoDownloader::probeDirect(const std::string &url, DirectProbe &probe)
+{
+  char error_buffer[CURL_ERROR_SIZE] = {0};
+  std::map<std::string, std::string> headers;
+
+  CURL *curl = curl_easy_init();
+  if (!curl)
+    return false;
+
+  // 只请求第一个字节：一次请求同时拿到总大小、ETag以及是否支持Range
+  curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+  curl_easy_setopt(curl, CURLOPT_RANGE, "0-0");
+  curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, HeaderCallback);
+  curl_easy_setopt(curl, CURLOPT_HEADERDATA, &headers);
+  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, +[](void *, size_t size, size_t nmemb, void *) -> size_t
+                   { return size * nmemb <= 1 ? size * nmemb : 0; });
+  setupCurlCommonOpts(curl, error_buffer);
+
+  CURLcode res = curl_easy_perform(curl);
+  long response_code = 0;
+  curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response_code);
+  curl_easy_cleanup(curl);
+
+  // 不支持Range的服务器会直接返回整个文件，此时写回调主动中止传输
+  if (res != CURLE_OK && res != CURLE_WRITE_ERROR && res != CURLE_SSL_CONNECT_ERROR)
+  {
+    std::cerr << "Failed to probe URL: " << curl_easy_strerror(res) << std::endl;
+    std::cerr << "Detailed error: " << error_buffer << std::endl;
+    return false;
+  }
+
+  probe.etag = headers.count("etag") ? headers["etag"] : "";
+  if (response_code == 206 && headers.count("content-range"))
+  {
+    const std::string &range = headers["content-range"];
+    size_t slash = range.rfind('/');
+    if (slash != std::string::npos && range.compare(slash + 1, std::string::npos, "*") != 0)
+    {
+      probe.size = std::stoull(range.substr(slash + 1));
+      probe.ranges = probe.size > 0;
+      return true;
+    }
+  }
+
+  if (response_code == 200)
+  {
+    probe.ranges = false;
+    probe.size = headers.count("content-length") ? std::stoull(headers["content-length"]) : 0;
+    return true;
+  }
+
+  std::cerr << "Server returned HTTP code: " << response_code << std::endl;
+  return false;
+}
+
+size_t VideoDownloader::ChunkWriteCallback(void *contents, size_t size, size_t nmemb, void *userp)
+{
+  auto *ctx = static_cast<ChunkWriteContext *>(userp);
+  size_t len = size * nmemb;
+
+  // 分块是长传输：暂停时在回调中原地等待，取消时中止传输，已写入的部分保留在分块计划中
+  if (!ctx->owner->waitWhilePaused())
+    return 0;
+
+  if (!ctx->code_checked)
+  {
+    // 服务器忽略Range返回200时数据偏移是错的，必须中止
+    long response_code = 0;
+    curl_easy_getinfo(ctx->curl, CURLINFO_RESPONSE_CODE, &response_code);
+    if (response_code != (ctx->ranges ? 206 : 200))
+      return 0;
+    ctx->code_checked = true;
+  }
+
+  RangePlan::Chunk &chunk = *ctx->chunk;
+  size_t to_write = len;
+  if (ctx->ranges)
+    to_write = static_cast<size_t>(std::min<uint64_t>(len, chunk.remaining()));
+
+  const char *data = static_cast<const char *>(contents);
+  size_t written = 0;
+  while (written < to_write)
+  {
+    ssize_t n = pwrite(ctx->fd, data + written, to_write - written,
+                       static_cast<off_t>(chunk.start + chunk.done.load() + written));
+    if (n <= 0)
+      return 0;
+    written += static_cast<size_t>(n);
+  }
+  chunk.done.fetch_add(written);
+
+  auto delay = throttleDelay(ctx->job_bandwidth, written);
+  if (delay >= std::chrono::milliseconds(1))
+    std::this_thread::sleep_for(delay);
+
+  // 定期保存进度，中断后每个分块都能从断点继续
+  ctx->unsaved += written;
+  if (ctx->unsaved >= (8u << 20))
+  {
+    ctx->plan->save();
+    ctx->unsaved = 0;
+  }
+  return len;
+}
+
+bool VideoDownloader::downloadChunk(RangePlan &plan, size_t chunk_index, int fd,
+                                    const std::string &url, bool ranges, size_t worker_id)
+{
+  RangePlan::Chunk &chunk = plan.chunk(chunk_index);
+
+  for (int retry = 0; retry < config_.retry_count && waitWhilePaused(); ++retry)
+  {
+    if (ranges && chunk.remaining() == 0)
+      return true;
+    if (!ranges)
+    {
+      // 不支持Range时只能从头重新下载，先截掉上一次写了一部分的内容，
+      // 否则这次的响应较短时文件末尾会留下旧数据
+      chunk.done = 0;
+      if (ftruncate(fd, 0) != 0)
+      {
+        logger_->line(Logger::kError) << "Failed to truncate output for " << url << ": " << std::strerror(errno);
+        return false;
+      }
+    }
+
+    CURL *curl = handle_pool_->acquire(worker_id);
+    if (!curl)
+      continue;
+
+    char error_buffer[CURL_ERROR_SIZE] = {0};
+    ChunkWriteContext ctx;
+    ctx.plan = &plan;
+    ctx.chunk = &chunk;
+    ctx.curl = curl;
+    ctx.fd = fd;
+    ctx.ranges = ranges;
+    ctx.job_bandwidth = &job_bandwidth_;
+    ctx.owner = this;
+
+    std::string range;
+    if (ranges)
+    {
+      range = std::to_string(chunk.start + chunk.done.load()) + "-" + std::to_string(chunk.end - 1);
+      curl_easy_setopt(curl, CURLOPT_RANGE, range.c_str());
+    }
+    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, ChunkWriteCallback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &ctx);
+    setupCurlCommonOpts(curl, error_buffer);
+    // 大文件分块不适用片段级的整体超时
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT, 0L);
+    curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, 1L);
+    curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, static_cast<long>(config_.timeout_seconds));
+
+    CURLcode res = curl_easy_perform(curl);
+    long response_code = 0;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response_code);
+    bool complete = ranges ? chunk.remaining() == 0 : (res == CURLE_OK && response_code == 200);
+    metrics_->record(curl, retry, complete);
+    handle_pool_->release(worker_id, curl);
+    plan.save();
+
+    if (complete)
+      return true;
+    if (jobCancelled())
+      return false;
+
+    logger_->line(Logger::kWarn) << "Failed to download chunk " << chunk_index + 1 << " of " << url
+                                 << " (Attempt " << (retry + 1) << "/" << config_.retry_count
+                                 << "): " << curl_easy_strerror(res) << ", detail: " << error_buffer
+                                 << ", HTTP " << response_code;
+
+    if (classifyFailure(res, response_code) == FailureKind::kFatal)
+      return false;
+    if (retry < config_.retry_count - 1)
+    {
+      // 分块下载本身就是长任务，直接在本worker上退避等待
+      auto delay = backoffDelay(config_.retry, retry);
+      logger_->line(Logger::kInfo) << "Retrying chunk " << chunk_index + 1 << " in " << delay.count() << " ms";
+      std::this_thread::sleep_for(delay);
+    }
+  }
+  return false;
+}
+
+bool VideoDownloader::downloadDirect(const std::string &url, const std::string &output_file)
+{
+  job_cancelled_.store(stop_requested_.load());
+  DirectProbe probe;
+  if (!probeDirect(url, probe))
+  {
+    std::cerr << "Failed to determine size of: " << url << std::endl;
+    return false;
+  }
+
+  RangePlan plan(output_file + ".chunks");
+  if (probe.ranges)
+  {
+    plan.prepare(probe.size, probe.etag, static_cast<size_t>(config_.direct_chunks));
+    std::cout << "File size: " << probe.size << " bytes, " << plan.chunkCount() << " chunks" << std::endl;
+  }
+  else
+  {
+    std::cout << "Server does not support range requests, downloading in a single stream" << std::endl;
+    plan.remove();
+    plan.prepare(probe.size, probe.etag, 1);
+  }
+
+  if (plan.resumed())
+    std::cout << "Resuming: " << plan.completedBytes() << "/" << probe.size << " bytes already downloaded" << std::endl;
+
+  int flags = O_RDWR | O_CREAT | O_CLOEXEC | (plan.resumed() ? 0 : O_TRUNC);
+  int fd = open(output_file.c_str(), flags, 0644);
+  if (fd < 0)
+  {
+    std::cerr << "Failed to open output file: " << output_file << std::endl;
+    return false;
+  }
+
+  // 预分配整个文件，各分块用pwrite直接写到各自的位置；空间不够时现在就失败，
+  // 而不是之后在各个分块中零散地写入失败
+  if (probe.ranges && fallocate(fd, 0, 0, static_cast<off_t>(probe.size)) != 0 &&
+      ftruncate(fd, static_cast<off_t>(probe.size)) != 0)
+  {
+    std::cerr << "Failed to allocate " << probe.size << " bytes for " << output_file << ": " << std::strerror(errno)
+              << std::endl;
+    close(fd);
+    return false;
+  }
+
+  ensureWorkers();
+  std::atomic<size_t> finished{0};
+  std::atomic<bool> failed{false};
+  const size_t chunk_count = plan.chunkCount();
+
+  for (size_t i = 0; i < chunk_count; ++i)
+  {
+    scheduler_->submit([&, i](size_t worker_id)
+                       {
+                         if (failed.load() || jobCancelled())
+                           return;
+
+                         if (!downloadChunk(plan, i, fd, url, probe.ranges, worker_id))
+                         {
+                           failed.store(true);
+                           return;
+                         }
+
+                         size_t done = finished.fetch_add(1) + 1;
+                         logger_->line(Logger::kInfo) << "Chunk " << i + 1 << " of " << url << " complete";
+                         reportProgress(done, chunk_count, "chunks", plan.completedBytes());
+                       },
+                       job_id_);
+  }
+  scheduler_->wait(job_id_);
+
+  plan.save();
+  bool closed = close(fd) == 0;
+  if (failed.load() || jobCancelled() || !closed)
+  {
+    std::cerr << "Direct download incomplete, rerun to resume: " << output_file << std::endl;
+    return false;
+  }
+
+  plan.remove();
+  std::cout << "Successfully downloaded " << plan.completedBytes() << " bytes to: " << output_file << std::endl;
+  return true;
+}
@@ -1,80 +1,388 @@
 #pragma once
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <mutex>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <memory>
+#include <functional>
 #include <nlohmann/json.hpp>
 #include <curl/curl.h>
+#include "segment_scheduler.h"
+#include "curl_handle_pool.h"
+#include "segment_decryptor.h"
+#include "decrypt_stage.h"
+#include "ordered_output.h"
+#include "range_plan.h"
+#include "resume_journal.h"
+#include "checksum.h"
+#include "retry_policy.h"
+#include "concurrency_limiter.h"
+#include "token_bucket.h"
+#include "buffer_pool.h"
+#include "variant_selector.h"
+#include "m3u8_parser.h"
+#include "transfer_metrics.h"
+#include "hedge_policy.h"
+#include "path_balancer.h"
+#include "logger.h"
 
 class VideoDownloader
 {
 public:
   struct ProxyConfig
   {
-    bool enabled;
-    std::string type;
+    bool enabled = false;
+    std::string type = "http";
     std::string host;
-    int port;
+    int port = 0;
+  };
+
+  struct BandwidthConfig
+  {
+    int global_kbps = 0; // shared by every transfer in the process, 0 = unlimited
+    int job_kbps = 0;    // per download job, 0 = unlimited
+    int burst_kb = 0;    // 0 = 200 ms worth of traffic
+    bool reload_on_sighup = false; // CLI: SIGHUP re-reads these limits instead of terminating the process
+  };
+
+  struct LiveConfig
+  {
+    int stall_timeout_seconds = 60; // give up when the playlist stops growing, 0 = never
+    bool blocking_reload = true;    // use _HLS_msn when the server supports blocking reloads
+  };
+
+  struct MetricsConfig
+  {
+    std::string json_path;       // JSON summary written at the end of each job, empty = off
+    std::string prometheus_path; // Prometheus text file refreshed while downloading, empty = off
+    int interval_seconds = 5;    // refresh period of prometheus_path
+  };
+
+  struct BufferPoolConfig
+  {
+    int max_mb = 0; // ceiling of in-memory bodies across all downloads in the process, 0 = unlimited
+  };
+
+  struct Http2Config
+  {
+    bool enabled = false; // offer h2 via ALPN; hosts that do not accept it stay on HTTP/1.1
+    int max_streams = 100; // multi engine: concurrent segment streams per connection
+  };
+
+  struct DecryptConfig
+  {
+    int threads = 0; // decrypt stage threads, 0 = half the CPU cores
+  };
+
+  struct JobQueueConfig
+  {
+    int max_active_jobs = 4; // --jobs playlists downloading at the same time
   };
 
   struct Config
   {
     std::string download_path;
-    int thread_count;
-    int timeout_seconds;
-    int retry_count;
+    std::string log_path;  // per-segment messages, stderr when empty
+    std::string log_level = "info"; // "debug", "info", "warn" or "error"
+    int thread_count = 8;
+    int timeout_seconds = 60;
+    int retry_count = 3;
     std::string user_agent;
+    std::string engine = "threads";      // "threads" or "multi"
+    int max_transfers = 64;              // concurrent transfers in multi engine mode
+    std::string output_mode = "merge";   // "merge" or "stream"
+    int reorder_buffer_mb = 256;         // memory bound of the stream mode reorder buffer
+    BufferPoolConfig buffer_pool;        // pooled I/O blocks for segment, playlist and key bodies
+    int stream_window = 0;               // stream mode: segments fetched ahead of the written prefix, 0 = unbounded
+    int direct_chunks = 8;               // byte-range chunks for --direct downloads
+    bool verify_checksums = false;       // re-hash segments against the journal before merging
+    RetryConfig retry;       // backoff and circuit breaker settings
+    ConcurrencyConfig concurrency; // adaptive in-flight segment limit
+    HedgeConfig hedge;       // duplicate requests for straggler segments
+    BandwidthConfig bandwidth;
+    VariantConfig variant;   // master playlist variant selection
+    LiveConfig live;         // --live recordings
+    JobQueueConfig job_queue; // --jobs lists
+    MetricsConfig metrics;   // per-transfer timing histograms
+    Http2Config http2;       // multiplexed segment requests
+    DecryptConfig decrypt;   // AES-128 segments are decrypted off the transfer threads
     ProxyConfig proxy;
+    std::vector<ProxyConfig> proxies; // proxy exits segments are spread over; replaces proxy when set
     std::string url;
     std::string baseurl;
+    std::vector<std::string> mirrors; // base URLs serving the same files as baseurl
     std::string output_name;
     std::string key_baseurl; // Add this field
   };
 
+  // Progress of the running download, reported after every finished
+  // segment (or chunk for direct downloads).
+  struct Progress
+  {
+    size_t done = 0;
+    size_t total = 0;
+    uint64_t bytes = 0; // bytes received by this downloader so far
+  };
+  using ProgressCallback = std::function<void(const Progress &)>;
+
   VideoDownloader();
   ~VideoDownloader();
 
   bool loadConfig(const std::string &config_path);
+  // 不经过JSON文件，直接使用调用方填好的配置
+  bool setConfig(const Config &config);
   bool downloadM3U8(const std::string &url, const std::string &output_name);
   bool loadM3U8FromFile(const std::string &file_path, const std::string &output_name);
   const Config &getConfig() const { return config_; }
 
   // 新增的公共方法
-  bool downloadOnly(const std::string &url_or_file, bool is_file = false);
+  bool downloadOnly(const std::string &url_or_file, const std::string &output_name, bool is_file = false);
   bool mergeOnly(const std::string &output_name);
+  // 直接下载单个文件（如mp4），按字节范围分块并行下载，支持断点续传
+  bool downloadDirect(const std::string &url, const std::string &output_file);
+  // 录制直播流：按目标时长轮询播放列表，新片段出现即下载，遇到EXT-X-ENDLIST结束
+  bool downloadLive(const std::string &url, const std::string &output_name);
+  // 边下载边播放：优先下载最前面缺失的片段，连续的部分立即写到标准输出（"-"）或命名管道
+  bool downloadToPipe(const std::string &url, const std::string &pipe_path);
+  // 作业队列模式：与其他下载器共用worker线程、curl handle和连接缓存，priority为公平调度的权重
+  void shareWorkers(std::shared_ptr<CurlShare> share, std::shared_ptr<CurlHandlePool> handle_pool,
+                    std::shared_ptr<SegmentScheduler> scheduler, std::shared_ptr<TransferMetrics> metrics,
+                    std::shared_ptr<Logger> logger, unsigned priority);
+  // 修改片段、日志和输出文件所在目录，目录不存在时创建
+  bool setDownloadPath(const std::string &path);
+  // 修改媒体播放列表中相对片段URI的前缀（即配置中的video.baseurl）
+  void setBaseUrl(const std::string &baseurl) { config_.baseurl = baseurl; }
+  // 不在控制台打印下载进度，日志文件照常写入
+  void setQuiet(bool quiet) { quiet_ = quiet; }
+  // 本下载器已成功下载的片段字节数（服务器返回的原始字节）
+  uint64_t bytesReceived() const { return bytes_received_.load(); }
+  // 调整带宽限制（KB/s，0表示不限），下载进行中也可调用
+  void setBandwidthLimit(int global_kbps, int job_kbps);
+  // 重新读取配置文件中的bandwidth设置并立即生效
+  bool reloadBandwidthLimit(const std::string &config_path);
+  // 每完成一个片段或分块调用一次，在下载线程中执行，回调需要线程安全且尽快返回
+  void setProgressCallback(ProgressCallback callback) { progress_callback_ = std::move(callback); }
+  // 以下三个方法可在任意线程调用，下载进行中立即生效
+  // 取消当前及之后的下载：正在进行的传输被中止，已完成的片段和断点信息保留，可再次运行续传
+  void cancel();
+  // 暂停派发新的片段和分块请求，正在传输的分块原地等待；resume后继续
+  void pause();
+  void resume();
+  bool cancelled() const { return stop_requested_.load(); }
+  bool paused() const { return paused_.load(); }
 
 private:
-  struct EncryptionInfo
+  // Attempts of one segment that may run at the same time once it is
+  // hedged. The first to finish successfully wins; the others abort and
+  // discard what they received.
+  struct SegmentRace
   {
-    bool enabled = false;
-    std::string method;
-    std::string key_uri;
-    std::vector<uint8_t> key_data;
+    std::atomic<bool> won{false};
+    std::atomic<int> running{0}; // threaded mode: attempts in flight
+    std::atomic<int> path{-1};   // path of the first attempt, the hedge takes another
   };
 
-  bool parseM3U8(const std::string &content, std::vector<std::string> &segments);
-  bool downloadSegment(const std::string &url, const std::string &output_path);
-  bool mergeSegments(const std::vector<std::string> &segments, const std::string &output_file);
-  static size_t WriteCallback(void *contents, size_t size, size_t nmemb, void *userp);
-  void setupCurlProxy(CURL *curl);
-  void setupCurlSSL(CURL *curl);
-  void setupCurlCommonOpts(CURL *curl, char *error_buffer);
-
-  bool downloadKey(const std::string &key_url, std::vector<uint8_t> &key_data);
-  bool decryptSegment(const std::string &input_file, const std::string &output_file,
-                      const std::vector<uint8_t> &key_data);
-
   struct DownloadTask
   {
     std::string url;
     std::string output_path;
     size_t index;
+    std::shared_ptr<SegmentRace> race; // set when hedging is enabled
+    std::shared_ptr<const SegmentCipher> cipher; // set for AES-128 segments
+  };
+
+  // 单次片段下载尝试的状态，线程模式和multi模式共用
+  struct SegmentAttempt
+  {
+    std::string url;
+    std::string output_path;
+    std::string temp_path;
+    size_t index = 0;
+    FILE *fp = nullptr;
+    bool to_memory = false;    // stream mode and encrypted segments: the body stays in the pool
+    PooledBuffer body;         // only used when to_memory
+    OrderedOutput *output = nullptr; // stream mode: lets the segment the output waits for overdraw the pool
+    const std::atomic<size_t> *decrypt_backlog = nullptr; // merge mode: encrypted bodies overdraw while it is 0
+    Xxh64 checksum;            // clear segments: recorded in the journal
+    uint64_t received = 0;     // raw bytes from the server
+    uint64_t written = 0;      // bytes stored so far
+    std::string etag;
+    std::shared_ptr<const SegmentCipher> cipher; // set for AES-128 segments, decrypted by the decrypt stage
+    int retry = 0;
+    FailureKind failure = FailureKind::kRetryable;
+    std::chrono::milliseconds retry_after{0}; // from a Retry-After header
+    TokenBucket *job_bandwidth = nullptr;
+    const std::atomic<bool> *cancelled = nullptr; // aborts the transfer when set
+    std::shared_ptr<SegmentRace> race;            // aborts the transfer once another attempt won
+    bool hedge = false;                           // duplicate request on a fresh connection
+    bool lost = false;                            // another attempt delivered the segment
+    CURL *easy = nullptr;                         // multi mode: the transfer while it is in the engine
+    int path = -1;                                // PathBalancer path, -1 without mirrors/proxies
+    // multi mode: pauses the transfer until the given time instead of sleeping
+    std::function<void(std::chrono::steady_clock::time_point)> pause;
+    std::chrono::steady_clock::time_point resume_at{};
+    char error_buffer[CURL_ERROR_SIZE] = {0};
+  };
+
+  struct DirectProbe
+  {
+    uint64_t size = 0;
+    std::string etag;
+    bool ranges = false;
+  };
+
+  struct ChunkWriteContext
+  {
+    RangePlan *plan = nullptr;
+    RangePlan::Chunk *chunk = nullptr;
+    CURL *curl = nullptr;
+    int fd = -1;
+    bool ranges = false;
+    bool code_checked = false;
+    uint64_t unsaved = 0;
+    TokenBucket *job_bandwidth = nullptr;
+    VideoDownloader *owner = nullptr; // pause/cancel checks
+  };
+
+  // Conditional request state of a polled playlist.
+  struct PlaylistValidators
+  {
+    std::string etag;
+    std::string last_modified;
+    bool not_modified = false; // the last fetch returned 304
+  };
+
+  // Shared state of one threaded download job; live jobs keep adding tasks.
+  struct ThreadedJob
+  {
+    std::atomic<size_t> processed{0};
+    std::atomic<size_t> total{0};
+    std::atomic<bool> failed{false};
+    bool skip_failed = false; // live: leave a gap instead of failing the job
   };
 
-  void downloadSegmentsParallel(const std::vector<DownloadTask> &tasks);
+  // playlist_url非空时相对URI按该地址解析，否则沿用baseurl配置
+  bool parseM3U8(std::string_view content, std::vector<std::string> &segments,
+                 const std::string &playlist_url = "");
+  // validators非空时发送条件请求，304视为成功并设置not_modified
+  bool fetchPlaylist(const std::string &url, std::string &content, PlaylistValidators *validators = nullptr);
+  // 按密钥和媒体序号得到片段的密钥和IV，同一密钥只下载一次；key为空表示片段未加密
+  bool segmentCipher(const PlaylistKey *key, int64_t sequence, std::shared_ptr<const SegmentCipher> &cipher);
+  bool resolvePlaylist(std::string_view content, const std::string &playlist_url,
+                       std::vector<std::string> &segments);
+  bool loadVariant(std::vector<std::string> &segments);
+  bool downloadWithVariants(std::vector<std::string> &segments,
+                            const std::function<bool(const std::vector<std::string> &)> &download);
+  bool jobCancelled() const { return job_cancelled_.load(); }
+  bool downloadSegment(const DownloadTask &task, size_t worker_id, SegmentAttempt &attempt);
+  bool prepareSegmentAttempt(CURL *curl, SegmentAttempt &attempt);
+  bool completeSegmentAttempt(CURL *curl, SegmentAttempt &attempt, CURLcode res);
+  void abandonSegmentAttempt(SegmentAttempt &attempt);
+  // 下载完成的加密片段交给解密阶段，解密后再写入输出或重命名为片段文件
+  void submitDecrypt(SegmentAttempt &attempt, int64_t content_length);
+  bool decryptBody(size_t index, const SegmentCipher &cipher, PooledBuffer &body);
+  bool decryptToOutput(size_t index, const SegmentCipher &cipher, PooledBuffer &body);
+  bool decryptToFile(size_t index, const SegmentCipher &cipher, PooledBuffer &body, const std::string &output_path,
+                     int64_t content_length, const std::string &etag);
+  // 等待解密阶段清空，返回期间是否有片段解密或写出失败
+  bool drainDecrypt();
+  std::chrono::milliseconds retryDelay(const SegmentAttempt &attempt) const;
+  bool mergeSegments(const std::vector<std::string> &segments, const std::string &output_file,
+                     ResumeJournal *journal = nullptr);
+  bool verifySegment(const std::string &path, const ResumeJournal::Record &record) const;
+  static size_t WriteCallback(void *contents, size_t size, size_t nmemb, void *userp);
+  static size_t SegmentWriteCallback(void *contents, size_t size, size_t nmemb, void *userp);
+  static size_t SegmentHeaderCallback(char *buffer, size_t size, size_t nitems, void *userp);
+  static int SegmentProgressCallback(void *userp, curl_off_t, curl_off_t, curl_off_t, curl_off_t);
+  static bool writeSegmentData(SegmentAttempt &attempt, const uint8_t *data, size_t len);
+  static std::chrono::nanoseconds throttleDelay(TokenBucket *job_bandwidth, size_t len);
+  static TokenBucket &globalBandwidth();
+  static BufferPool &bufferPool();
+  // 流式输出重排序缓冲区的上限，缓冲池有上限时最多占一半，其余留给下载中的片段
+  size_t reorderBufferBytes() const;
+  void setupCurlProxy(CURL *curl, const ProxyConfig &proxy);
+  void setupCurlSSL(CURL *curl);
+  void setupCurlCommonOpts(CURL *curl, char *error_buffer);
+
+  bool downloadKey(const std::string &key_url, std::vector<uint8_t> &key_data);
+
+  bool downloadAndMerge(const std::vector<std::string> &segments, const std::string &output_name);
+  bool downloadStreaming(const std::vector<std::string> &segments, const std::string &output_path,
+                         bool pipe = false);
   bool processDownloadTasks(std::vector<DownloadTask> &tasks);
-  bool isSegmentComplete(const std::string &filepath) const;
+  void beginJob(size_t total_segments);
+  void endJob();
+  bool applyConfig();
+  // 暂停期间阻塞调用线程，取消或恢复时返回；返回false表示已取消
+  bool waitWhilePaused();
+  // 暂停期间片段请求推迟的间隔
+  static constexpr std::chrono::milliseconds kPausePoll{200};
+  // 缓冲池用尽时传输暂停后再次尝试的间隔
+  static constexpr std::chrono::milliseconds kBufferPoll{20};
+  // 控制台进度行，每秒最多打印一次，最后一个完成时总会打印
+  void reportProgress(size_t done, size_t total, const char *unit, uint64_t bytes);
+  bool processDownloadTasksThreaded(std::vector<DownloadTask> &tasks);
+  // avoid_path为上一次失败的尝试所用的路径，重试时换一个镜像或代理
+  void submitThreadedAttempt(ThreadedJob &job, const DownloadTask *task, int retry, int avoid_path = -1);
+  // 片段运行时间超过阈值时在另一个worker上发出重复请求
+  void submitThreadedHedge(ThreadedJob &job, const DownloadTask *task, int retry, std::chrono::milliseconds delay);
+  void finishThreadedSegment(ThreadedJob &job, const DownloadTask *task);
+  bool processDownloadTasksMulti(std::vector<DownloadTask> &tasks);
+  bool prepareSegmentTasks(const std::vector<std::string> &segments, const std::string &output_name,
+                           std::vector<DownloadTask> &tasks, std::vector<std::string> &segment_files);
+  std::string journalPath(const std::string &output_name) const;
+  void ensureWorkers();
+  size_t workerCount() const;
+  // 为一次片段请求选择镜像和代理；需要等待（暂停、熔断）时返回等待时间，path为-1表示不分路径
+  std::chrono::milliseconds choosePath(const std::string &url, int avoid, int &path);
+  // 熔断器的主机键：有多个镜像或代理时按路径区分
+  std::string breakerKey(const std::string &url, int path) const;
+  // 播放列表、密钥等非片段请求使用的代理
+  const ProxyConfig &defaultProxy() const { return config_.proxies.empty() ? config_.proxy : config_.proxies.front(); }
+
+  static size_t HeaderCallback(char *buffer, size_t size, size_t nitems, void *userp);
+  static size_t ChunkWriteCallback(void *contents, size_t size, size_t nmemb, void *userp);
+  bool probeDirect(const std::string &url, DirectProbe &probe);
+  bool downloadChunk(RangePlan &plan, size_t chunk_index, int fd,
+                     const std::string &url, bool ranges, size_t worker_id);
 
+  CurlGlobal curl_global_; // first member: libcurl stays initialised until everything else is gone
   Config config_;
   std::shared_ptr<CURL> curl_;
-  EncryptionInfo encryption_;
+  std::map<std::string, std::vector<uint8_t>> keys_;              // downloaded keys by URI
+  std::vector<std::shared_ptr<const SegmentCipher>> segment_ciphers_; // per segment of the parsed playlist
+  std::shared_ptr<CurlShare> share_;
+  std::shared_ptr<CurlHandlePool> handle_pool_;
+  std::shared_ptr<SegmentScheduler> scheduler_;
+  SegmentScheduler::JobId job_id_ = SegmentScheduler::kDefaultJob; // fair-share lane in a shared scheduler
+  std::shared_ptr<Logger> logger_;
+  std::shared_ptr<TransferMetrics> metrics_;
+  std::unique_ptr<MetricsExporter> metrics_exporter_; // declared after metrics_ so it stops first
+  HostCircuitBreaker breaker_{config_.retry};
+  std::unique_ptr<OrderedOutput> ordered_output_; // set while a stream mode download runs
+  std::unique_ptr<ResumeJournal> journal_;        // set while segment files are downloaded
+  std::unique_ptr<ConcurrencyLimiter> limiter_;   // set while an adaptive download runs
+  std::unique_ptr<HedgePolicy> hedge_;            // set when hedging is enabled
+  std::unique_ptr<PathBalancer> paths_;           // set when several mirrors or proxies are configured
+  TokenBucket job_bandwidth_;
+  std::unique_ptr<VariantSelector> variant_selector_; // set when a master playlist is used
+  std::atomic<bool> job_cancelled_{false};            // stops the running job's transfers
+  std::atomic<bool> stop_requested_{false};           // cancel(): unlike a variant switch, never restarts
+  std::atomic<bool> paused_{false};
+  std::mutex pause_mutex_;
+  std::condition_variable pause_cv_;
+  ProgressCallback progress_callback_;
+  std::atomic<uint64_t> bytes_received_{0};
+  bool quiet_ = false;
+  std::atomic<int64_t> last_progress_ms_{0}; // console progress line rate limit
+  size_t dispatch_window_ = 0; // stream mode: segments allowed ahead of the written prefix, 0 = all
+  std::atomic<bool> decrypt_failed_{false};   // a segment could not be decrypted or written out
+  std::atomic<uint64_t> decrypted_segments_{0};
+  std::atomic<uint64_t> decrypted_bytes_{0};
+  std::atomic<size_t> decrypt_backlog_{0}; // encrypted bodies handed to the decrypt stage and not yet written
+  std::mutex decrypt_mutex_;
+  std::unique_ptr<DecryptStage> decrypt_stage_; // created with the first encrypted segment; last member so it stops first
 };